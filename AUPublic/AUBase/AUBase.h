@@ -79,6 +79,13 @@
 	#endif
 #endif
 
+// MusicDeviceMIDIEventList (Universal MIDI Packet input) needs the macOS 12 SDK
+#if !CA_BASIC_AU_FEATURES && defined(MAC_OS_VERSION_12_0)
+	#define CA_AU_MIDI_EVENT_LIST 1
+#else
+	#define CA_AU_MIDI_EVENT_LIST 0
+#endif
+
 #ifndef AUTRACE
 	#define AUTRACE(code, obj, a, b, c, d)
 #endif	
@@ -725,6 +732,12 @@ public:
 	/*! @method SysEx */
 	virtual OSStatus	SysEx(			const UInt8 *				inData, 
 										UInt32 						inLength) { return kAudio_UnimplementedError;}
+
+#if CA_AU_MIDI_EVENT_LIST
+	/*! @method MIDIEventList */
+	virtual OSStatus	MIDIEventList(	UInt32						inOffsetSampleFrame,
+										const struct MIDIEventList *	inEventList) { return kAudio_UnimplementedError; }
+#endif
 										
 	/*! @method StartNote */
 	virtual OSStatus	StartNote(		MusicDeviceInstrumentID 	inInstrument, 
@@ -460,6 +460,19 @@ static OSStatus AUMethodSysEx(void *self, const UInt8 *inData, UInt32 inLength)
 	return result;
 }
 
+#if CA_AU_MIDI_EVENT_LIST
+static OSStatus AUMethodMIDIEventList(void *self, UInt32 inOffsetSampleFrame, const struct MIDIEventList *inEventList)
+{
+	OSStatus result = noErr;
+	try {
+		// this is a potential render-time method; no lock
+		result = AUI->MIDIEventList(inOffsetSampleFrame, inEventList);
+	}
+	COMPONENT_CATCH
+	return result;
+}
+#endif
+
 static OSStatus AUMethodStartNote(void *self, MusicDeviceInstrumentID inInstrument, MusicDeviceGroupID inGroupID, NoteInstanceID *outNoteInstanceID, UInt32 inOffsetSampleFrame, const MusicDeviceNoteParams *inParams)
 {
 	OSStatus result = noErr;
@@ -610,6 +623,9 @@ inline AudioComponentMethod MIDI_Lookup (SInt16 selector)
 	switch (selector) {
 		case kMusicDeviceMIDIEventSelect:	return (AudioComponentMethod)AUMethodMIDIEvent;
 		case kMusicDeviceSysExSelect:		return (AudioComponentMethod)AUMethodSysEx;
+#if CA_AU_MIDI_EVENT_LIST
+		case kMusicDeviceMIDIEventListSelect:	return (AudioComponentMethod)AUMethodMIDIEventList;
+#endif
 		default:
 			break;
 	}
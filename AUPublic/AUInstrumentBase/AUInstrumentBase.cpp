@@ -223,55 +223,60 @@ void		AUInstrumentBase::PerformEvents(const AudioTimeStamp& inTimeStamp)
 #if DEBUG_PRINT_RENDER
 	printf("AUInstrumentBase::PerformEvents\n");
 #endif
-	SynthEvent *event;
+	SynthEvent *events;
 	SynthGroupElement *group;
+	UInt32 count;
 	
-	while ((event = mEventQueue.ReadItem()) != NULL)
+		// a run of events at a time, handed back in one go
+	while ((count = mEventQueue.ReadableItems(events)) > 0)
 	{
+		for (SynthEvent *event = events; event < events + count; ++event)
+		{
 #if DEBUG_PRINT_RENDER
-		printf("event %08X %d\n", event, event->GetEventType());
+			printf("event %08X %d\n", event, event->GetEventType());
 #endif
-		switch(event->GetEventType())
-		{
-			case SynthEvent::kEventType_NoteOn :
-				RealTimeStartNote(GetElForGroupID (event->GetGroupID()), event->GetNoteID(),
-									event->GetOffsetSampleFrame(), *event->GetParams());
-				break;
-			case SynthEvent::kEventType_NoteOff :
-				RealTimeStopNote(event->GetGroupID(), event->GetNoteID(),
-					event->GetOffsetSampleFrame());
-				break;
-			case SynthEvent::kEventType_SustainOn :
-				group = GetElForGroupID (event->GetGroupID());
-				group->SustainOn(event->GetOffsetSampleFrame());
-				break;
-			case SynthEvent::kEventType_SustainOff :
-				group = GetElForGroupID (event->GetGroupID());
-				group->SustainOff(event->GetOffsetSampleFrame());
-				break;
-			case SynthEvent::kEventType_SostenutoOn :
-				group = GetElForGroupID (event->GetGroupID());
-				group->SostenutoOn(event->GetOffsetSampleFrame());
-				break;
-			case SynthEvent::kEventType_SostenutoOff :
-				group = GetElForGroupID (event->GetGroupID());
-				group->SostenutoOff(event->GetOffsetSampleFrame());
-				break;
-			case SynthEvent::kEventType_AllNotesOff :
-				group = GetElForGroupID (event->GetGroupID());
-				group->AllNotesOff(event->GetOffsetSampleFrame());
-				break;
-			case SynthEvent::kEventType_AllSoundOff :
-				group = GetElForGroupID (event->GetGroupID());
-				group->AllSoundOff(event->GetOffsetSampleFrame());
-				break;
-			case SynthEvent::kEventType_ResetAllControllers :
-				group = GetElForGroupID (event->GetGroupID());
-				group->ResetAllControllers(event->GetOffsetSampleFrame());
-				break;
+			switch(event->GetEventType())
+			{
+				case SynthEvent::kEventType_NoteOn :
+					RealTimeStartNote(GetElForGroupID (event->GetGroupID()), event->GetNoteID(),
+										event->GetOffsetSampleFrame(), *event->GetParams());
+					break;
+				case SynthEvent::kEventType_NoteOff :
+					RealTimeStopNote(event->GetGroupID(), event->GetNoteID(),
+						event->GetOffsetSampleFrame());
+					break;
+				case SynthEvent::kEventType_SustainOn :
+					group = GetElForGroupID (event->GetGroupID());
+					group->SustainOn(event->GetOffsetSampleFrame());
+					break;
+				case SynthEvent::kEventType_SustainOff :
+					group = GetElForGroupID (event->GetGroupID());
+					group->SustainOff(event->GetOffsetSampleFrame());
+					break;
+				case SynthEvent::kEventType_SostenutoOn :
+					group = GetElForGroupID (event->GetGroupID());
+					group->SostenutoOn(event->GetOffsetSampleFrame());
+					break;
+				case SynthEvent::kEventType_SostenutoOff :
+					group = GetElForGroupID (event->GetGroupID());
+					group->SostenutoOff(event->GetOffsetSampleFrame());
+					break;
+				case SynthEvent::kEventType_AllNotesOff :
+					group = GetElForGroupID (event->GetGroupID());
+					group->AllNotesOff(event->GetOffsetSampleFrame());
+					break;
+				case SynthEvent::kEventType_AllSoundOff :
+					group = GetElForGroupID (event->GetGroupID());
+					group->AllSoundOff(event->GetOffsetSampleFrame());
+					break;
+				case SynthEvent::kEventType_ResetAllControllers :
+					group = GetElForGroupID (event->GetGroupID());
+					group->ResetAllControllers(event->GetOffsetSampleFrame());
+					break;
+			}
 		}
 		
-		mEventQueue.AdvanceReadPtr();
+		mEventQueue.AdvanceReadPtr(count);
 	}
 }
 
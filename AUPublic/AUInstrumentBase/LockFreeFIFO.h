@@ -44,19 +44,87 @@
  Copyright (C) 2014 Apple Inc. All Rights Reserved.
  
 */
-#include <libkern/OSAtomic.h>
+#ifndef __LockFreeFIFO_h__
+#define __LockFreeFIFO_h__
+
+// Single producer, single consumer queues. The writer and the reader each own
+// their index and only read the other's, with acquire/release ordering, and
+// each side keeps the last value it saw of the other's index so it only goes
+// back to the shared one when that value says the queue is full (or empty).
+// The two sides live on separate cache lines. WriteItems, ReadItems and
+// ReadableItems move a whole run of items per index update.
+//
+// Sizes must be powers of two; that many items fit. Indices run freely and
+// are masked on access.
+
+#if __cplusplus >= 201103L
+#include <atomic>
+#endif
+#include <algorithm>
+
+enum {
+		// Apple silicon has 128 byte lines, and Intel parts fetch 64 byte lines
+		// in pairs, so 128 keeps the two sides apart on both.
+	kLockFreeFIFOCacheLineSize = 128
+};
+
+class LockFreeFIFOIndex
+{
+public:
+	LockFreeFIFOIndex() : mValue(0) {}
+	
+#if __cplusplus >= 201103L
+		// the other side's index
+	UInt32 Load() const			{ return mValue.load(std::memory_order_acquire); }
+		// our own index, which only we write
+	UInt32 LoadOwn() const		{ return mValue.load(std::memory_order_relaxed); }
+	void Store(UInt32 inValue)	{ mValue.store(inValue, std::memory_order_release); }
+private:
+	std::atomic<UInt32> mValue;
+#else
+		// the same orderings from the GCC/Clang builtins std::atomic is built on
+	UInt32 Load() const			{ return __atomic_load_n(&mValue, __ATOMIC_ACQUIRE); }
+	UInt32 LoadOwn() const		{ return __atomic_load_n(&mValue, __ATOMIC_RELAXED); }
+	void Store(UInt32 inValue)	{ __atomic_store_n(&mValue, inValue, __ATOMIC_RELEASE); }
+private:
+	UInt32 mValue;
+#endif
+	
+	LockFreeFIFOIndex(const LockFreeFIFOIndex&);
+	LockFreeFIFOIndex& operator=(const LockFreeFIFOIndex&);
+};
+
+	// Copies between a flat array and the ring starting at inIndex, in at most two runs.
+template <class ITEM>
+inline void LockFreeFIFOCopyIn(ITEM *ioRing, UInt32 inMask, UInt32 inIndex, const ITEM *inItems, UInt32 inCount)
+{
+	UInt32 start = inIndex & inMask, first = std::min(inCount, inMask + 1 - start);
+	std::copy(inItems, inItems + first, ioRing + start);
+	std::copy(inItems + first, inItems + inCount, ioRing);
+}
 
+template <class ITEM>
+inline void LockFreeFIFOCopyOut(const ITEM *inRing, UInt32 inMask, UInt32 inIndex, ITEM *outItems, UInt32 inCount)
+{
+	UInt32 start = inIndex & inMask, first = std::min(inCount, inMask + 1 - start);
+	std::copy(inRing + start, inRing + start + first, outItems);
+	std::copy(inRing, inRing + inCount - first, outItems + first);
+}
+
+	// Items read are handed back to the writer, which calls Free() on each
+	// before reusing its slot, so whatever an item owns is released on the
+	// writing thread. That happens when the writer runs out of room, and on
+	// Reset.
 template <class ITEM>
 class LockFreeFIFOWithFree
 {
 	LockFreeFIFOWithFree(); // private, unimplemented.
+	LockFreeFIFOWithFree(const LockFreeFIFOWithFree&);
+	LockFreeFIFOWithFree& operator=(const LockFreeFIFOWithFree&);
 public:
 	LockFreeFIFOWithFree(UInt32 inMaxSize)
-		: mReadIndex(0), mWriteIndex(0), mFreeIndex(0)
+		: mItems(new ITEM[inMaxSize]), mMask(inMaxSize - 1), mFreeIndex(0), mCachedWriteIndex(0)
 	{
-		//assert(IsPowerOfTwo(inMaxSize));
-		mItems = new ITEM[inMaxSize];
-		mMask = inMaxSize - 1;
 	}
 	
 	~LockFreeFIFOWithFree()
@@ -64,53 +132,89 @@ public:
 		delete [] mItems;
 	}
 
-	
+		// not thread safe
 	void Reset() 
 	{
 		FreeItems();
-		mReadIndex = 0;
-		mWriteIndex = 0;
+		mWriteIndex.Store(0);
+		mReadIndex.Store(0);
 		mFreeIndex = 0;
+		mCachedWriteIndex = 0;
 	}
 	
+		// writer
 	ITEM* WriteItem() 
 	{
-		//printf("WriteItem %d %d\n", mReadIndex, mWriteIndex);
-		FreeItems(); // free items on the write thread.
-		int32_t nextWriteIndex = (mWriteIndex + 1) & mMask;
-		if (nextWriteIndex == mFreeIndex) return NULL;
-		return &mItems[mWriteIndex];
+		if (Writable(1) == 0) return NULL;
+		return &mItems[mWriteIndex.LoadOwn() & mMask];
+	}
+	void AdvanceWritePtr(UInt32 inCount = 1) { mWriteIndex.Store(mWriteIndex.LoadOwn() + inCount); }
+	
+		// returns how many of inItems fit
+	UInt32 WriteItems(const ITEM *inItems, UInt32 inCount)
+	{
+		inCount = std::min(inCount, Writable(inCount));
+		LockFreeFIFOCopyIn(mItems, mMask, mWriteIndex.LoadOwn(), inItems, inCount);
+		AdvanceWritePtr(inCount);
+		return inCount;
 	}
 	
+		// reader
 	ITEM* ReadItem() 
 	{
-		//printf("ReadItem %d %d\n", mReadIndex, mWriteIndex);
-		if (mReadIndex == mWriteIndex) return NULL;
-		return &mItems[mReadIndex];
+		if (Readable(1) == 0) return NULL;
+		return &mItems[mReadIndex.LoadOwn() & mMask];
 	}
-	void AdvanceWritePtr() { OSAtomicCompareAndSwap32(mWriteIndex, (mWriteIndex + 1) & mMask, &mWriteIndex); }
-	void AdvanceReadPtr()  { OSAtomicCompareAndSwap32(mReadIndex,  (mReadIndex  + 1) & mMask, &mReadIndex); }
+	void AdvanceReadPtr(UInt32 inCount = 1) { mReadIndex.Store(mReadIndex.LoadOwn() + inCount); }
+	
+		// Points outItems at the run of items up to the end of the ring, to be
+		// used in place and then passed on with AdvanceReadPtr(count).
+	UInt32 ReadableItems(ITEM* &outItems)
+	{
+		UInt32 read = mReadIndex.LoadOwn();
+		outItems = &mItems[read & mMask];
+		return std::min(Readable(1), mMask + 1 - (read & mMask));
+	}
+
 private:
-	ITEM* FreeItem() 
+		// Frees everything read since the last call, and returns the room left,
+		// going back to the reader's index only if less than inWanted.
+	UInt32 Writable(UInt32 inWanted)
 	{
-		if (mFreeIndex == mReadIndex) return NULL;
-		return &mItems[mFreeIndex];
+		UInt32 room = mMask + 1 - (mWriteIndex.LoadOwn() - mFreeIndex);
+		if (room < inWanted) {
+			FreeItems();
+			room = mMask + 1 - (mWriteIndex.LoadOwn() - mFreeIndex);
+		}
+		return room;
 	}
-	void AdvanceFreePtr() { OSAtomicCompareAndSwap32(mFreeIndex, (mFreeIndex + 1) & mMask, &mFreeIndex); }
 	
 	void FreeItems() 
 	{
-		ITEM* item;
-		while ((item = FreeItem()) != NULL)
-		{
-			item->Free();
-			AdvanceFreePtr();
-		}
+		for (UInt32 read = mReadIndex.Load(); mFreeIndex != read; ++mFreeIndex)
+			mItems[mFreeIndex & mMask].Free();
 	}
 	
-	volatile int32_t mReadIndex, mWriteIndex, mFreeIndex;
-	int32_t mMask;
+	UInt32 Readable(UInt32 inWanted)
+	{
+		UInt32 read = mReadIndex.LoadOwn();
+		if (mCachedWriteIndex - read < inWanted)
+			mCachedWriteIndex = mWriteIndex.Load();
+		return mCachedWriteIndex - read;
+	}
+	
+		// shared, fixed
 	ITEM *mItems;
+	UInt32 mMask;
+	char mPad0[kLockFreeFIFOCacheLineSize];
+		// writer
+	LockFreeFIFOIndex mWriteIndex;
+	UInt32 mFreeIndex;				// the writer's view of the read index
+	char mPad1[kLockFreeFIFOCacheLineSize];
+		// reader
+	LockFreeFIFOIndex mReadIndex;
+	UInt32 mCachedWriteIndex;
+	char mPad2[kLockFreeFIFOCacheLineSize];
 };
 
 
@@ -121,13 +225,12 @@ template <class ITEM>
 class LockFreeFIFO
 {
 	LockFreeFIFO(); // private, unimplemented.
+	LockFreeFIFO(const LockFreeFIFO&);
+	LockFreeFIFO& operator=(const LockFreeFIFO&);
 public:
 	LockFreeFIFO(UInt32 inMaxSize)
-		: mReadIndex(0), mWriteIndex(0)
+		: mItems(new ITEM[inMaxSize]), mMask(inMaxSize - 1), mCachedReadIndex(0), mCachedWriteIndex(0)
 	{
-		//assert(IsPowerOfTwo(inMaxSize));
-		mItems = new ITEM[inMaxSize];
-		mMask = inMaxSize - 1;
 	}
 	
 	~LockFreeFIFO()
@@ -135,34 +238,87 @@ public:
 		delete [] mItems;
 	}
 	
+		// not thread safe
 	void Reset() 
 	{
-		mReadIndex = 0;
-		mWriteIndex = 0;
+		mWriteIndex.Store(0);
+		mReadIndex.Store(0);
+		mCachedReadIndex = 0;
+		mCachedWriteIndex = 0;
 	}
 	
+		// writer
 	ITEM* WriteItem() 
 	{
-		int32_t nextWriteIndex = (mWriteIndex + 1) & mMask;
-		if (nextWriteIndex == mReadIndex) return NULL;
-		return &mItems[mWriteIndex];
+		if (Writable(1) == 0) return NULL;
+		return &mItems[mWriteIndex.LoadOwn() & mMask];
+	}
+	void AdvanceWritePtr(UInt32 inCount = 1) { mWriteIndex.Store(mWriteIndex.LoadOwn() + inCount); }
+	
+		// returns how many of inItems fit
+	UInt32 WriteItems(const ITEM *inItems, UInt32 inCount)
+	{
+		inCount = std::min(inCount, Writable(inCount));
+		LockFreeFIFOCopyIn(mItems, mMask, mWriteIndex.LoadOwn(), inItems, inCount);
+		AdvanceWritePtr(inCount);
+		return inCount;
 	}
 	
+		// reader
 	ITEM* ReadItem() 
 	{
-		if (mReadIndex == mWriteIndex) return NULL;
-		return &mItems[mReadIndex];
+		if (Readable(1) == 0) return NULL;
+		return &mItems[mReadIndex.LoadOwn() & mMask];
+	}
+	void AdvanceReadPtr(UInt32 inCount = 1) { mReadIndex.Store(mReadIndex.LoadOwn() + inCount); }
+	
+		// returns how many items were copied to outItems
+	UInt32 ReadItems(ITEM *outItems, UInt32 inMaxCount)
+	{
+		inMaxCount = std::min(inMaxCount, Readable(inMaxCount));
+		LockFreeFIFOCopyOut(mItems, mMask, mReadIndex.LoadOwn(), outItems, inMaxCount);
+		AdvanceReadPtr(inMaxCount);
+		return inMaxCount;
 	}
 	
-		// the CompareAndSwap will always succeed. We use CompareAndSwap because it calls the PowerPC sync instruction,
-		// plus any processor bug workarounds for various CPUs.
-	void AdvanceWritePtr() { OSAtomicCompareAndSwap32(mWriteIndex, (mWriteIndex + 1) & mMask, &mWriteIndex); }
-	void AdvanceReadPtr()  { OSAtomicCompareAndSwap32(mReadIndex,  (mReadIndex  + 1) & mMask, &mReadIndex); }
+		// see LockFreeFIFOWithFree::ReadableItems
+	UInt32 ReadableItems(ITEM* &outItems)
+	{
+		UInt32 read = mReadIndex.LoadOwn();
+		outItems = &mItems[read & mMask];
+		return std::min(Readable(1), mMask + 1 - (read & mMask));
+	}
 	
 private:
+		// the room left, going back to the reader's index only if less than inWanted
+	UInt32 Writable(UInt32 inWanted)
+	{
+		UInt32 write = mWriteIndex.LoadOwn();
+		if (mMask + 1 - (write - mCachedReadIndex) < inWanted)
+			mCachedReadIndex = mReadIndex.Load();
+		return mMask + 1 - (write - mCachedReadIndex);
+	}
+	
+	UInt32 Readable(UInt32 inWanted)
+	{
+		UInt32 read = mReadIndex.LoadOwn();
+		if (mCachedWriteIndex - read < inWanted)
+			mCachedWriteIndex = mWriteIndex.Load();
+		return mCachedWriteIndex - read;
+	}
 	
-	volatile int32_t mReadIndex, mWriteIndex;
-	int32_t mMask;
+		// shared, fixed
 	ITEM *mItems;
+	UInt32 mMask;
+	char mPad0[kLockFreeFIFOCacheLineSize];
+		// writer
+	LockFreeFIFOIndex mWriteIndex;
+	UInt32 mCachedReadIndex;
+	char mPad1[kLockFreeFIFOCacheLineSize];
+		// reader
+	LockFreeFIFOIndex mReadIndex;
+	UInt32 mCachedWriteIndex;
+	char mPad2[kLockFreeFIFOCacheLineSize];
 };
 
+#endif
@@ -58,6 +58,7 @@ enum
 	kMidiMessage_ProgramChange 		= 0xC0,
 	kMidiMessage_ChannelPressure 	= 0xD0,
 	kMidiMessage_PitchWheel 		= 0xE0,
+	kMidiMessage_SysEx				= 0xF0,
 
 	kMidiController_AllSoundOff			= 120,
 	kMidiController_ResetAllControllers	= 121,
@@ -65,15 +66,20 @@ enum
 };
 
 AUMIDIBase::AUMIDIBase(AUBase* inBase) 
-	: mAUBaseInstance (*inBase) 
+	: mAUBaseInstance (*inBase),
+	  mSysExBuffer (new UInt8[kDefaultMaxSysExLength]),
+	  mMaxSysExLength (kDefaultMaxSysExLength),
+	  mSysExLength (0),
+	  mSysExOverflow (false)
 {
 #if CA_AUTO_MIDI_MAP
-	mMapManager = new CAAUMIDIMapManager();
+	mMapManager = new CAAUMIDIMapManager(*inBase);
 #endif
 }
 
 AUMIDIBase::~AUMIDIBase() 
 {
+	delete[] mSysExBuffer;
 #if CA_AUTO_MIDI_MAP
 	if (mMapManager) 
 		delete mMapManager;
@@ -272,46 +278,6 @@ OSStatus			AUMIDIBase::DelegateSetProperty(	AudioUnitPropertyID 			inID,
 #pragma mark ____MidiDispatch
 
 
-inline const Byte *	NextMIDIEvent(const Byte *event, const Byte *end)
-{
-	Byte c = *event;
-	switch (c >> 4) {
-	default:	// data byte -- assume in sysex
-		while ((*++event & 0x80) == 0 && event < end)
-			;
-		break;
-	case 0x8:
-	case 0x9:
-	case 0xA:
-	case 0xB:
-	case 0xE:
-		event += 3;
-		break;
-	case 0xC:
-	case 0xD:
-		event += 2;
-		break;
-	case 0xF:
-		switch (c) {
-		case 0xF0:
-			while ((*++event & 0x80) == 0 && event < end)
-				;
-			break;
-		case 0xF1:
-		case 0xF3:
-			event += 2;
-			break;
-		case 0xF2:
-			event += 3;
-			break;
-		default:
-			++event;
-			break;
-		}
-	}
-	return (event >= end) ? end : event;
-}
-
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 //	AUMIDIBase::HandleMIDIPacketList
 //
@@ -325,21 +291,60 @@ OSStatus			AUMIDIBase::HandleMIDIPacketList(const MIDIPacketList *pktlist)
 	
 	while (nPackets-- > 0) {
 		const Byte *event = pkt->data, *packetEnd = event + pkt->length;
-		long startFrame = (long)pkt->timeStamp;
-		while (event < packetEnd) {
-			Byte status = event[0];
-			if (status & 0x80) {
-				// really a status byte (not sysex continuation)
-				HandleMidiEvent(status & 0xF0, status & 0x0F, event[1], event[2], static_cast<UInt32>(startFrame));
-					// note that we're generating a bogus channel number for system messages (0xF0-FF)
-			}
-			event = NextMIDIEvent(event, packetEnd);
+		UInt32 startFrame = static_cast<UInt32>(pkt->timeStamp);
+		AUMIDIMessage message;
+		while (mPacketParser.Next(event, packetEnd, message)) {
+			if (message.status == kMidiMessage_SysEx)
+				HandleSysExPiece(message);
+			else
+				HandleMidiEvent(message.status & 0xF0, message.status & 0x0F, message.data1, message.data2, startFrame);
+					// note that we're generating a bogus channel number for system messages (0xF1-FF)
 		}
-		pkt = reinterpret_cast<const MIDIPacket *>(packetEnd);
+		pkt = MIDIPacketNext(pkt);
 	}
 	return noErr;
 }
 
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	AUMIDIBase::HandleSysExPiece
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void				AUMIDIBase::HandleSysExPiece(const AUMIDIMessage &inMessage)
+{
+	const UInt8 kWhole = AUMIDIMessage::kSysExStart | AUMIDIMessage::kSysExEnd;
+	if (inMessage.sysExFlags == kWhole) {
+		// all in one packet: no need to copy
+		HandleSysEx(inMessage.sysExData, inMessage.sysExLength);
+		return;
+	}
+	
+	if (inMessage.sysExFlags & AUMIDIMessage::kSysExStart) {
+		mSysExLength = 0;
+		mSysExOverflow = false;
+	}
+	if (mSysExLength + inMessage.sysExLength > mMaxSysExLength)
+		mSysExOverflow = true;
+	if (!mSysExOverflow) {
+		memcpy(mSysExBuffer + mSysExLength, inMessage.sysExData, inMessage.sysExLength);
+		mSysExLength += inMessage.sysExLength;
+	}
+	if ((inMessage.sysExFlags & AUMIDIMessage::kSysExEnd) && !mSysExOverflow && mSysExLength > 0)
+		HandleSysEx(mSysExBuffer, mSysExLength);
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	AUMIDIBase::SetMaxSysExLength
+//
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void				AUMIDIBase::SetMaxSysExLength(UInt32 inLength)
+{
+	delete[] mSysExBuffer;
+	mSysExBuffer = new UInt8[inLength];
+	mMaxSysExLength = inLength;
+	mSysExLength = 0;
+	mSysExOverflow = false;
+}
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 //	AUMIDIBase::HandleMidiEvent
 //
@@ -351,10 +356,8 @@ OSStatus 	AUMIDIBase::HandleMidiEvent(UInt8 status, UInt8 channel, UInt8 data1,
 #if CA_AUTO_MIDI_MAP	
 // you potentially have a choice to make here - if a param mapping matches, do you still want to process the 
 // MIDI event or not. The default behaviour is to continue on with the MIDI event.
-	if (mMapManager->HandleHotMapping (status, channel, data1, mAUBaseInstance)) {
-		mAUBaseInstance.PropertyChanged (kAudioUnitProperty_HotMapParameterMIDIMapping, kAudioUnitScope_Global, 0);
-	}
-	else {
+// A hot-mapped event is announced by the map manager's worker thread, not from here.
+	if (!mMapManager->HandleHotMapping (status, channel, data1, mAUBaseInstance)) {
 		mMapManager->FindParameterMapEventMatch(status, channel, data1, data2, inStartFrame, mAUBaseInstance);
 	}	
 #endif	
@@ -48,6 +48,7 @@
 #define __AUMIDIBase_h__
 
 #include "AUBase.h"
+#include "AUMIDIParser.h"
 
 #if CA_AUTO_MIDI_MAP
 	#include "CAAUMIDIMapManager.h"
@@ -80,12 +81,18 @@ public:
 	}
 	
 	/*! @method HandleMIDIPacketList */
-	OSStatus			HandleMIDIPacketList(const MIDIPacketList *pktlist);
+	virtual OSStatus	HandleMIDIPacketList(const MIDIPacketList *pktlist);
 	
 	/*! @method SysEx */
 	virtual OSStatus	SysEx(			const UInt8 *				inData, 
 										UInt32 						inLength);
 
+#if CA_AU_MIDI_EVENT_LIST
+	/*! @method MIDIEventList */
+	virtual OSStatus	MIDIEventList(	UInt32						inOffsetSampleFrame,
+										const struct MIDIEventList *	inEventList) { return kAudio_UnimplementedError; }
+#endif
+
 #if TARGET_API_MAC_OSX
 	/*! @method DelegateGetPropertyInfo */
 	virtual OSStatus			DelegateGetPropertyInfo(AudioUnitPropertyID			inID,
@@ -191,10 +198,35 @@ protected:
 	
 #endif
 
+	/*! @method PacketParser */
+	AUMIDIParser &				PacketParser() { return mPacketParser; }
+
+	// Hands SysEx from HandleMIDIPacketList to HandleSysEx once it is complete,
+	// assembling it first if it spans packets. Longer than MaxSysExLength(),
+	// it is dropped.
+	/*! @method HandleSysExPiece */
+	void						HandleSysExPiece(const AUMIDIMessage &inMessage);
+
+	enum { kDefaultMaxSysExLength = 65536 };
+
+	// Resizes the assembly buffer, dropping any SysEx in progress. Not real-time
+	// safe; call it from the constructor of a unit that expects longer messages.
+	/*! @method SetMaxSysExLength */
+	void						SetMaxSysExLength(UInt32 inLength);
+	/*! @method MaxSysExLength */
+	UInt32						MaxSysExLength() const { return mMaxSysExLength; }
+
 												
 private:
 	/*! @var mAUBaseInstance */
 	AUBase						& mAUBaseInstance;
+
+	/*! @var mPacketParser */
+	AUMIDIParser				mPacketParser;	// state carries over between packet lists
+	UInt8 *						mSysExBuffer;
+	UInt32						mMaxSysExLength;
+	UInt32						mSysExLength;
+	bool						mSysExOverflow;
 	
 #if CA_AUTO_MIDI_MAP
 	/* map manager */
@@ -0,0 +1,265 @@
+/*
+     File: AUMIDIParser.h
+ Abstract: MIDI 1.0 byte stream parser for AUMIDIBase::HandleMIDIPacketList
+
+ Replaces the old NextMIDIEvent scan. The parser keeps its state between
+ calls, so a stream split into packets parses as if it were one piece:
+ running status carries over, a message cut off by the end of a packet is
+ completed by the next one, and SysEx may span any number of packets.
+ Real-time bytes (0xF8-0xFF) are reported where they occur, also in the
+ middle of another message or of SysEx, and leave the state alone.
+
+ Bytes are never read past the end passed in. Data byte counts come from
+ lookup tables, and runs of data bytes inside SysEx are skipped 16 bytes
+ at a time with SIMD where available.
+*/
+#ifndef __AUMIDIParser_h__
+#define __AUMIDIParser_h__
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__)
+	#define AUMIDI_PARSER_NOINLINE __attribute__((noinline))
+#else
+	#define AUMIDI_PARSER_NOINLINE
+#endif
+
+// data bytes by status: channel messages by high nibble 0x8-0xE, system
+// messages by low nibble
+static const UInt8 kAUMIDIChannelDataLength[8] = { 2, 2, 2, 2, 1, 1, 2, 0 };
+static const UInt8 kAUMIDISystemDataLength[16] = { 0, 1, 2, 1, 0, 0, 0, 0,
+												   0, 0, 0, 0, 0, 0, 0, 0 };
+
+/*! @struct AUMIDIMessage */
+struct AUMIDIMessage {
+	enum {
+		kSysExStart	= 1,	// the piece begins with the 0xF0
+		kSysExEnd	= 2		// the message is complete after this piece
+	};
+
+	UInt8			status;			// with channel; 0xF0 for a piece of SysEx
+	UInt8			data1;			// 0 where the message has no such byte
+	UInt8			data2;
+	// status 0xF0 only; the data points into the input and includes the 0xF0
+	// and 0xF7 if present
+	UInt8			sysExFlags;
+	const UInt8 *	sysExData;
+	UInt32			sysExLength;
+};
+
+/*! @class AUMIDIParser */
+class AUMIDIParser {
+public:
+	/*! @ctor AUMIDIParser */
+	AUMIDIParser() { Reset(); }
+
+	/*! @method Reset */
+	void	Reset()
+	{
+		mRunningStatus = 0;
+		mStatus = 0;
+		mCount = 0;
+		mNeeded = 0;
+		mSysExFlags = 0;
+	}
+
+	// Reads bytes from ioData up to inEnd until a message is complete, then
+	// fills outMessage, advances ioData past it and returns true. Returns
+	// false once all bytes are used up; a partial message is kept for the
+	// next call. SysEx comes out in pieces, one per stretch of it between
+	// packet boundaries or interleaved real-time bytes; a SysEx message cut
+	// short by another status byte ends without the 0xF7.
+	/*! @method Next */
+	bool	Next(const UInt8 *&ioData, const UInt8 *inEnd, AUMIDIMessage &outMessage)
+	{
+		// the common case, kept small enough to inline: a whole channel
+		// message, with its status byte or in running status. Both data bytes
+		// are tested at once and nothing is looked up in a table.
+		const UInt8 *p = ioData;
+		if (mStatus == 0 && inEnd - p >= 3) {
+			UInt32 status = p[0];
+			const UInt8 *data = p + 1;
+			if (status < 0x80) {
+				status = mRunningStatus;	// 0 if there is none
+				data = p;
+			}
+			if (status - 0x80 < 0x40 || status - 0xE0 < 0x10) {
+				if (((data[0] | data[1]) & 0x80) == 0) {
+					mRunningStatus = (UInt8)status;
+					SetMessage(outMessage, (UInt8)status, data[0], data[1]);
+					ioData = data + 2;
+					return true;
+				}
+			} else if (status - 0xC0 < 0x20 && data[0] < 0x80) {
+				mRunningStatus = (UInt8)status;
+				SetMessage(outMessage, (UInt8)status, data[0], 0);
+				ioData = data + 1;
+				return true;
+			}
+		}
+		// real-time bytes come between the messages of a clocked stream, and
+		// anywhere else; they leave the state alone
+		if (p < inEnd && *p >= 0xF8) {
+			SetMessage(outMessage, *p, 0, 0);
+			ioData = p + 1;
+			return true;
+		}
+		return NextSlow(ioData, inEnd, outMessage);
+	}
+
+	// The first byte in [inData, inEnd) with the high bit set, or inEnd.
+	/*! @method FindStatusByte */
+	static const UInt8 *	FindStatusByte(const UInt8 *inData, const UInt8 *inEnd);
+
+	/*! @method DataLength */
+	static UInt32	DataLength(UInt8 inStatus)
+	{
+		return inStatus < 0xF0	? kAUMIDIChannelDataLength[(inStatus >> 4) & 7]
+								: kAUMIDISystemDataLength[inStatus & 0x0F];
+	}
+
+private:
+	enum { kInSysEx = 0xF0 };
+
+	bool	NextSlow(const UInt8 *&ioData, const UInt8 *inEnd, AUMIDIMessage &outMessage);
+	bool	SysExPiece(const UInt8 *inPiece, const UInt8 *inScan, const UInt8 *inEnd,
+					   const UInt8 *&ioData, AUMIDIMessage &outMessage);
+
+	static void	SetMessage(AUMIDIMessage &outMessage, UInt8 inStatus, UInt8 inData1, UInt8 inData2)
+	{
+		outMessage.status = inStatus;
+		outMessage.data1 = inData1;
+		outMessage.data2 = inData2;
+	}
+
+	UInt8	mRunningStatus;		// 0 -> none
+	UInt8	mStatus;			// of the message being assembled, kInSysEx inside
+								//  SysEx; 0 -> none
+	UInt8	mData[2];
+	UInt32	mCount;				// data bytes in mData
+	UInt32	mNeeded;
+	UInt8	mSysExFlags;		// kSysExStart until the first piece is out
+};
+
+inline const UInt8 *	AUMIDIParser::FindStatusByte(const UInt8 *inData, const UInt8 *inEnd)
+{
+#if defined(__SSE2__)
+	while (inEnd - inData >= 16) {
+		int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)inData));
+		if (mask) return inData + __builtin_ctz(mask);
+		inData += 16;
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	while (inEnd - inData >= 16 && vmaxvq_u8(vld1q_u8(inData)) < 0x80)
+		inData += 16;
+#endif
+	while (inEnd - inData >= 8) {
+		UInt64 word;
+		memcpy(&word, inData, sizeof(word));
+		if (word & 0x8080808080808080ULL) break;
+		inData += 8;
+	}
+	while (inData < inEnd && (*inData & 0x80) == 0)
+		++inData;
+	return inData;
+}
+
+inline bool	AUMIDIParser::SysExPiece(const UInt8 *inPiece, const UInt8 *inScan, const UInt8 *inEnd,
+									 const UInt8 *&ioData, AUMIDIMessage &outMessage)
+{
+	const UInt8 *stop = FindStatusByte(inScan, inEnd);
+	UInt8 flags = mSysExFlags;
+	if (stop < inEnd && *stop < 0xF8) {
+		// 0xF7 or any other status byte ends it; the latter is left for the caller
+		if (*stop == 0xF7) ++stop;
+		flags |= AUMIDIMessage::kSysExEnd;
+		mStatus = 0;
+	}
+	ioData = stop;
+	if (stop == inPiece && flags == 0)
+		return false;	// nothing yet; a real-time byte is next
+
+	mSysExFlags = 0;
+	SetMessage(outMessage, 0xF0, 0, 0);
+	outMessage.sysExFlags = flags;
+	outMessage.sysExData = inPiece;
+	outMessage.sysExLength = (UInt32)(stop - inPiece);
+	return true;
+}
+
+// Kept out of line so the loop around Next() stays small.
+AUMIDI_PARSER_NOINLINE inline bool	AUMIDIParser::NextSlow(const UInt8 *&ioData, const UInt8 *inEnd, AUMIDIMessage &outMessage)
+{
+	const UInt8 *p = ioData;
+	while (p < inEnd) {
+		if (mStatus == kInSysEx && SysExPiece(p, p, inEnd, p, outMessage)) {
+			ioData = p;
+			return true;
+		}
+		if (p == inEnd) break;
+
+		UInt8 byte = *p;
+		if (byte < 0x80) {
+			if (mStatus == 0) {
+				if (mRunningStatus == 0) {
+					// data without a status byte
+					p = FindStatusByte(p + 1, inEnd);
+					continue;
+				}
+				mStatus = mRunningStatus;
+				mCount = 0;
+				mNeeded = DataLength(mStatus);
+			}
+			mData[mCount++] = byte;
+			++p;
+			if (mCount < mNeeded) continue;
+
+			SetMessage(outMessage, mStatus, mData[0], mNeeded == 2 ? mData[1] : 0);
+			mStatus = 0;
+			ioData = p;
+			return true;
+		}
+
+		if (byte >= 0xF8) {
+			SetMessage(outMessage, byte, 0, 0);
+			ioData = p + 1;
+			return true;
+		}
+
+		// any other status byte drops a message still being assembled
+		mStatus = 0;
+		++p;
+		if (byte >= 0xF0) {
+			mRunningStatus = 0;
+			if (byte == 0xF0) {
+				mStatus = kInSysEx;
+				mSysExFlags = AUMIDIMessage::kSysExStart;
+				SysExPiece(p - 1, p, inEnd, ioData, outMessage);
+				return true;
+			}
+			if (byte == 0xF4 || byte == 0xF5 || byte == 0xF7)
+				continue;	// undefined, or the end of a SysEx we never saw start
+			if (DataLength(byte) == 0) {
+				SetMessage(outMessage, byte, 0, 0);
+				ioData = p;
+				return true;
+			}
+		} else {
+			mRunningStatus = byte;
+		}
+		mStatus = byte;
+		mCount = 0;
+		mNeeded = DataLength(byte);
+	}
+	ioData = p;
+	return false;
+}
+
+#endif // __AUMIDIParser_h__
@@ -78,6 +78,15 @@ public:
 		return AUMIDIBase::SysEx (inData, inLength);
 	}
 
+#if CA_AU_MIDI_EVENT_LIST
+	/*! @method MIDIEventList */
+	virtual OSStatus	MIDIEventList(	UInt32						inOffsetSampleFrame,
+										const struct MIDIEventList *	inEventList)
+	{
+		return AUMIDIBase::MIDIEventList (inOffsetSampleFrame, inEventList);
+	}
+#endif
+
 	/*! @method GetPropertyInfo */
 	virtual OSStatus			GetPropertyInfo(AudioUnitPropertyID			inID,
 												AudioUnitScope				inScope,
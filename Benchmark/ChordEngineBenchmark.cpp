@@ -0,0 +1,767 @@
+//
+//  ChordEngineBenchmark.cpp
+//  ChordTrigger
+//
+//  Headless benchmark for the MIDI path of ChordTrigger. Replays synthetic
+//  MIDIPacketLists through ChordEngine render slice by render slice, the way
+//  AUMIDIBase and ChordTrigger::Render drive it inside a host, and reports
+//  the cost per input event together with the output it produced.
+//
+//  The include/ directory holds stand-ins for the few CoreAudio/CoreMIDI
+//  types the engine uses, so this builds anywhere. From the repository root:
+//
+//    c++ -O2 -IBenchmark/include -IChordTrigger -IPublicUtility
+//        -IAUPublic/OtherBases
+//        -include ChordTrigger/ChordTrigger_Prefix.pch
+//        Benchmark/ChordEngineBenchmark.cpp ChordTrigger/ChordEngine.cpp
+//        ChordTrigger/ChordMapBank.cpp ChordTrigger/MIDIOutputCallbackHelper.cpp
+//        -o chordbench -lpthread
+//
+//  Packet lists reach the engine through a stand-in for ChordTrigger, one
+//  virtual call and two clock reads per message as from AUMIDIBase. The
+//  -batch workloads hand each list over whole instead, as
+//  ChordTrigger::HandleMIDIPacketList does, decoded a MIDIEventBatch at a
+//  time; their "worst ns" is a message's share of its list.
+//
+//  The midi2 workloads feed the same input as MIDI 2.0 Universal MIDI
+//  Packets; their output is still counted after conversion to MIDI 1.0.
+//
+//  Besides the average cost per input event, every workload is replayed
+//  three more times with each input message timed on its own; "worst ns" is
+//  the slowest message, taking each message's fastest replay, i.e. the
+//  worst-case latency of a chord trigger without the machine's own noise.
+//
+//  Adding -fsanitize=thread turns the "edit" workload, which republishes
+//  the chord maps and strum settings from a second thread while rendering,
+//  and the "trace" workload, which drains the trace ring from one, into
+//  race checks.
+//
+//  usage: chordbench [workload|all] [renders] [frames per render]
+//
+
+#include "ChordEngine.h"
+#include <new>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+enum {
+  kNoteOff = 0x80,
+  kNoteOn = 0x90,
+  kControlChange = 0xB0,
+  kProgramChange = 0xC0
+};
+
+static const Float64 kSampleRate = 44100.;
+
+//------------------------------------------------------------------------------
+// allocation counting
+
+static bool sCountAllocations = false;
+static UInt64 sAllocationCount = 0;
+
+void *operator new(size_t size) {
+  if (sCountAllocations) sAllocationCount++;
+  void *p = malloc(size ? size : 1);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+// Kept out of line: once inlined, GCC takes the free() for a mismatch with
+// the operator new it came from (-Wmismatched-new-delete).
+#define NOINLINE __attribute__((noinline))
+NOINLINE void operator delete(void *p) throw() { free(p); }
+NOINLINE void operator delete[](void *p) throw() { free(p); }
+NOINLINE void operator delete(void *p, size_t) throw() { free(p); }
+NOINLINE void operator delete[](void *p, size_t) throw() { free(p); }
+#undef NOINLINE
+
+//------------------------------------------------------------------------------
+// timing
+
+static UInt64 NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (UInt64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Per input message, the fastest of several timed replays. Taking the
+// minimum per message filters out preemption and interrupts, so the slowest
+// message left shows the engine's own worst case.
+class EventTimes {
+ public:
+  explicit EventTimes(size_t numEvents)
+      : mTimes(numEvents, ~(UInt64)0), mNext(0) {}
+
+  void Rewind() { mNext = 0; }
+
+  void Record(UInt64 nanos) {
+    UInt64 &fastest = mTimes[mNext++];
+    if (nanos < fastest) fastest = nanos;
+  }
+
+  UInt64 Worst() const {
+    UInt64 worst = 0;
+    for (size_t i = 0; i < mTimes.size(); i++)
+      if (mTimes[i] > worst) worst = mTimes[i];
+    return worst;
+  }
+
+ private:
+  std::vector<UInt64> mTimes;
+  size_t mNext;
+};
+
+//------------------------------------------------------------------------------
+// input
+
+typedef struct BenchEvent {
+  UInt32 frame;
+  UInt8 status;
+  UInt8 data1;
+  UInt8 data2;
+} BenchEvent;
+
+// Packet lists are time ordered; generators may emit out of order.
+static void SortByFrame(std::vector<BenchEvent> &events) {
+  for (size_t i = 1; i < events.size(); i++) {
+    BenchEvent e = events[i];
+    size_t j = i;
+    for (; j > 0 && events[j - 1].frame > e.frame; j--)
+      events[j] = events[j - 1];
+    events[j] = e;
+  }
+}
+
+// One MIDIPacketList per render slice, stored back to back.
+class PacketListStream {
+ public:
+  void Append(std::vector<BenchEvent> &events) {
+    SortByFrame(events);
+
+    size_t bufferSize = offsetof(MIDIPacketList, packet) +
+                        (events.size() + 1) * sizeof(MIDIPacket);
+    std::vector<UInt32> buffer(bufferSize / sizeof(UInt32) + 1);
+    MIDIPacketList *pktlist = (MIDIPacketList *)&buffer[0];
+    MIDIPacket *pkt = MIDIPacketListInit(pktlist);
+    for (size_t i = 0; i < events.size(); i++) {
+      Byte data[3] = {events[i].status, events[i].data1, events[i].data2};
+      UInt32 length = ((events[i].status & 0xF0) == kProgramChange ||
+                       (events[i].status & 0xF0) == 0xD0) ? 2 : 3;
+      pkt = MIDIPacketListAdd(pktlist, bufferSize, pkt, events[i].frame,
+                              length, data);
+    }
+    const Byte *end = pktlist->numPackets ? (const Byte *)MIDIPacketNext(pkt)
+                                          : (const Byte *)pkt;
+    size_t used = end - (const Byte *)pktlist;
+
+    mOffsets.push_back(mStorage.size());
+    mStorage.insert(mStorage.end(), (UInt32 *)pktlist,
+                    (UInt32 *)pktlist + (used + 3) / 4);
+    mEventCount += events.size();
+    events.clear();
+  }
+
+  size_t Count() const { return mOffsets.size(); }
+  UInt64 EventCount() const { return mEventCount; }
+
+  const MIDIPacketList *List(size_t index) const {
+    return (const MIDIPacketList *)&mStorage[mOffsets[index]];
+  }
+
+  PacketListStream() : mEventCount(0) {}
+
+ private:
+  std::vector<UInt32> mStorage;
+  std::vector<size_t> mOffsets;
+  UInt64 mEventCount;
+};
+
+// The same input as MIDI 2.0 Universal MIDI Packets. Per render slice, each
+// frame with events is stored as frame, word count, words; velocities are
+// scaled up to 16 bit and notes carry a pitch 7.9 attribute.
+class UMPStream {
+ public:
+  void Append(std::vector<BenchEvent> &events) {
+    SortByFrame(events);
+
+    mOffsets.push_back(mStorage.size());
+    size_t countIndex = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+      const BenchEvent &e = events[i];
+      if (i == 0 || e.frame != events[i - 1].frame) {
+        mStorage.push_back(e.frame);
+        countIndex = mStorage.size();
+        mStorage.push_back(0);
+      }
+      UInt8 status = e.status & 0xF0, channel = e.status & 0x0F;
+      UInt32 word1;
+      if (status == kNoteOn || status == kNoteOff) {
+        if (status == kNoteOn && e.data2 == 0) status = kNoteOff;
+        mStorage.push_back(UMPMakeMIDI2Word0(0, status, channel, e.data1, 3));
+        word1 = ((UInt32)UMPUpscaleVelocity(e.data2) << 16) | (e.data1 << 9);
+      } else if (status == kProgramChange) {
+        mStorage.push_back(UMPMakeMIDI2Word0(0, status, channel, 0, 0));
+        word1 = (UInt32)e.data1 << 24;
+      } else {
+        mStorage.push_back(UMPMakeMIDI2Word0(0, status, channel, e.data1, 0));
+        word1 = (UInt32)e.data2 << 25;
+      }
+      mStorage.push_back(word1);
+      mStorage[countIndex] += 2;
+    }
+    mEventCount += events.size();
+    events.clear();
+  }
+
+  size_t Count() const { return mOffsets.size(); }
+  UInt64 EventCount() const { return mEventCount; }
+
+  // Feeds slice |index| to the engine, one call per frame as the AU does
+  // per MIDIEventPacket. With |ioTimes| set, messages are fed and timed one
+  // at a time instead.
+  void Play(ChordEngine &engine, size_t index, EventTimes *ioTimes) const {
+    size_t i = mOffsets[index];
+    size_t end = index + 1 < mOffsets.size() ? mOffsets[index + 1]
+                                              : mStorage.size();
+    while (i < end) {
+      UInt32 frame = mStorage[i], numWords = mStorage[i + 1];
+      const UInt32 *words = &mStorage[i + 2];
+      if (ioTimes == NULL) {
+        engine.HandleUMPEvents(words, numWords, frame);
+      } else {
+        for (UInt32 w = 0; w < numWords; w += 2) {
+          UInt64 start = NowNanos();
+          engine.HandleUMPEvents(&words[w], 2, frame);
+          ioTimes->Record(NowNanos() - start);
+        }
+      }
+      i += 2 + numWords;
+    }
+  }
+
+  UMPStream() : mEventCount(0) {}
+
+ private:
+  std::vector<UInt32> mStorage;
+  std::vector<size_t> mOffsets;
+  UInt64 mEventCount;
+};
+
+//------------------------------------------------------------------------------
+// output
+
+typedef struct OutputStats {
+  UInt64 packetLists;
+  UInt64 packets;
+  UInt64 messages;
+  UInt64 bytes;
+} OutputStats;
+
+static OSStatus CountOutput(void *userData, const AudioTimeStamp *, UInt32,
+                            const MIDIPacketList *pktlist) {
+  OutputStats *stats = (OutputStats *)userData;
+  stats->packetLists++;
+  const MIDIPacket *pkt = &pktlist->packet[0];
+  for (UInt32 i = 0; i < pktlist->numPackets; i++) {
+    stats->packets++;
+    stats->bytes += pkt->length;
+    for (UInt32 b = 0; b < pkt->length; b++)
+      if (pkt->data[b] & 0x80) stats->messages++;
+    pkt = MIDIPacketNext(pkt);
+  }
+  return noErr;
+}
+
+//------------------------------------------------------------------------------
+// workloads
+
+static UInt32 sRandomState = 1;
+
+static UInt32 Random(UInt32 range) {
+  sRandomState = sRandomState * 1664525 + 1013904223;
+  return (sRandomState >> 8) % range;
+}
+
+// Stacked thirds on every trigger from C2 up, three to six notes.
+static void MapStackedChords(ChordMap &map) {
+  static const UInt8 kIntervals[] = {0, 4, 7, 11, 14, 17};
+  for (int trigger = 36; trigger < 96; trigger++) {
+    UInt8 notes[6];
+    int numNotes = 3 + trigger % 4;
+    for (int i = 0; i < numNotes; i++) notes[i] = trigger + kIntervals[i];
+    map.SetChord(trigger, notes, numNotes);
+  }
+}
+
+// Sixteen notes in minor thirds around every trigger from C2 up: the
+// largest chords a map can hold, the worst case for voice leading.
+static void MapWideChords(ChordMap &map) {
+  for (int trigger = 36; trigger < 96; trigger++) {
+    UInt8 notes[kChordMapMaxChordNotes];
+    for (int i = 0; i < kChordMapMaxChordNotes; i++)
+      notes[i] = trigger - 24 + 3 * i;
+    map.SetChord(trigger, notes, kChordMapMaxChordNotes);
+  }
+}
+
+static void SetupThru(ChordEngine &) {}
+
+static void SetupChords(ChordEngine &engine) {
+  MapStackedChords(engine.SharedChordMap());
+  engine.PublishChordMaps();
+}
+
+static void SetupStrum(ChordEngine &engine) {
+  SetupChords(engine);
+  engine.SetStrum(kSampleRate, 30.f, StrumTable::kStrumDown, -20.f);
+}
+
+// Stacked chords with a hard curve, the top voice pulled back and the
+// bottom one pushed.
+static void SetupVoicing(ChordEngine &engine) {
+  ChordMap &map = engine.SharedChordMap();
+  MapStackedChords(map);
+  map.SetVelocityCurve(kVelocityCurveHard);
+  map.SetVoiceVelocity(0, 70, 0);
+  for (int voice = 2; voice < kChordMapMaxChordNotes; voice++)
+    map.SetVoiceVelocity(voice, 100, 10);
+  engine.PublishChordMaps();
+}
+
+static void SetupVoiceLeading(ChordEngine &engine) {
+  SetupChords(engine);
+  engine.SetVoiceLeading(true);
+}
+
+static void SetupWideChords(ChordEngine &engine) {
+  MapWideChords(engine.SharedChordMap());
+  engine.PublishChordMaps();
+}
+
+static void SetupWideVoiceLeading(ChordEngine &engine) {
+  SetupWideChords(engine);
+  engine.SetVoiceLeading(true);
+}
+
+static void SetupTrace(ChordEngine &engine) {
+  SetupStrum(engine);
+  engine.Trace().SetEnabled(true);
+}
+
+static void SetupRecognition(ChordEngine &engine) {
+  SetupChords(engine);
+  engine.SetChordRecognition(ChordEngine::kChordRecognitionCC,
+                             ChordEngine::kDefaultRecognitionController);
+}
+
+static void SetupMultiChannel(ChordEngine &engine) {
+  engine.SetChannel(-1);
+  for (UInt8 ch = 0; ch < ChordEngine::kChannelCount; ch++)
+    MapStackedChords(*engine.CreateChannelChordMap(ch));
+  engine.PublishChordMaps();
+}
+
+// 128 programs, each transposing the stacked chords by the program number,
+// loaded from a bank image.
+static void SetupBank(ChordEngine &engine) {
+  SetupChords(engine);
+  std::vector<UInt8> image(kChordMapBankMaxDataSize);
+  UInt8 *p = &image[0];
+  memcpy(p, "CTBK\x01\x00\x00\x80", kChordMapBankHeaderSize);
+  UInt8 *sizes = p + kChordMapBankHeaderSize;
+  p = sizes + 2 * kChordMapBankMaxPrograms;
+  for (int program = 0; program < kChordMapBankMaxPrograms; program++) {
+    ChordMap map;
+    MapStackedChords(map);
+    for (int trigger = 36; trigger < 96; trigger++)
+      for (int i = 0; map.GetChordNote(trigger, i); i++)
+        map.SetChordNote(trigger, i,
+                         (map.GetChordNote(trigger, i) + program % 12) & 0x7F);
+    UInt32 size = map.Save(p);
+    sizes[2 * program] = (UInt8)(size >> 8);
+    sizes[2 * program + 1] = (UInt8)size;
+    p += size;
+  }
+
+  ChordMapBank *bank = new ChordMapBank;
+  if (!bank->Restore(&image[0], (UInt32)(p - &image[0]))) {
+    fprintf(stderr, "bank image rejected\n");
+    exit(1);
+  }
+  engine.SetChordMapBank(bank);
+  engine.PublishChordMaps();
+}
+
+// What a host automating the chord note parameters does: edit one note and
+// publish, over and over, from outside the render thread. Every fourth edit
+// also moves the strum time, which publishes new settings.
+static void EditChords(ChordEngine &engine, UInt32 iteration) {
+  UInt8 trigger = 36 + iteration % 60;
+  ChordMap *map = engine.CreateChannelChordMap(iteration % 2);
+  map->SetChordNote(trigger, 1 + iteration % 3, trigger + 3 + iteration % 2);
+  engine.PublishChordMaps();
+  if (iteration % 4 == 0)
+    engine.SetStrum(kSampleRate, (Float32)(iteration / 4 % 3) * 15.f,
+                    StrumTable::kStrumDown, 0.f);
+}
+
+// What TraceWriter's thread does, minus the formatting, at a shorter
+// interval since the replay runs faster than real time.
+static void DrainTrace(ChordEngine &engine, UInt32) {
+  TraceRecord records[256];
+  while (engine.Trace().Read(records, 256) != 0) {
+  }
+  usleep(1000);
+}
+
+// One note every four slices, released two slices later.
+static void GenerateSparse(UInt32 render, UInt32 frames,
+                           std::vector<BenchEvent> &out) {
+  static UInt8 note;
+  if (render % 4 == 0) {
+    note = 60 + Random(24);
+    BenchEvent on = {Random(frames), kNoteOn, note, 100};
+    out.push_back(on);
+  } else if (render % 4 == 2) {
+    BenchEvent off = {Random(frames), kNoteOff, note, 0};
+    out.push_back(off);
+  }
+}
+
+// Eight chord triggers per slice, each released in the next slice.
+static void GenerateDenseChords(UInt32, UInt32 frames,
+                                std::vector<BenchEvent> &out) {
+  static UInt8 held[8];
+  static bool holding = false;
+  for (int i = 0; i < 8; i++) {
+    if (holding) {
+      BenchEvent off = {Random(frames), kNoteOn, held[i], 0};
+      out.push_back(off);
+    }
+    held[i] = 36 + Random(60);
+    BenchEvent on = {Random(frames), kNoteOn, held[i], (UInt8)(64 + Random(64))};
+    out.push_back(on);
+  }
+  holding = true;
+}
+
+// A controller sweep on every frame group, as from a busy mod wheel.
+static void GenerateCCFlood(UInt32 render, UInt32 frames,
+                            std::vector<BenchEvent> &out) {
+  for (UInt32 i = 0; i < 96; i++) {
+    BenchEvent cc = {i * frames / 96, kControlChange, (UInt8)(1 + i % 4),
+                     (UInt8)((render + i) & 0x7F)};
+    out.push_back(cc);
+  }
+}
+
+// Two chord triggers per channel per slice on all 16 channels.
+static void GenerateMultiChannel(UInt32, UInt32 frames,
+                                 std::vector<BenchEvent> &out) {
+  static UInt8 held[ChordEngine::kChannelCount][2];
+  static bool holding = false;
+  for (int ch = 0; ch < ChordEngine::kChannelCount; ch++) {
+    for (int i = 0; i < 2; i++) {
+      if (holding) {
+        BenchEvent off = {Random(frames), (UInt8)(kNoteOff | ch), held[ch][i],
+                          64};
+        out.push_back(off);
+      }
+      held[ch][i] = 36 + Random(60);
+      BenchEvent on = {Random(frames), (UInt8)(kNoteOn | ch), held[ch][i], 100};
+      out.push_back(on);
+    }
+  }
+  holding = true;
+}
+
+// Dense chords with a program change at the start of every slice.
+static void GenerateProgramChanges(UInt32 render, UInt32 frames,
+                                   std::vector<BenchEvent> &out) {
+  BenchEvent pc = {0, kProgramChange, (UInt8)(render & 0x7F), 0};
+  out.push_back(pc);
+  GenerateDenseChords(render, frames, out);
+}
+
+enum {
+  kInputMessages,  // MIDIPacketLists, one engine call per message
+  kInputBatches,   // MIDIPacketLists, decoded a batch at a time
+  kInputUMP        // MIDI 2.0 Universal MIDI Packets
+};
+
+typedef struct Workload {
+  const char *name;
+  void (*setup)(ChordEngine &);
+  void (*generate)(UInt32 render, UInt32 frames, std::vector<BenchEvent> &out);
+  // run on a second thread for as long as the renders take, if set
+  void (*edit)(ChordEngine &, UInt32 iteration);
+  int input;
+} Workload;
+
+static const Workload kWorkloads[] = {
+    {"sparse", SetupThru, GenerateSparse, NULL, kInputMessages},
+    {"chords", SetupChords, GenerateDenseChords, NULL, kInputMessages},
+    {"strum", SetupStrum, GenerateDenseChords, NULL, kInputMessages},
+    {"voicing", SetupVoicing, GenerateDenseChords, NULL, kInputMessages},
+    {"voicelead", SetupVoiceLeading, GenerateDenseChords, NULL,
+     kInputMessages},
+    {"wide", SetupWideChords, GenerateDenseChords, NULL, kInputMessages},
+    {"voicelead16", SetupWideVoiceLeading, GenerateDenseChords, NULL,
+     kInputMessages},
+    {"trace", SetupTrace, GenerateDenseChords, DrainTrace, kInputMessages},
+    {"recognize", SetupRecognition, GenerateDenseChords, NULL,
+     kInputMessages},
+    {"cc", SetupChords, GenerateCCFlood, NULL, kInputMessages},
+    {"multichannel", SetupMultiChannel, GenerateMultiChannel, NULL,
+     kInputMessages},
+    {"programs", SetupBank, GenerateProgramChanges, NULL, kInputMessages},
+    {"edit", SetupMultiChannel, GenerateMultiChannel, EditChords,
+     kInputMessages},
+    {"chords-batch", SetupChords, GenerateDenseChords, NULL, kInputBatches},
+    {"strum-batch", SetupStrum, GenerateDenseChords, NULL, kInputBatches},
+    {"cc-batch", SetupChords, GenerateCCFlood, NULL, kInputBatches},
+    {"multi-batch", SetupMultiChannel, GenerateMultiChannel, NULL,
+     kInputBatches},
+    {"midi2", SetupStrum, GenerateDenseChords, NULL, kInputUMP},
+    {"midi2cc", SetupChords, GenerateCCFlood, NULL, kInputUMP},
+};
+
+static const int kNumWorkloads = sizeof(kWorkloads) / sizeof(kWorkloads[0]);
+
+//------------------------------------------------------------------------------
+// driver
+
+// ChordTrigger as the host's MIDI reaches it. Per message, AUMIDIBase makes
+// a virtual HandleMidiEvent call, which reads the clock twice for the
+// performance counters; the batched HandleMIDIPacketList does both once per
+// MIDIEventBatch. AUMIDIBase's own handling, the same either way, is left
+// out.
+class MIDIReceiver {
+ public:
+  explicit MIDIReceiver(ChordEngine &engine)
+      : mEngine(engine), mHandledNanos(0) {}
+  virtual ~MIDIReceiver() {}
+
+  virtual void HandleMidiEvent(UInt8 status, UInt8 channel, UInt8 data1,
+                               UInt8 data2, UInt32 inStartFrame) {
+    UInt64 start = NowNanos();
+    mEngine.HandleMIDIEvent(status, channel, data1, data2, inStartFrame);
+    mHandledNanos += NowNanos() - start;
+  }
+
+  virtual UInt32 HandleMIDIPacketList(const MIDIPacketList *pktlist) {
+    MIDIEventBatch batch(mParser, pktlist);
+    UInt32 numEvents = 0;
+    while (batch.DecodeNext()) {
+      UInt64 start = NowNanos();
+      numEvents += mEngine.HandleMIDIEventBatch(batch);
+      mHandledNanos += NowNanos() - start;
+    }
+    return numEvents;
+  }
+
+  AUMIDIParser &Parser() { return mParser; }
+
+ private:
+  ChordEngine &mEngine;
+  AUMIDIParser mParser;
+  UInt64 mHandledNanos;
+};
+
+// AUMIDIBase::HandleMIDIPacketList, minus SysEx.
+// With |ioTimes| set, every message is timed on its own.
+static UInt32 HandlePacketList(MIDIReceiver &receiver,
+                               const MIDIPacketList *pktlist,
+                               EventTimes *ioTimes) {
+  UInt32 numEvents = 0;
+  const MIDIPacket *pkt = &pktlist->packet[0];
+  for (UInt32 i = 0; i < pktlist->numPackets; i++) {
+    const Byte *p = pkt->data, *end = pkt->data + pkt->length;
+    AUMIDIMessage message;
+    while (receiver.Parser().Next(p, end, message)) {
+      if (message.status == 0xF0) continue;
+      UInt64 start = ioTimes ? NowNanos() : 0;
+      receiver.HandleMidiEvent(message.status & 0xF0, message.status & 0x0F,
+                               message.data1, message.data2,
+                               (UInt32)pkt->timeStamp);
+      if (ioTimes) ioTimes->Record(NowNanos() - start);
+      numEvents++;
+    }
+    pkt = MIDIPacketNext(pkt);
+  }
+  return numEvents;
+}
+
+// With |ioTimes| set, each message is recorded at its share of the whole
+// list's time.
+static UInt32 HandlePacketListBatched(MIDIReceiver &receiver,
+                                      const MIDIPacketList *pktlist,
+                                      EventTimes *ioTimes) {
+  UInt64 start = ioTimes ? NowNanos() : 0;
+  UInt32 numEvents = receiver.HandleMIDIPacketList(pktlist);
+  if (ioTimes && numEvents) {
+    UInt64 share = (NowNanos() - start) / numEvents;
+    for (UInt32 i = 0; i < numEvents; i++) ioTimes->Record(share);
+  }
+  return numEvents;
+}
+
+typedef struct EditorThread {
+  pthread_t thread;
+  const Workload *workload;
+  ChordEngine *engine;
+  volatile SInt32 stop;
+  UInt32 iterations;
+} EditorThread;
+
+static void *RunEditor(void *arg) {
+  EditorThread *editor = (EditorThread *)arg;
+  while (CAAtomicAdd32Barrier(0, &editor->stop) == 0)
+    editor->workload->edit(*editor->engine, editor->iterations++);
+  return NULL;
+}
+
+static ChordEngine *CreateEngine(const Workload &workload,
+                                 OutputStats &stats) {
+  ChordEngine *engine = new ChordEngine;
+  memset(&stats, 0, sizeof(stats));
+  AUMIDIOutputCallback callback = CountOutput;
+  engine->Output().SetCallbackInfo(callback, &stats);
+  engine->Reset();
+  workload.setup(*engine);
+  return engine;
+}
+
+static void Replay(const Workload &workload, const PacketListStream &input,
+                   const UMPStream &umpInput, ChordEngine &engine,
+                   UInt32 numRenders, UInt32 numFrames,
+                   EventTimes *ioTimes) {
+  AudioTimeStamp timeStamp;
+  memset(&timeStamp, 0, sizeof(timeStamp));
+  timeStamp.mFlags = kAudioTimeStampSampleTimeValid;
+  MIDIReceiver receiver(engine);
+
+  for (size_t r = 0; r < numRenders; r++) {
+    if (workload.input == kInputUMP)
+      umpInput.Play(engine, r, ioTimes);
+    else if (workload.input == kInputBatches)
+      HandlePacketListBatched(receiver, input.List(r), ioTimes);
+    else
+      HandlePacketList(receiver, input.List(r), ioTimes);
+    engine.Render(timeStamp, numFrames);
+    timeStamp.mSampleTime += numFrames;
+  }
+}
+
+static const int kTimedReplays = 3;
+
+static void RunWorkload(const Workload &workload, UInt32 numRenders,
+                        UInt32 numFrames) {
+  sRandomState = 1;
+  PacketListStream input;
+  UMPStream umpInput;
+  std::vector<BenchEvent> events;
+  for (UInt32 r = 0; r < numRenders; r++) {
+    workload.generate(r, numFrames, events);
+    if (workload.input == kInputUMP)
+      umpInput.Append(events);
+    else
+      input.Append(events);
+  }
+
+  OutputStats stats;
+  ChordEngine *engine = CreateEngine(workload, stats);
+
+  // the editor thread allocates snapshots, which are not counted against
+  // the render path
+  sAllocationCount = 0;
+  sCountAllocations = workload.edit == NULL;
+
+  EditorThread editor;
+  editor.workload = &workload;
+  editor.engine = engine;
+  editor.stop = 0;
+  editor.iterations = 0;
+  if (workload.edit) pthread_create(&editor.thread, NULL, RunEditor, &editor);
+
+  UInt64 start = NowNanos();
+  Replay(workload, input, umpInput, *engine, numRenders, numFrames, NULL);
+  UInt64 elapsed = NowNanos() - start;
+
+  if (workload.edit) {
+    CAAtomicIncrement32Barrier(&editor.stop);
+    pthread_join(editor.thread, NULL);
+  }
+  sCountAllocations = false;
+
+  // the timed replays run without the editor thread
+  UInt64 numEvents = workload.input == kInputUMP ? umpInput.EventCount()
+                                                 : input.EventCount();
+  EventTimes times(numEvents);
+  for (int pass = 0; pass < kTimedReplays; pass++) {
+    OutputStats timedStats;
+    ChordEngine *timedEngine = CreateEngine(workload, timedStats);
+    times.Rewind();
+    Replay(workload, input, umpInput, *timedEngine, numRenders, numFrames,
+           &times);
+    delete timedEngine;
+  }
+
+  printf("%-13s %9llu %9llu %9.1f %9llu %9.2f %9llu %9llu %7llu %7u %7u\n",
+         workload.name, (unsigned long long)numEvents,
+         (unsigned long long)stats.messages,
+         numEvents ? (double)elapsed / numEvents : 0.,
+         (unsigned long long)times.Worst(),
+         (double)stats.messages / numRenders,
+         (unsigned long long)stats.packetLists,
+         (unsigned long long)stats.packets,
+         (unsigned long long)sAllocationCount,
+         (unsigned)engine->Output().OverflowCount(),
+         (unsigned)engine->Scheduler().DroppedCount());
+  if (workload.edit == EditChords)
+    printf("%-13s %9u edits published while rendering\n", "",
+           (unsigned)editor.iterations);
+  if (engine->Trace().IsEnabled())
+    printf("%-13s %9u trace records dropped\n", "",
+           (unsigned)engine->Trace().DroppedCount());
+  delete engine;
+}
+
+int main(int argc, char *argv[]) {
+  const char *name = argc > 1 ? argv[1] : "all";
+  UInt32 numRenders = argc > 2 ? (UInt32)atoi(argv[2]) : 20000;
+  UInt32 numFrames = argc > 3 ? (UInt32)atoi(argv[3]) : 256;
+  if (numRenders == 0 || numFrames == 0) {
+    fprintf(stderr, "usage: %s [workload|all] [renders] [frames]\n", argv[0]);
+    return 1;
+  }
+
+  printf("%u renders of %u frames\n\n", (unsigned)numRenders,
+         (unsigned)numFrames);
+  printf("%-13s %9s %9s %9s %9s %9s %9s %9s %7s %7s %7s\n", "workload",
+         "events", "out", "ns/event", "worst ns", "out/rndr", "pktlists", "packets", "allocs",
+         "dropped", "unsched");
+
+  bool found = false;
+  for (int i = 0; i < kNumWorkloads; i++) {
+    if (strcmp(name, "all") != 0 && strcmp(name, kWorkloads[i].name) != 0)
+      continue;
+    RunWorkload(kWorkloads[i], numRenders, numFrames);
+    found = true;
+  }
+  if (!found) {
+    fprintf(stderr, "unknown workload '%s'; one of:", name);
+    for (int i = 0; i < kNumWorkloads; i++)
+      fprintf(stderr, " %s", kWorkloads[i].name);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+  return 0;
+}
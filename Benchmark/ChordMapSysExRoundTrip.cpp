@@ -0,0 +1,199 @@
+//
+//  ChordMapSysExRoundTrip.cpp
+//  ChordTrigger
+//
+//  Round-trips the largest bank there can be, 128 programs with every
+//  trigger mapped to a full chord and custom velocity settings, through the
+//  SysEx dump and load path. A loader on one engine answers a bank dump
+//  request; its reply, as the MIDI output callback gets it, is parsed with
+//  AUMIDIParser and assembled the way AUMIDIBase::HandleSysExPiece does,
+//  into a buffer of the length ChordTrigger sets, and submitted to a loader
+//  on a second engine. The bank that engine ends up with must save to the
+//  same image. A message one byte longer than the loader takes must be
+//  refused.
+//
+//  From the repository root:
+//
+//    c++ -O2 -IBenchmark/include -IChordTrigger -IPublicUtility
+//        -IAUPublic/OtherBases
+//        -include ChordTrigger/ChordTrigger_Prefix.pch
+//        Benchmark/ChordMapSysExRoundTrip.cpp ChordTrigger/ChordMapSysExLoader.cpp
+//        ChordTrigger/ChordEngine.cpp ChordTrigger/ChordMapBank.cpp
+//        ChordTrigger/MIDIOutputCallbackHelper.cpp
+//        -o sysexroundtrip -lpthread
+//
+//  Exits with 0 if the bank came back unchanged.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "AUMIDIParser.h"
+#include "ChordMapSysExLoader.h"
+
+// Stands in for AUMIDIBase: parses the packets the loader sends and
+// assembles the SysEx in them.
+typedef struct Receiver {
+  AUMIDIParser parser;
+  std::vector<UInt8> buffer;  // ChordMapSysExLoader::kMaxMessageLength
+  UInt32 length;
+  bool overflow;
+  std::vector<UInt8> message;  // the last complete SysEx
+  int messages;
+} Receiver;
+
+static void HandleSysExPiece(Receiver &receiver, const AUMIDIMessage &piece) {
+  if (piece.sysExFlags & AUMIDIMessage::kSysExStart) {
+    receiver.length = 0;
+    receiver.overflow = false;
+  }
+  if (receiver.length + piece.sysExLength > receiver.buffer.size())
+    receiver.overflow = true;
+  if (!receiver.overflow) {
+    memcpy(&receiver.buffer[receiver.length], piece.sysExData,
+           piece.sysExLength);
+    receiver.length += piece.sysExLength;
+  }
+  if ((piece.sysExFlags & AUMIDIMessage::kSysExEnd) && !receiver.overflow &&
+      receiver.length > 0) {
+    receiver.message.assign(receiver.buffer.begin(),
+                            receiver.buffer.begin() + receiver.length);
+    receiver.messages++;
+  }
+}
+
+static OSStatus Output(void *userData, const AudioTimeStamp *, UInt32,
+                       const MIDIPacketList *packetList) {
+  Receiver &receiver = *(Receiver *)userData;
+  const MIDIPacket *packet = &packetList->packet[0];
+  for (UInt32 i = 0; i < packetList->numPackets; i++) {
+    const UInt8 *p = packet->data, *end = p + packet->length;
+    AUMIDIMessage message;
+    while (receiver.parser.Next(p, end, message)) {
+      if (message.status == 0xF0) HandleSysExPiece(receiver, message);
+    }
+    packet = MIDIPacketNext(packet);
+  }
+  return noErr;
+}
+
+// Every trigger gets kChordMapMaxChordNotes notes, and the velocity settings
+// are all off their defaults, so each map saves to kChordMapMaxDataSize
+// bytes. Negative offsets set the top bits the SysEx packing has to carry.
+static void FillMap(ChordMap &map, int program) {
+  for (int trigger = 0; trigger < kChordMapNoteCount; trigger++) {
+    UInt8 notes[kChordMapMaxChordNotes];
+    for (int i = 0; i < kChordMapMaxChordNotes; i++)
+      notes[i] = (UInt8)(1 + (trigger + program + 7 * i) % 127);
+    map.SetChord((UInt8)trigger, notes, kChordMapMaxChordNotes);
+  }
+  map.SetVelocityCurve(1);
+  for (int voice = 0; voice < kChordMapMaxChordNotes; voice++)
+    map.SetVoiceVelocity(voice, 50 + voice, -(program % 100) - voice);
+}
+
+static void BuildBank(std::vector<UInt8> &image) {
+  image.resize(kChordMapBankMaxDataSize);
+  UInt8 *p = &image[0];
+  memcpy(p, "CTBK\x01\x00\x00\x80", kChordMapBankHeaderSize);
+  UInt8 *sizes = p + kChordMapBankHeaderSize;
+  p = sizes + 2 * kChordMapBankMaxPrograms;
+  for (int program = 0; program < kChordMapBankMaxPrograms; program++) {
+    ChordMap map;
+    FillMap(map, program);
+    UInt32 size = map.Save(p);
+    sizes[2 * program] = (UInt8)(size >> 8);
+    sizes[2 * program + 1] = (UInt8)size;
+    p += size;
+  }
+  image.resize(p - &image[0]);
+}
+
+static int Fail(const char *what) {
+  fprintf(stderr, "FAIL: %s\n", what);
+  return 1;
+}
+
+int main() {
+  std::vector<UInt8> image;
+  BuildBank(image);
+  printf("bank image %u bytes (max %u), message %u bytes (max %u)\n",
+         (unsigned)image.size(), (unsigned)kChordMapBankMaxDataSize,
+         (unsigned)(ChordMapSysExPackedSize((UInt32)image.size()) +
+                    kChordMapSysExOverhead),
+         (unsigned)ChordMapSysExLoader::kMaxMessageLength);
+  if (image.size() != kChordMapBankMaxDataSize)
+    return Fail("bank is not the largest possible");
+
+  ChordEngine source, target;
+  ChordMapBank *bank = new ChordMapBank;
+  if (!bank->Restore(&image[0], (UInt32)image.size()))
+    return Fail("bank image rejected");
+  source.SetChordMapBank(bank);
+  source.PublishChordMaps();
+
+  ChordMapSysExLoader sourceLoader(source, NULL, NULL);
+  ChordMapSysExLoader targetLoader(target, NULL, NULL);
+  if (!sourceLoader.Start() || !targetLoader.Start())
+    return Fail("loader thread");
+
+  Receiver receiver;
+  receiver.buffer.resize(ChordMapSysExLoader::kMaxMessageLength);
+  receiver.length = 0;
+  receiver.overflow = false;
+  receiver.messages = 0;
+  MIDIOutputCallbackHelper output;
+  AUMIDIOutputCallback callback = Output;
+  output.SetCallbackInfo(callback, &receiver);
+  AudioTimeStamp timeStamp;
+  memset(&timeStamp, 0, sizeof(timeStamp));
+
+  UInt8 request[kChordMapSysExOverhead];
+  UInt32 requestLength = ChordMapSysExEncode(kChordMapSysExCommandBankDump, 0,
+                                             NULL, 0, request);
+  if (!sourceLoader.Submit(request, requestLength))
+    return Fail("dump request dropped");
+  for (int i = 0; i < 10000 && receiver.messages == 0; i++) {
+    usleep(100);
+    sourceLoader.SendReply(output, timeStamp);
+  }
+  if (receiver.messages != 1) return Fail("no dump reply");
+  printf("reply %u bytes\n", (unsigned)receiver.message.size());
+
+  // what the unit would do in HandleSysEx
+  if (!ChordMapSysExMatches(&receiver.message[0],
+                            (UInt32)receiver.message.size()) ||
+      !targetLoader.Submit(&receiver.message[0],
+                           (UInt32)receiver.message.size()))
+    return Fail("reply not accepted");
+  for (int i = 0; i < 10000; i++) {
+    {
+      ChordEngine::EditLocker lock(target);
+      if (target.Bank()) break;
+    }
+    usleep(100);
+  }
+
+  std::vector<UInt8> restored(kChordMapBankMaxDataSize);
+  UInt32 restoredSize = 0;
+  {
+    ChordEngine::EditLocker lock(target);
+    if (target.Bank()) restoredSize = target.Bank()->Save(&restored[0]);
+  }
+  if (restoredSize == 0) return Fail("bank not loaded");
+  if (restoredSize != image.size() ||
+      memcmp(&restored[0], &image[0], restoredSize) != 0)
+    return Fail("bank changed on the way");
+
+  std::vector<UInt8> tooLong(ChordMapSysExLoader::kMaxMessageLength + 1);
+  memcpy(&tooLong[0], &receiver.message[0], receiver.message.size());
+  if (targetLoader.Submit(&tooLong[0], (UInt32)tooLong.size()))
+    return Fail("overlong message accepted");
+
+  sourceLoader.Stop();
+  targetLoader.Stop();
+  printf("ok: %d programs round-tripped\n", kChordMapBankMaxPrograms);
+  return 0;
+}
@@ -0,0 +1,190 @@
+//
+//  LockFreeFIFOBenchmark.cpp
+//  ChordTrigger
+//
+//  Contention benchmark for LockFreeFIFO: a writer and a reader thread
+//  stream 16-byte events through a 1024-slot queue, the size
+//  AUInstrumentBase uses, as fast as they can. It compares the previous
+//  OSAtomic implementation, kept below, with the current one used an item
+//  at a time and with WriteItems/ReadItems moving runs of kRunLength. A side
+//  that finds the queue full (or empty) yields.
+//
+//  The figures only mean something with the two threads on different cores;
+//  on a single core they measure the scheduler. From the repository root:
+//
+//    c++ -O2 -std=c++11 -IBenchmark/include -IAUPublic/AUInstrumentBase
+//        -include CoreAudio/CoreAudioTypes.h
+//        Benchmark/LockFreeFIFOBenchmark.cpp -o lockfreefifobench -lpthread
+//    lockfreefifobench [million events]
+//
+
+#include "LockFreeFIFO.h"
+#include <libkern/OSAtomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { kQueueSize = 1024, kRunLength = 32, kRepeats = 3 };
+
+typedef struct Event {
+  UInt32 type;
+  UInt32 frame;
+  UInt32 data;
+  UInt32 sequence;
+} Event;
+
+//------------------------------------------------------------------------------
+// the previous LockFreeFIFO: volatile indices next to each other, advanced
+// with a compare-and-swap, and the other side's index read on every call
+
+template <class ITEM>
+class LegacyLockFreeFIFO {
+ public:
+  LegacyLockFreeFIFO(UInt32 inMaxSize) : mReadIndex(0), mWriteIndex(0) {
+    mItems = new ITEM[inMaxSize];
+    mMask = inMaxSize - 1;
+  }
+  ~LegacyLockFreeFIFO() { delete[] mItems; }
+
+  ITEM *WriteItem() {
+    int32_t nextWriteIndex = (mWriteIndex + 1) & mMask;
+    if (nextWriteIndex == mReadIndex) return NULL;
+    return &mItems[mWriteIndex];
+  }
+  ITEM *ReadItem() {
+    if (mReadIndex == mWriteIndex) return NULL;
+    return &mItems[mReadIndex];
+  }
+  void AdvanceWritePtr() {
+    OSAtomicCompareAndSwap32(mWriteIndex, (mWriteIndex + 1) & mMask,
+                             &mWriteIndex);
+  }
+  void AdvanceReadPtr() {
+    OSAtomicCompareAndSwap32(mReadIndex, (mReadIndex + 1) & mMask,
+                             &mReadIndex);
+  }
+
+ private:
+  volatile int32_t mReadIndex, mWriteIndex;
+  int32_t mMask;
+  ITEM *mItems;
+};
+
+//------------------------------------------------------------------------------
+// workloads
+
+static UInt64 Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (UInt64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static Event MakeEvent(UInt32 sequence) {
+  Event event = {1, sequence & 511, sequence * 31, sequence};
+  return event;
+}
+
+template <class FIFO>
+struct Run {
+  FIFO *fifo;
+  UInt32 count;
+  UInt64 checksum;  // reader's, so the reads can't be optimised away
+};
+
+template <class FIFO>
+static void *SingleWriter(void *arg) {
+  Run<FIFO> &run = *(Run<FIFO> *)arg;
+  for (UInt32 i = 0; i < run.count;) {
+    Event *event = run.fifo->WriteItem();
+    if (event == NULL) {
+      sched_yield();
+      continue;
+    }
+    *event = MakeEvent(i++);
+    run.fifo->AdvanceWritePtr();
+  }
+  return NULL;
+}
+
+template <class FIFO>
+static void *SingleReader(void *arg) {
+  Run<FIFO> &run = *(Run<FIFO> *)arg;
+  for (UInt32 i = 0; i < run.count;) {
+    Event *event = run.fifo->ReadItem();
+    if (event == NULL) {
+      sched_yield();
+      continue;
+    }
+    run.checksum += event->sequence + event->data;
+    run.fifo->AdvanceReadPtr();
+    i++;
+  }
+  return NULL;
+}
+
+static void *BatchWriter(void *arg) {
+  Run<LockFreeFIFO<Event> > &run = *(Run<LockFreeFIFO<Event> > *)arg;
+  Event events[kRunLength];
+  for (UInt32 i = 0; i < run.count;) {
+    UInt32 count =
+        run.count - i < kRunLength ? run.count - i : (UInt32)kRunLength;
+    for (UInt32 j = 0; j < count; j++) events[j] = MakeEvent(i + j);
+    UInt32 written = run.fifo->WriteItems(events, count);
+    // what didn't fit is made again next time round
+    i += written;
+    if (written == 0) sched_yield();
+  }
+  return NULL;
+}
+
+static void *BatchReader(void *arg) {
+  Run<LockFreeFIFO<Event> > &run = *(Run<LockFreeFIFO<Event> > *)arg;
+  Event events[kRunLength];
+  for (UInt32 i = 0; i < run.count;) {
+    UInt32 count = run.fifo->ReadItems(events, kRunLength);
+    if (count == 0) {
+      sched_yield();
+      continue;
+    }
+    for (UInt32 j = 0; j < count; j++)
+      run.checksum += events[j].sequence + events[j].data;
+    i += count;
+  }
+  return NULL;
+}
+
+template <class FIFO>
+static void Measure(const char *name, void *(*writer)(void *),
+                    void *(*reader)(void *), UInt32 count) {
+  UInt64 best = ~(UInt64)0, checksum = 0;
+  for (int repeat = 0; repeat < kRepeats; repeat++) {
+    FIFO fifo(kQueueSize);
+    Run<FIFO> run = {&fifo, count, 0};
+    pthread_t writerThread, readerThread;
+    UInt64 start = Now();
+    pthread_create(&readerThread, NULL, reader, &run);
+    pthread_create(&writerThread, NULL, writer, &run);
+    pthread_join(writerThread, NULL);
+    pthread_join(readerThread, NULL);
+    UInt64 elapsed = Now() - start;
+    if (elapsed < best) best = elapsed;
+    checksum = run.checksum;
+  }
+  printf("%-10s %10.1f %10.2f   %016llx\n", name, count * 1e3 / best,
+         (double)best / count, (unsigned long long)checksum);
+}
+
+int main(int argc, char *argv[]) {
+  UInt32 count = (UInt32)((argc > 1 ? atof(argv[1]) : 20) * 1e6);
+  printf("%-10s %10s %10s   %s\n", "workload", "Mevents/s", "ns/event",
+         "checksum");
+  Measure<LegacyLockFreeFIFO<Event> >(
+      "legacy", SingleWriter<LegacyLockFreeFIFO<Event> >,
+      SingleReader<LegacyLockFreeFIFO<Event> >, count);
+  Measure<LockFreeFIFO<Event> >("single", SingleWriter<LockFreeFIFO<Event> >,
+                                SingleReader<LockFreeFIFO<Event> >, count);
+  Measure<LockFreeFIFO<Event> >("batch", BatchWriter, BatchReader, count);
+  return 0;
+}
@@ -0,0 +1,266 @@
+//
+//  LockFreeFIFOStress.cpp
+//  ChordTrigger
+//
+//  Stress test for LockFreeFIFO and LockFreeFIFOWithFree. A writer and a
+//  reader thread move numbered items through queues from 2 to 1024 slots,
+//  each side picking at random between the single-item calls, WriteItems,
+//  ReadItems and ReadableItems with random run lengths, so full and empty
+//  queues and runs across the end of the ring come up all the time. The
+//  reader checks that every item arrives once and in order; with
+//  LockFreeFIFOWithFree, every item must also be freed once, on the writer
+//  thread and only after it was read. Exits non-zero on the first failure.
+//
+//  From the repository root:
+//
+//    c++ -O2 -std=c++11 -IBenchmark/include -IAUPublic/AUInstrumentBase
+//        -include CoreAudio/CoreAudioTypes.h
+//        Benchmark/LockFreeFIFOStress.cpp -o lockfreefifostress -lpthread
+//    lockfreefifostress [items per queue size]
+//
+//  Add -fsanitize=thread to have ThreadSanitizer check the orderings, and
+//  drop -std=c++11 (or use -std=c++98) to test the __atomic fallback.
+//
+
+#include "LockFreeFIFO.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+enum { kMaxRun = 40 };
+
+static volatile int gFailed = 0;
+
+static void Fail(const char *what, UInt32 expected, UInt32 got) {
+  if (__sync_bool_compare_and_swap(&gFailed, 0, 1))
+    fprintf(stderr, "FAILED: %s (expected %u, got %u)\n", what, expected, got);
+}
+
+// Per-thread xorshift, so neither side shares state with the other.
+typedef struct Random {
+  UInt32 state;
+  UInt32 Next(UInt32 range) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state % range;
+  }
+} Random;
+
+//------------------------------------------------------------------------------
+// LockFreeFIFO
+
+typedef struct Item {
+  UInt32 sequence;
+  UInt32 check;  // catches torn copies
+} Item;
+
+static Item MakeItem(UInt32 sequence) {
+  Item item = {sequence, sequence * 2654435761u};
+  return item;
+}
+
+typedef struct Run {
+  LockFreeFIFO<Item> *fifo;
+  UInt32 count;
+  UInt32 seed;
+} Run;
+
+static void *Writer(void *arg) {
+  Run &run = *(Run *)arg;
+  Random random = {run.seed};
+  Item items[kMaxRun];
+  UInt32 next = 0;
+  while (next < run.count && !gFailed) {
+    if (random.Next(2) == 0) {
+      Item *item = run.fifo->WriteItem();
+      if (item == NULL) {
+        sched_yield();
+        continue;
+      }
+      *item = MakeItem(next++);
+      run.fifo->AdvanceWritePtr();
+    } else {
+      UInt32 count = 1 + random.Next(kMaxRun);
+      if (count > run.count - next) count = run.count - next;
+      for (UInt32 i = 0; i < count; i++) items[i] = MakeItem(next + i);
+      UInt32 written = run.fifo->WriteItems(items, count);
+      next += written;
+      if (written < count) sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static bool Check(const Item &item, UInt32 &ioNext) {
+  if (item.sequence != ioNext || item.check != MakeItem(ioNext).check) {
+    Fail("item out of order or torn", ioNext, item.sequence);
+    return false;
+  }
+  ioNext++;
+  return true;
+}
+
+static void *Reader(void *arg) {
+  Run &run = *(Run *)arg;
+  Random random = {run.seed * 7 + 1};
+  Item items[kMaxRun];
+  UInt32 next = 0;
+  while (next < run.count && !gFailed) {
+    UInt32 got = 0;
+    switch (random.Next(3)) {
+      case 0: {
+        Item *item = run.fifo->ReadItem();
+        if (item == NULL) break;
+        Check(*item, next);
+        run.fifo->AdvanceReadPtr();
+        got = 1;
+        break;
+      }
+      case 1:
+        got = run.fifo->ReadItems(items, 1 + random.Next(kMaxRun));
+        for (UInt32 i = 0; i < got; i++) Check(items[i], next);
+        break;
+      case 2: {
+        Item *runItems;
+        got = run.fifo->ReadableItems(runItems);
+        if (got > 1) got = 1 + random.Next(got);  // hand back part of it
+        for (UInt32 i = 0; i < got; i++) Check(runItems[i], next);
+        run.fifo->AdvanceReadPtr(got);
+        break;
+      }
+    }
+    if (got == 0) sched_yield();
+  }
+  if (run.fifo->ReadItem() != NULL) Fail("item left over", 0, 1);
+  return NULL;
+}
+
+//------------------------------------------------------------------------------
+// LockFreeFIFOWithFree
+
+static pthread_t gWriterThread;
+static std::vector<UInt8> gState;  // per sequence number
+enum { kWritten = 1, kRead = 2, kFreed = 3 };
+
+typedef struct FreeItem {
+  UInt32 sequence;
+  bool owned;  // something to free
+
+  void Free() {
+    if (!owned) return;
+    owned = false;
+    if (!pthread_equal(pthread_self(), gWriterThread))
+      Fail("freed on the reader thread", 0, sequence);
+    UInt8 state = __atomic_load_n(&gState[sequence], __ATOMIC_ACQUIRE);
+    if (state != kRead) Fail("freed before read or twice", kRead, state);
+    __atomic_store_n(&gState[sequence], (UInt8)kFreed, __ATOMIC_RELEASE);
+  }
+} FreeItem;
+
+typedef struct FreeRun {
+  LockFreeFIFOWithFree<FreeItem> *fifo;
+  UInt32 count;
+  UInt32 seed;
+} FreeRun;
+
+static void *FreeWriter(void *arg) {
+  FreeRun &run = *(FreeRun *)arg;
+  Random random = {run.seed};
+  FreeItem items[kMaxRun];
+  UInt32 next = 0;
+  while (next < run.count && !gFailed) {
+    UInt32 count = random.Next(2) == 0 ? 0 : 1 + random.Next(kMaxRun);
+    if (count > run.count - next) count = run.count - next;
+    if (count == 0) {
+      FreeItem *item = run.fifo->WriteItem();
+      if (item == NULL) {
+        sched_yield();
+        continue;
+      }
+      gState[next] = kWritten;
+      item->sequence = next++;
+      item->owned = true;
+      run.fifo->AdvanceWritePtr();
+    } else {
+      for (UInt32 i = 0; i < count; i++) {
+        items[i].sequence = next + i;
+        items[i].owned = true;
+        gState[next + i] = kWritten;
+      }
+      UInt32 written = run.fifo->WriteItems(items, count);
+      next += written;
+      if (written < count) sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static void *FreeReader(void *arg) {
+  FreeRun &run = *(FreeRun *)arg;
+  Random random = {run.seed * 7 + 1};
+  UInt32 next = 0;
+  while (next < run.count && !gFailed) {
+    FreeItem *items;
+    UInt32 got;
+    if (random.Next(2) == 0) {
+      items = run.fifo->ReadItem();
+      got = items ? 1 : 0;
+    } else {
+      got = run.fifo->ReadableItems(items);
+    }
+    if (got == 0) {
+      sched_yield();
+      continue;
+    }
+    for (UInt32 i = 0; i < got; i++) {
+      if (items[i].sequence != next || !items[i].owned)
+        Fail("item out of order or already freed", next, items[i].sequence);
+      __atomic_store_n(&gState[next], (UInt8)kRead, __ATOMIC_RELEASE);
+      next++;
+    }
+    run.fifo->AdvanceReadPtr(got);
+  }
+  return NULL;
+}
+
+//------------------------------------------------------------------------------
+// driver
+
+int main(int argc, char *argv[]) {
+  UInt32 count = argc > 1 ? (UInt32)atoi(argv[1]) : 200000;
+  for (UInt32 size = 2; size <= 1024 && !gFailed; size *= 2) {
+    LockFreeFIFO<Item> fifo(size);
+    for (int round = 0; round < 2 && !gFailed; round++) {
+      Run run = {&fifo, count, 12345u + size + round};
+      pthread_t writer, reader;
+      pthread_create(&writer, NULL, Writer, &run);
+      pthread_create(&reader, NULL, Reader, &run);
+      pthread_join(writer, NULL);
+      pthread_join(reader, NULL);
+      fifo.Reset();  // the second round starts over from index 0
+    }
+
+    LockFreeFIFOWithFree<FreeItem> freeFifo(size);
+    gState.assign(count, 0);
+    FreeRun freeRun = {&freeFifo, count, 54321u + size};
+    pthread_t reader;
+    pthread_create(&gWriterThread, NULL, FreeWriter, &freeRun);
+    pthread_create(&reader, NULL, FreeReader, &freeRun);
+    pthread_join(gWriterThread, NULL);
+    pthread_join(reader, NULL);
+
+    // what is still unfreed goes on Reset, on this thread
+    gWriterThread = pthread_self();
+    freeFifo.Reset();
+    for (UInt32 i = 0; i < count && !gFailed; i++)
+      if (gState[i] != kFreed) Fail("item never freed", kFreed, gState[i]);
+
+    if (!gFailed) printf("size %4u: %u items through each queue\n", size, count);
+  }
+  if (gFailed) return 1;
+  printf("passed\n");
+  return 0;
+}
@@ -0,0 +1,277 @@
+//
+//  MIDIParserFuzzer.cpp
+//  ChordTrigger
+//
+//  Fuzz target for AUMIDIParser. Each input is a MIDI 1.0 byte stream; its
+//  first byte seeds how the rest is cut into packets. The stream is parsed
+//  three ways: as one packet, cut into packets, and byte by byte with a
+//  plain reference state machine written straight from the MIDI 1.0 spec.
+//  All three must produce the same messages and the same complete SysEx
+//  messages, and every packet is copied into a buffer of exactly its size,
+//  so AddressSanitizer reports any read past its end.
+//
+//  With libFuzzer:
+//
+//    clang++ -g -O1 -fsanitize=fuzzer,address -DMIDI_PARSER_LIBFUZZER
+//        -IBenchmark/include -IAUPublic/OtherBases
+//        Benchmark/MIDIParserFuzzer.cpp -o midiparserfuzz
+//    ./midiparserfuzz Benchmark/MIDIParserCorpus
+//
+//  Without it, the same build minus -fsanitize=fuzzer and the define replays
+//  the files given on the command line, then as many random streams as
+//  asked for:
+//
+//    midiparserfuzz [-random count] [corpus files...]
+//
+
+#include "AUMIDIParser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// A message as both parsers report it; SysEx only once complete.
+typedef struct ParsedMessage {
+  UInt8 status;
+  UInt8 data1;
+  UInt8 data2;
+  std::vector<UInt8> sysEx;
+
+  bool operator==(const ParsedMessage &other) const {
+    return status == other.status && data1 == other.data1 &&
+           data2 == other.data2 && sysEx == other.sysEx;
+  }
+} ParsedMessage;
+
+typedef std::vector<ParsedMessage> MessageList;
+
+static void AddMessage(MessageList &list, UInt8 status, UInt8 data1,
+                       UInt8 data2) {
+  ParsedMessage message;
+  message.status = status;
+  message.data1 = data1;
+  message.data2 = data2;
+  list.push_back(message);
+}
+
+//------------------------------------------------------------------------------
+// reference
+
+class ReferenceParser {
+ public:
+  ReferenceParser()
+      : mRunningStatus(0), mStatus(0), mCount(0), mNeeded(0),
+        mInSysEx(false) {}
+
+  void Feed(UInt8 byte, MessageList &out) {
+    if (byte >= 0xF8) {
+      AddMessage(out, byte, 0, 0);
+      return;
+    }
+    if (mInSysEx) {
+      if (byte < 0x80) {
+        mSysEx.push_back(byte);
+        return;
+      }
+      // any status byte ends SysEx; only 0xF7 belongs to it
+      if (byte == 0xF7) mSysEx.push_back(byte);
+      AddMessage(out, 0xF0, 0, 0);
+      out.back().sysEx = mSysEx;
+      mInSysEx = false;
+      if (byte == 0xF7) return;
+    }
+    if (byte < 0x80) {
+      if (mStatus == 0) {
+        if (mRunningStatus == 0) return;
+        mStatus = mRunningStatus;
+        mCount = 0;
+        mNeeded = Length(mStatus);
+      }
+      mData[mCount++] = byte;
+      if (mCount == mNeeded) {
+        AddMessage(out, mStatus, mData[0], mNeeded == 2 ? mData[1] : 0);
+        mStatus = 0;
+      }
+      return;
+    }
+    mStatus = 0;
+    if (byte >= 0xF0) {
+      mRunningStatus = 0;
+      if (byte == 0xF0) {
+        mInSysEx = true;
+        mSysEx.assign(1, byte);
+        return;
+      }
+      if (byte == 0xF4 || byte == 0xF5 || byte == 0xF7) return;
+      if (Length(byte) == 0) {
+        AddMessage(out, byte, 0, 0);
+        return;
+      }
+    } else {
+      mRunningStatus = byte;
+    }
+    mStatus = byte;
+    mCount = 0;
+    mNeeded = Length(byte);
+  }
+
+ private:
+  static int Length(UInt8 status) {
+    switch (status & 0xF0) {
+      case 0xC0:
+      case 0xD0:
+        return 1;
+      case 0xF0:
+        return status == 0xF2 ? 2 : (status == 0xF1 || status == 0xF3) ? 1 : 0;
+      default:
+        return 2;
+    }
+  }
+
+  UInt8 mRunningStatus, mStatus, mData[2];
+  int mCount, mNeeded;
+  bool mInSysEx;
+  std::vector<UInt8> mSysEx;
+};
+
+//------------------------------------------------------------------------------
+// AUMIDIParser, packet by packet
+
+// Assembles SysEx pieces the way AUMIDIBase::HandleSysExPiece does.
+static void Parse(AUMIDIParser &parser, const UInt8 *data, size_t length,
+                  std::vector<UInt8> &sysEx, MessageList &out) {
+  // an exactly sized copy, so reading past the end is caught
+  UInt8 *packet = (UInt8 *)malloc(length ? length : 1);
+  memcpy(packet, data, length);
+
+  const UInt8 *p = packet, *end = packet + length;
+  AUMIDIMessage message;
+  while (parser.Next(p, end, message)) {
+    if (p < packet || p > end) abort();
+    if (message.status != 0xF0) {
+      AddMessage(out, message.status, message.data1, message.data2);
+      continue;
+    }
+    if (message.sysExData < packet ||
+        message.sysExData + message.sysExLength > end)
+      abort();
+    if (message.sysExFlags & AUMIDIMessage::kSysExStart) sysEx.clear();
+    sysEx.insert(sysEx.end(), message.sysExData,
+                 message.sysExData + message.sysExLength);
+    if (message.sysExFlags & AUMIDIMessage::kSysExEnd) {
+      AddMessage(out, 0xF0, 0, 0);
+      out.back().sysEx = sysEx;
+    }
+  }
+  if (p != end) abort();
+  free(packet);
+}
+
+static void Check(const MessageList &expected, const MessageList &actual,
+                  const char *what) {
+  if (expected == actual) return;
+  size_t i = 0;
+  while (i < expected.size() && i < actual.size() && expected[i] == actual[i])
+    i++;
+  fprintf(stderr, "%s: %zu messages, expected %zu; first difference at %zu\n",
+          what, actual.size(), expected.size(), i);
+  abort();
+}
+
+static void RunOne(const UInt8 *data, size_t size) {
+  if (size == 0) return;
+  UInt32 seed = data[0];
+  const UInt8 *stream = data + 1;
+  size_t length = size - 1;
+
+  MessageList expected;
+  ReferenceParser reference;
+  for (size_t i = 0; i < length; i++) reference.Feed(stream[i], expected);
+
+  MessageList whole;
+  AUMIDIParser wholeParser;
+  std::vector<UInt8> wholeSysEx;
+  Parse(wholeParser, stream, length, wholeSysEx, whole);
+  Check(expected, whole, "one packet");
+
+  MessageList split;
+  AUMIDIParser splitParser;
+  std::vector<UInt8> splitSysEx;
+  size_t maxPacket = 1 + seed % 40;
+  for (size_t offset = 0; offset < length;) {
+    seed = seed * 1664525 + 1013904223;
+    size_t packetLength = 1 + (seed >> 16) % maxPacket;
+    if (packetLength > length - offset) packetLength = length - offset;
+    Parse(splitParser, stream + offset, packetLength, splitSysEx, split);
+    offset += packetLength;
+  }
+  Check(expected, split, "split packets");
+}
+
+#ifdef MIDI_PARSER_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const UInt8 *data, size_t size) {
+  RunOne(data, size);
+  return 0;
+}
+
+#else
+
+// Mostly well-formed MIDI with the awkward cases mixed in.
+static void RandomStream(std::vector<UInt8> &out) {
+  static const UInt8 kStatus[] = {0x90, 0x80, 0xB0, 0xC0, 0xD0, 0xE0, 0xA0,
+                                  0xF0, 0xF1, 0xF2, 0xF3, 0xF6, 0xF7, 0xF8,
+                                  0xFA, 0xFE, 0xF4, 0xF9};
+  out.assign(1, (UInt8)rand());
+  int numEvents = rand() % 64;
+  for (int i = 0; i < numEvents; i++) {
+    int kind = rand() % 10;
+    if (kind < 6) {
+      // a message, or running status data
+      if (kind < 4) out.push_back(kStatus[rand() % 7] | rand() % 16);
+      for (int d = rand() % 3; d >= 0; d--) out.push_back(rand() & 0x7F);
+    } else if (kind < 8) {
+      out.push_back(kStatus[rand() % sizeof(kStatus)]);
+    } else if (kind < 9) {
+      // SysEx, long enough for the vector scan
+      out.push_back(0xF0);
+      for (int d = rand() % 100; d > 0; d--)
+        out.push_back(rand() % 50 ? rand() & 0x7F : 0xF8);
+      if (rand() % 4) out.push_back(0xF7);
+    } else {
+      out.push_back((UInt8)rand());
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  long numRandom = 0;
+  int numFiles = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-random") == 0 && i + 1 < argc) {
+      numRandom = atol(argv[++i]);
+      continue;
+    }
+    FILE *file = fopen(argv[i], "rb");
+    if (file == NULL) {
+      fprintf(stderr, "can't open %s\n", argv[i]);
+      return 1;
+    }
+    std::vector<UInt8> data;
+    int c;
+    while ((c = fgetc(file)) != EOF) data.push_back((UInt8)c);
+    fclose(file);
+    RunOne(data.empty() ? NULL : &data[0], data.size());
+    numFiles++;
+  }
+
+  std::vector<UInt8> data;
+  for (long i = 0; i < numRandom; i++) {
+    RandomStream(data);
+    RunOne(&data[0], data.size());
+  }
+  printf("%d corpus files, %ld random streams: ok\n", numFiles, numRandom);
+  return 0;
+}
+
+#endif
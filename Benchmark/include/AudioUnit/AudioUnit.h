@@ -0,0 +1,25 @@
+//
+//  AudioUnit.h
+//  ChordTrigger benchmark
+//
+//  Only the MIDI output callback types the engine uses.
+//
+
+#ifndef __BenchmarkAudioUnit__
+#define __BenchmarkAudioUnit__
+
+#include <CoreAudio/CoreAudioTypes.h>
+
+struct MIDIPacketList;
+
+typedef OSStatus (*AUMIDIOutputCallback)(void *userData,
+                                         const AudioTimeStamp *timeStamp,
+                                         UInt32 midiOutNum,
+                                         const struct MIDIPacketList *pktlist);
+
+typedef struct AUMIDIOutputCallbackStruct {
+  AUMIDIOutputCallback midiOutputCallback;
+  void *userData;
+} AUMIDIOutputCallbackStruct;
+
+#endif
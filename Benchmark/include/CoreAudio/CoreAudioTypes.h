@@ -0,0 +1,38 @@
+//
+//  CoreAudioTypes.h
+//  ChordTrigger benchmark
+//
+
+#ifndef __BenchmarkCoreAudioTypes__
+#define __BenchmarkCoreAudioTypes__
+
+#include <CoreFoundation/CFBase.h>
+
+typedef struct SMPTETime {
+  SInt16 mSubframes;
+  SInt16 mSubframeDivisor;
+  UInt32 mCounter;
+  UInt32 mType;
+  UInt32 mFlags;
+  SInt16 mHours;
+  SInt16 mMinutes;
+  SInt16 mSeconds;
+  SInt16 mFrames;
+} SMPTETime;
+
+typedef struct AudioTimeStamp {
+  Float64 mSampleTime;
+  UInt64 mHostTime;
+  Float64 mRateScalar;
+  UInt64 mWordClockTime;
+  SMPTETime mSMPTETime;
+  UInt32 mFlags;
+  UInt32 mReserved;
+} AudioTimeStamp;
+
+enum {
+  kAudioTimeStampSampleTimeValid = (1U << 0),
+  kAudioTimeStampHostTimeValid = (1U << 1)
+};
+
+#endif
@@ -0,0 +1,32 @@
+//
+//  CFBase.h
+//  ChordTrigger benchmark
+//
+//  Minimal stand-in for the MacTypes/CoreFoundation scalar types, so the
+//  engine sources build on platforms without the Apple SDKs.
+//
+
+#ifndef __BenchmarkCFBase__
+#define __BenchmarkCFBase__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t UInt8;
+typedef int8_t SInt8;
+typedef uint16_t UInt16;
+typedef int16_t SInt16;
+typedef uint32_t UInt32;
+typedef int32_t SInt32;
+typedef uint64_t UInt64;
+typedef int64_t SInt64;
+typedef float Float32;
+typedef double Float64;
+typedef unsigned char Boolean;
+typedef UInt8 Byte;
+typedef unsigned long ByteCount;
+typedef SInt32 OSStatus;
+
+enum { noErr = 0 };
+
+#endif
@@ -0,0 +1,64 @@
+//
+//  CoreMIDI.h
+//  ChordTrigger benchmark
+//
+//  Packet list types and the two packet list builders, following the
+//  documented CoreMIDI behaviour: MIDIPacketListAdd appends to the current
+//  packet when the time stamp matches and starts a new one otherwise, and
+//  returns NULL when the list is out of room.
+//
+
+#ifndef __BenchmarkCoreMIDI__
+#define __BenchmarkCoreMIDI__
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <AudioUnit/AudioUnit.h>
+#include <string.h>
+
+typedef UInt64 MIDITimeStamp;
+
+#pragma pack(push, 4)
+typedef struct MIDIPacket {
+  MIDITimeStamp timeStamp;
+  UInt16 length;
+  Byte data[256];
+} MIDIPacket;
+
+typedef struct MIDIPacketList {
+  UInt32 numPackets;
+  MIDIPacket packet[1];
+} MIDIPacketList;
+#pragma pack(pop)
+
+#define MIDIPacketNext(pkt) ((MIDIPacket *)&(pkt)->data[(pkt)->length])
+
+inline MIDIPacket *MIDIPacketListInit(MIDIPacketList *pktlist) {
+  pktlist->numPackets = 0;
+  return &pktlist->packet[0];
+}
+
+inline MIDIPacket *MIDIPacketListAdd(MIDIPacketList *pktlist, ByteCount listSize,
+                                     MIDIPacket *curPacket, MIDITimeStamp time,
+                                     ByteCount nData, const Byte *data) {
+  const Byte *listEnd = (const Byte *)pktlist + listSize;
+
+  if (pktlist->numPackets > 0 && curPacket->timeStamp == time &&
+      curPacket->data[0] != 0xF0 && data[0] != 0xF0 &&
+      curPacket->length + nData <= sizeof(curPacket->data)) {
+    if (curPacket->data + curPacket->length + nData > listEnd) return NULL;
+    memcpy(curPacket->data + curPacket->length, data, nData);
+    curPacket->length += (UInt16)nData;
+    return curPacket;
+  }
+
+  MIDIPacket *pkt =
+      pktlist->numPackets > 0 ? MIDIPacketNext(curPacket) : curPacket;
+  if (nData > sizeof(pkt->data) || pkt->data + nData > listEnd) return NULL;
+  pkt->timeStamp = time;
+  pkt->length = (UInt16)nData;
+  memcpy(pkt->data, data, nData);
+  pktlist->numPackets++;
+  return pkt;
+}
+
+#endif
@@ -0,0 +1,24 @@
+//
+//  TargetConditionals.h
+//  ChordTrigger benchmark
+//
+
+#ifndef __BenchmarkTargetConditionals__
+#define __BenchmarkTargetConditionals__
+
+#if defined(__x86_64__)
+#define TARGET_CPU_X86_64 1
+#elif defined(__i386__)
+#define TARGET_CPU_X86 1
+#endif
+
+#ifndef TARGET_CPU_X86
+#define TARGET_CPU_X86 0
+#endif
+#ifndef TARGET_CPU_X86_64
+#define TARGET_CPU_X86_64 0
+#endif
+#define TARGET_OS_WIN32 0
+#define TARGET_OS_MAC 0
+
+#endif
@@ -0,0 +1,78 @@
+//
+//  OSAtomic.h
+//  ChordTrigger benchmark
+//
+//  The OSAtomic calls CAAtomic.h is built on, mapped to the GCC/Clang
+//  __sync builtins. All of them are full barriers, like the Barrier
+//  variants they stand in for.
+//
+
+#ifndef __BenchmarkOSAtomic__
+#define __BenchmarkOSAtomic__
+
+#include <stdint.h>
+#include <unistd.h>  // usleep, used by CAAtomic.h's non-Mac spin lock
+
+inline void OSMemoryBarrier() { __sync_synchronize(); }
+
+inline int32_t OSAtomicAdd32Barrier(int32_t amount, volatile int32_t *value) {
+  return __sync_add_and_fetch(value, amount);
+}
+
+inline int32_t OSAtomicIncrement32(volatile int32_t *value) {
+  return __sync_add_and_fetch(value, 1);
+}
+
+inline int32_t OSAtomicIncrement32Barrier(volatile int32_t *value) {
+  return __sync_add_and_fetch(value, 1);
+}
+
+inline int32_t OSAtomicDecrement32(volatile int32_t *value) {
+  return __sync_sub_and_fetch(value, 1);
+}
+
+inline int32_t OSAtomicDecrement32Barrier(volatile int32_t *value) {
+  return __sync_sub_and_fetch(value, 1);
+}
+
+inline int32_t OSAtomicOr32Barrier(uint32_t mask, volatile uint32_t *value) {
+  return (int32_t)__sync_or_and_fetch(value, mask);
+}
+
+inline int32_t OSAtomicAnd32Barrier(uint32_t mask, volatile uint32_t *value) {
+  return (int32_t)__sync_and_and_fetch(value, mask);
+}
+
+inline bool OSAtomicCompareAndSwap32(int32_t oldValue, int32_t newValue,
+                                     volatile int32_t *value) {
+  return __sync_bool_compare_and_swap(value, oldValue, newValue);
+}
+
+inline bool OSAtomicCompareAndSwap32Barrier(int32_t oldValue, int32_t newValue,
+                                            volatile int32_t *value) {
+  return __sync_bool_compare_and_swap(value, oldValue, newValue);
+}
+
+inline bool OSAtomicCompareAndSwap64Barrier(int64_t oldValue, int64_t newValue,
+                                            volatile int64_t *value) {
+  return __sync_bool_compare_and_swap(value, oldValue, newValue);
+}
+
+// Bit n is counted from the most significant bit of the first byte.
+inline bool OSAtomicTestAndSetBarrier(uint32_t n, volatile void *address) {
+  volatile uint8_t *byte = (volatile uint8_t *)address + (n >> 3);
+  uint8_t mask = (uint8_t)(0x80 >> (n & 7));
+  return (__sync_fetch_and_or(byte, mask) & mask) != 0;
+}
+
+inline bool OSAtomicTestAndClearBarrier(uint32_t n, volatile void *address) {
+  volatile uint8_t *byte = (volatile uint8_t *)address + (n >> 3);
+  uint8_t mask = (uint8_t)(0x80 >> (n & 7));
+  return (__sync_fetch_and_and(byte, (uint8_t)~mask) & mask) != 0;
+}
+
+inline bool OSAtomicTestAndClear(uint32_t n, volatile void *address) {
+  return OSAtomicTestAndClearBarrier(n, address);
+}
+
+#endif
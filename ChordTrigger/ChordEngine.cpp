@@ -0,0 +1,479 @@
+//
+//  ChordEngine.cpp
+//  ChordTrigger
+//
+
+#include "ChordEngine.h"
+
+enum {
+  kNoteOff = 0x80,
+  kNoteOn = 0x90,
+  kControlChange = 0xB0,
+  kProgramChange = 0xC0
+};
+
+ChordEngine::ChordEngine()
+    : mRenderSampleTime(0),
+      mBank(NULL),
+      mPinnedChordMaps(NULL),
+      mPinnedSettings(NULL) {
+  for (int ch = 0; ch < kChannelCount; ch++) {
+    mChannelChordMaps[ch] = NULL;
+    mProgram[ch] = -1;
+    mRecognizedChord[ch] = ChordRecognizer::kNoChord;
+  }
+  memset(mNoteOnDelay, 0, sizeof(mNoteOnDelay));
+  ClearNoteSampleTimes();
+  pthread_mutex_init(&mEditMutex, NULL);
+  PublishChordMaps();
+  PublishSettings();
+}
+
+ChordEngine::~ChordEngine() {
+  UnpinSnapshots();
+  pthread_mutex_destroy(&mEditMutex);
+  for (int ch = 0; ch < kChannelCount; ch++) delete mChannelChordMaps[ch];
+  if (mBank) mBank->Release();
+}
+
+void ChordEngine::Reset() {
+  mOutput.SetMaxEvents(mOutput.MaxEvents());  // resets stats
+  mScheduler.Clear();
+  mRenderSampleTime = 0;
+  ClearNoteSampleTimes();
+  for (int ch = 0; ch < kChannelCount; ch++) {
+    noteFlag[ch].Clear();
+    mHeldNotes[ch].Clear();
+    mVoiceLeaders[ch].Clear();
+    mRecognizedChord[ch] = ChordRecognizer::kNoChord;
+    mProgram[ch] = -1;
+  }
+  UnpinSnapshots();
+  EditLocker lock(*this);
+  mChordMapPublisher.Reclaim();
+  mSettingsPublisher.Reclaim();
+}
+
+void ChordEngine::ClearNoteSampleTimes() {
+  for (int ch = 0; ch < kChannelCount; ch++)
+    for (int note = 0; note < NoteOwnership::kNoteCount; note++)
+      mNoteSampleTime[ch][note] = -1;
+}
+
+void ChordEngine::SetChordMapBank(ChordMapBank *inBank) {
+  if (mBank) mBank->Release();
+  mBank = inBank;
+}
+
+void ChordEngine::PublishChordMaps() {
+  mChordMapPublisher.Publish(
+      new ChordMapSnapshot(mChordMap, mChannelChordMaps, mBank));
+}
+
+static const UInt8 kStateMagic[4] = {'C', 'T', 'S', 'T'};
+enum { kStateSharedMap = 0, kStateBank = 0x80 };
+
+static UInt32 Adler32(const UInt8 *inData, UInt32 inSize) {
+  UInt32 a = 1, b = 0;
+  while (inSize > 0) {
+    UInt32 count = inSize < 5552 ? inSize : 5552;  // b can't overflow
+    inSize -= count;
+    while (count--) {
+      a += *inData++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+static void WriteUInt32(UInt8 *p, UInt32 value) {
+  p[0] = (UInt8)(value >> 24);
+  p[1] = (UInt8)(value >> 16);
+  p[2] = (UInt8)(value >> 8);
+  p[3] = (UInt8)value;
+}
+
+static UInt32 ReadUInt32(const UInt8 *p) {
+  return ((UInt32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static UInt8 *BeginSection(UInt8 *p, UInt8 id) {
+  p[0] = id;
+  return p + ChordEngine::kChordMapStateSectionHeaderSize;
+}
+
+static UInt8 *EndSection(UInt8 *data, UInt32 size) {
+  WriteUInt32(data - 4, size);
+  return data + size;
+}
+
+UInt32 ChordEngine::SaveChordMaps(UInt8 *outData) const {
+  UInt8 *p = outData + kChordMapStateHeaderSize;
+  int numSections = 0;
+
+  UInt8 *data = BeginSection(p, kStateSharedMap);
+  p = EndSection(data, mChordMap.Save(data));
+  numSections++;
+  for (int ch = 0; ch < kChannelCount; ch++) {
+    if (mChannelChordMaps[ch] == NULL) continue;
+    data = BeginSection(p, (UInt8)(ch + 1));
+    p = EndSection(data, mChannelChordMaps[ch]->Save(data));
+    numSections++;
+  }
+  if (mBank) {
+    data = BeginSection(p, kStateBank);
+    p = EndSection(data, mBank->Save(data));
+    numSections++;
+  }
+
+  UInt32 size = (UInt32)(p - outData);
+  memcpy(outData, kStateMagic, sizeof(kStateMagic));
+  outData[4] = kChordMapStateVersion;
+  outData[5] = 0;
+  outData[6] = (UInt8)(numSections >> 8);
+  outData[7] = (UInt8)numSections;
+  WriteUInt32(outData + 8, Adler32(outData + kChordMapStateHeaderSize,
+                                    size - kChordMapStateHeaderSize));
+  return size;
+}
+
+bool ChordEngine::RestoreChordMaps(const UInt8 *inData, UInt32 inSize) {
+  if (inSize < kChordMapStateHeaderSize ||
+      memcmp(inData, kStateMagic, sizeof(kStateMagic)) != 0 ||
+      inData[4] == 0 || inData[4] > kChordMapStateVersion ||
+      ReadUInt32(inData + 8) != Adler32(inData + kChordMapStateHeaderSize,
+                                        inSize - kChordMapStateHeaderSize))
+    return false;
+
+  // first pass: check every section, decoding only the bank, which is
+  // built separately anyway
+  const UInt8 *maps[1 + kChannelCount] = {NULL};
+  UInt32 mapSizes[1 + kChannelCount];
+  ChordMapBank *bank = NULL;
+  bool valid = true;
+
+  int numSections = (inData[6] << 8) | inData[7];
+  const UInt8 *p = inData + kChordMapStateHeaderSize, *end = inData + inSize;
+  for (int i = 0; i < numSections && valid; i++) {
+    if (end - p < kChordMapStateSectionHeaderSize) {
+      valid = false;
+      break;
+    }
+    UInt8 id = p[0];
+    UInt32 size = ReadUInt32(p + 1);
+    p += kChordMapStateSectionHeaderSize;
+    if ((UInt32)(end - p) < size) {
+      valid = false;
+    } else if (id == kStateBank) {
+      if (bank) bank->Release();
+      bank = new ChordMapBank;
+      valid = bank->Restore(p, size);
+    } else if (id <= kChannelCount) {
+      maps[id] = p;
+      mapSizes[id] = size;
+      valid = ChordMap::IsValid(p, size);
+    } else {
+      valid = false;
+    }
+    p += size;
+  }
+  if (!valid || p != end || maps[kStateSharedMap] == NULL) {
+    if (bank) bank->Release();
+    return false;
+  }
+
+  mChordMap.Restore(maps[kStateSharedMap], mapSizes[kStateSharedMap]);
+  for (int ch = 0; ch < kChannelCount; ch++) {
+    if (maps[ch + 1] == NULL) {
+      delete mChannelChordMaps[ch];
+      mChannelChordMaps[ch] = NULL;
+      continue;
+    }
+    if (mChannelChordMaps[ch] == NULL) mChannelChordMaps[ch] = new ChordMap;
+    mChannelChordMaps[ch]->Restore(maps[ch + 1], mapSizes[ch + 1]);
+  }
+  SetChordMapBank(bank);
+  return true;
+}
+
+ChordMap *ChordEngine::CreateChannelChordMap(UInt8 inChannel) {
+  if (mChannelChordMaps[inChannel] == NULL)
+    mChannelChordMaps[inChannel] = new ChordMap(mChordMap);
+  return mChannelChordMaps[inChannel];
+}
+
+bool ChordEngine::SetChannelChordMap(UInt8 inChannel, const UInt8 *inData,
+                                     UInt32 inSize) {
+  if (inData == NULL) {
+    delete mChannelChordMaps[inChannel];
+    mChannelChordMaps[inChannel] = NULL;
+    return true;
+  }
+
+  ChordMap *map = mChannelChordMaps[inChannel];
+  if (map == NULL) map = new ChordMap;
+  if (!map->Restore(inData, inSize)) {
+    if (map != mChannelChordMaps[inChannel]) delete map;
+    return false;
+  }
+  mChannelChordMaps[inChannel] = map;
+  return true;
+}
+
+void ChordEngine::HandleMIDI1Event(UInt8 group, UInt8 status, UInt8 channel,
+                                   UInt8 data1, UInt8 data2,
+                                   UInt32 inStartFrame) {
+  // data1 : note number, data2 : velocity
+  if (status == 0xF0) {
+    // a system message, passed as AUMIDIBase does: the rest of its status
+    // byte in |channel|
+    HandleSystemMessage(UMPMakeSystem(group, status | channel, data1, data2),
+                        inStartFrame);
+    return;
+  }
+  int listenChannel = PinnedSettings().channel;
+  bool listening = listenChannel < 0 || channel == listenChannel;
+  if (listening && status == kProgramChange && PinnedChordMaps().HasBank()) {
+    // held notes keep their owners, so switching never cuts them off
+    mProgram[channel] = data1;
+    TraceMessage(kTraceDecisionProgram, 0, inStartFrame,
+                 UMPMakeMIDI1(group, status, channel, data1, data2), 0);
+    return;
+  }
+  if (!listening || (status != kNoteOn && status != kNoteOff)) {
+    UInt32 word0 = UMPMakeMIDI1(group, status, channel, data1, data2);
+    mOutput.AddUMPEvent(word0, 0, inStartFrame);
+    TraceMessage(kTraceDecisionThru, 0, inStartFrame, word0, 0);
+    return;
+  }
+
+  if (data2 == 0) status = kNoteOff;  // velocity = 0 Noteon -> Noteoff
+
+  NoteMessage note = {false, group, status, channel, data1,
+                      UMPUpscaleVelocity(data2), 0, 0};
+  HandleNote(note, inStartFrame);
+}
+
+void ChordEngine::HandleMIDI2Event(UInt32 word0, UInt32 word1,
+                                   UInt32 inStartFrame) {
+  UInt8 status = UMPStatus(word0), channel = UMPChannel(word0);
+  int listenChannel = PinnedSettings().channel;
+  bool listening = listenChannel < 0 || channel == listenChannel;
+  if (listening && status == kProgramChange && PinnedChordMaps().HasBank()) {
+    mProgram[channel] = (word1 >> 24) & 0x7F;
+    TraceMessage(kTraceDecisionProgram, 0, inStartFrame, word0, word1);
+    return;
+  }
+  if (!listening || (status != kNoteOn && status != kNoteOff)) {
+    mOutput.AddUMPEvent(word0, word1, inStartFrame);
+    TraceMessage(kTraceDecisionThru, 0, inStartFrame, word0, word1);
+    return;
+  }
+
+  // unlike MIDI 1.0, a velocity 0 note-on is still a note-on
+  NoteMessage note = {true,
+                      UMPGroup(word0),
+                      status,
+                      channel,
+                      UMPData1(word0),
+                      UMPVelocity(word1),
+                      UMPAttributeType(word0),
+                      UMPAttribute(word1)};
+  HandleNote(note, inStartFrame);
+}
+
+UInt32 ChordEngine::HandleMIDIEventBatch(const MIDIEventBatch &inBatch) {
+  UInt32 numEvents = inBatch.Count();
+  for (UInt32 i = 0; i < numEvents; i++) {
+    UInt32 word0 = inBatch.Word(i);
+    if (UMPMessageType(word0) == kUMPTypeSystem) {
+      HandleSystemMessage(word0, inBatch.Frame(i));
+      continue;
+    }
+    HandleMIDI1Event(0, UMPStatus(word0), UMPChannel(word0), UMPData1(word0),
+                     UMPData2(word0), inBatch.Frame(i));
+  }
+  return numEvents;
+}
+
+UInt32 ChordEngine::HandleUMPEvents(const UInt32 *inWords, UInt32 inNumWords,
+                                    UInt32 inStartFrame) {
+  UInt32 numMessages = 0;
+  for (UInt32 i = 0; i < inNumWords; numMessages++) {
+    UInt32 word0 = inWords[i], numWords = UMPWordCount(word0);
+    if (i + numWords > inNumWords) break;
+
+    switch (UMPMessageType(word0)) {
+      case kUMPTypeMIDI1ChannelVoice:
+        HandleMIDI1Event(UMPGroup(word0), UMPStatus(word0), UMPChannel(word0),
+                         UMPData1(word0), UMPData2(word0), inStartFrame);
+        break;
+      case kUMPTypeMIDI2ChannelVoice:
+        HandleMIDI2Event(word0, inWords[i + 1], inStartFrame);
+        break;
+      case kUMPTypeSystem:
+        HandleSystemMessage(word0, inStartFrame);
+        break;
+    }
+    i += numWords;
+  }
+  return numMessages;
+}
+
+void ChordEngine::HandleNote(const NoteMessage &inNote, UInt32 inStartFrame) {
+  UInt8 channel = inNote.channel, trigger = inNote.note;
+  const Settings &settings = PinnedSettings();
+  const StrumTable &strumTable = settings.strumTable;
+  NoteOwnership &owners = noteFlag[channel];
+  const ChordMap &map =
+      PinnedChordMaps().MapForChannel(channel, mProgram[channel]);
+  const ChordMapEntry &chord = map.Lookup(trigger);
+
+  // Output notes are only switched on by the first trigger holding them and
+  // switched off by the last one, so overlapping chords never retrigger each
+  // other. A thru note owns itself.
+  UInt8 decision = chord.numNotes == 0        ? kTraceDecisionUnmapped
+                   : inNote.status == kNoteOn ? kTraceDecisionChord
+                                              : kTraceDecisionRelease;
+  int numSent = 0;
+  if (inNote.status == kNoteOn) {
+    if (chord.numNotes == 0) {
+      if (owners.Acquire(trigger, trigger)) {
+        mNoteOnDelay[channel][trigger] = 0;
+        EmitNote(inNote, trigger, inNote.velocity, inStartFrame, 0);
+        numSent++;
+      }
+    }
+    // the voiced chord has its own ranks, so strum order and per-voice
+    // velocity go by the notes actually played
+    ChordMapEntry voiced;
+    const ChordMapEntry *played = &chord;
+    if (settings.voiceLeading && chord.numNotes > 0) {
+      mVoiceLeaders[channel].Lead(chord, voiced);
+      played = &voiced;
+    }
+    for (int j = 0; j < played->numNotes; j++) {
+      UInt8 note = played->notes[j];
+      if (!owners.Acquire(trigger, note)) continue;
+      numSent++;
+      UInt16 velocity = map.Velocity(*played, j, inNote.velocity);
+      UInt32 delay = 0;
+      if (strumTable.IsActive()) {
+        velocity = strumTable.Velocity(*played, j, velocity);
+        delay = strumTable.Offset(*played, j);
+      }
+      mNoteOnDelay[channel][note] = delay;
+      EmitNote(inNote, note, velocity, inStartFrame, delay);
+    }
+  } else if (owners.IsHeld(trigger)) {
+    UInt8 releasedNotes[NoteOwnership::kNoteCount];
+    int numReleased = owners.ReleaseAll(trigger, releasedNotes);
+    numSent = numReleased;
+    for (int j = 0; j < numReleased; j++) {
+      // strummed notes are released with the offset they went on with, so
+      // a note-off can never overtake its pending note-on, whatever the
+      // voicing, the map or the strum settings are by now
+      UInt8 note = releasedNotes[j];
+      EmitNote(inNote, note, inNote.velocity, inStartFrame,
+               mNoteOnDelay[channel][note]);
+    }
+  } else if (chord.numNotes == 0 && !owners.IsSounding(trigger)) {
+    // a note we never saw go on, e.g. held across a map change
+    EmitNote(inNote, trigger, inNote.velocity, inStartFrame, 0);
+    numSent = 1;
+  }
+
+  if (mTrace.IsEnabled()) {
+    UInt32 word0, word1 = 0;
+    if (inNote.midi2) {
+      word0 = UMPMakeMIDI2Word0(inNote.group, inNote.status, inNote.channel,
+                                trigger, inNote.attributeType);
+      word1 = ((UInt32)inNote.velocity << 16) | inNote.attribute;
+    } else {
+      word0 = UMPMakeMIDI1(inNote.group, inNote.status, inNote.channel,
+                           trigger, UMPDownscaleVelocity(inNote.velocity));
+    }
+    TraceMessage(decision, numSent, inStartFrame, word0, word1);
+  }
+
+  mHeldNotes[channel].Set(trigger, inNote.status == kNoteOn);
+  if (settings.recognitionOutput != kChordRecognitionOff)
+    EmitRecognizedChord(settings, inNote.group, channel, inStartFrame);
+}
+
+void ChordEngine::EmitRecognizedChord(const Settings &inSettings, UInt8 group,
+                                      UInt8 channel, UInt32 inStartFrame) {
+  UInt32 pitchClasses = mHeldNotes[channel].PitchClasses();
+  UInt8 chord = mChordRecognizer.Recognize(pitchClasses);
+  if (chord == ChordRecognizer::kNoChord) {
+    // only forgotten once everything is released, so lifting one finger off
+    // a chord and putting it back doesn't resend it
+    if (pitchClasses == 0) mRecognizedChord[channel] = chord;
+    return;
+  }
+  if (chord == mRecognizedChord[channel]) return;
+  mRecognizedChord[channel] = chord;
+
+  UInt8 root = ChordRecognizer::Root(chord);
+  UInt8 quality = ChordRecognizer::Quality(chord);
+  if (inSettings.recognitionOutput == kChordRecognitionCC) {
+    UInt8 controller = inSettings.recognitionController;
+    mOutput.AddUMPEvent(
+        UMPMakeMIDI1(group, kControlChange, channel, controller, root), 0,
+        inStartFrame);
+    mOutput.AddUMPEvent(
+        UMPMakeMIDI1(group, kControlChange, channel, controller + 1, quality),
+        0, inStartFrame);
+  } else {
+    mOutput.AddUMPEvent(UMPMakeMIDI1(group, kProgramChange, channel,
+                                     quality * 12 + root, 0),
+                        0, inStartFrame);
+  }
+}
+
+// Notes go out in the protocol they came in with. Events due in the same
+// render slice go straight to the output helper; anything later waits in the
+// scheduler, keyed on the engine's own sample timeline. That timeline only
+// advances with rendered frames, so pending events keep their spacing when
+// the host's sample time jumps (loops, relocations). A note never goes out
+// ahead of a pending event for the same note, e.g. when a note is played
+// again before its strummed note-off is due.
+void ChordEngine::EmitNote(const NoteMessage &inNote, UInt8 note,
+                           UInt16 velocity, UInt32 inStartFrame,
+                           UInt32 inDelayFrames) {
+  UInt32 word0, word1 = 0;
+  if (inNote.midi2) {
+    word0 = UMPMakeMIDI2Word0(inNote.group, inNote.status, inNote.channel, note,
+                              inNote.attributeType);
+    word1 = ((UInt32)velocity << 16) | inNote.attribute;
+  } else {
+    word0 = UMPMakeMIDI1(inNote.group, inNote.status, inNote.channel, note,
+                         UMPDownscaleVelocity(velocity));
+  }
+
+  SInt64 sampleTime = mRenderSampleTime + inStartFrame + inDelayFrames;
+  SInt64 &lastSampleTime = mNoteSampleTime[inNote.channel][note];
+  if (inDelayFrames == 0 && sampleTime > lastSampleTime) {
+    mOutput.AddUMPEvent(word0, word1, inStartFrame);
+  } else {
+    // the scheduler keeps events due at the same time in order
+    if (sampleTime < lastSampleTime) sampleTime = lastSampleTime;
+    mScheduler.Schedule(sampleTime, word0, word1);
+  }
+  lastSampleTime = sampleTime;
+}
+
+UInt32 ChordEngine::Render(const AudioTimeStamp &inTimeStamp,
+                           UInt32 inNumberFrames) {
+  mScheduler.Dispatch(mRenderSampleTime, inNumberFrames, mOutput);
+  UInt32 numEvents = mOutput.NumEvents();
+  mOutput.FireAtTimeStamp(inTimeStamp);
+  mTrace.Record(kTraceEventRender, kTraceDecisionThru,
+                numEvents > 0xFFFF ? 0xFFFF : numEvents, mRenderSampleTime,
+                inNumberFrames, 0);
+  mRenderSampleTime += inNumberFrames;
+  UnpinSnapshots();
+  return numEvents;
+}
@@ -0,0 +1,290 @@
+//
+//  ChordEngine.h
+//  ChordTrigger
+//
+//  The MIDI side of ChordTrigger: chord maps, note ownership, strumming and
+//  the output queue. It has no AUBase dependency so it can also be driven
+//  outside a host (see Benchmark/).
+//
+
+#ifndef __ChordEngine__
+#define __ChordEngine__
+
+#include <pthread.h>
+#include "ChordMap.h"
+#include "ChordMapSnapshot.h"
+#include "ChordRecognizer.h"
+#include "NoteOwnership.h"
+#include "MIDIEventBatch.h"
+#include "MIDIOutputCallbackHelper.h"
+#include "MIDIEventScheduler.h"
+#include "StrumTable.h"
+#include "TraceRing.h"
+#include "UniversalMIDIPacket.h"
+#include "VoiceLeading.h"
+
+class ChordEngine {
+ public:
+  enum { kChannelCount = 16 };
+
+  enum {
+    kChordRecognitionOff = 0,
+    kChordRecognitionCC = 1,             // root on CC n, quality on CC n + 1
+    kChordRecognitionProgramChange = 2,  // program = quality * 12 + root
+    kDefaultRecognitionController = 20
+  };
+
+  ChordEngine();
+  ~ChordEngine();
+
+  // Drops held notes and pending events and restarts the sample timeline.
+  // Not real-time safe.
+  void Reset();
+
+  // The maps and settings below are the editing copies. Map edits reach the
+  // render thread only through PublishChordMaps(); every settings change
+  // publishes a new copy of the settings right away. Edits and their
+  // publishing can come from more than one thread, so they are made holding
+  // an EditLocker. Never taken on the render thread.
+  class EditLocker {
+   public:
+    explicit EditLocker(ChordEngine &engine) : mMutex(engine.mEditMutex) {
+      pthread_mutex_lock(&mMutex);
+    }
+    ~EditLocker() { pthread_mutex_unlock(&mMutex); }
+
+   private:
+    EditLocker(const EditLocker &);
+    EditLocker &operator=(const EditLocker &);
+
+    pthread_mutex_t &mMutex;
+  };
+
+  ChordMap &SharedChordMap() { return mChordMap; }
+
+  // NULL when the channel uses the shared map.
+  ChordMap *ChannelChordMap(UInt8 inChannel) {
+    return mChannelChordMaps[inChannel];
+  }
+
+  // Returns the channel's own map, creating it as a copy of the shared map
+  // if needed.
+  ChordMap *CreateChannelChordMap(UInt8 inChannel);
+
+  // Replaces the channel's map with a packed chord map, or drops it when
+  // |inData| is NULL. Returns false and leaves the map as it was if the
+  // data is malformed.
+  bool SetChannelChordMap(UInt8 inChannel, const UInt8 *inData, UInt32 inSize);
+
+  // Takes over the caller's reference to |inBank|, which may be NULL to
+  // drop the bank. Program Change messages select bank programs while a
+  // bank is loaded and pass through otherwise.
+  void SetChordMapBank(ChordMapBank *inBank);
+  const ChordMapBank *Bank() const { return mBank; }
+
+  // Saves and restores every editing copy and the bank as one image for the
+  // plug-in state:
+  //
+  //   'C' 'T' 'S' 'T'  version (1)  0  numSections (UInt16, big endian)
+  //   checksum (UInt32, big endian; Adler-32 of the sections)
+  //   numSections x { id  size (UInt32, big endian)  data }
+  //
+  // id 0 is the shared map and 1-16 the map of that channel, as written by
+  // ChordMap::Save(); id 0x80 is a ChordMapBank::Save() image. Channels
+  // using the shared map and a missing bank have no section.
+  //
+  // |outData| must hold kChordMapStateMaxDataSize bytes. Restore checks the
+  // whole image before decoding it straight into the editing copies, and
+  // leaves everything untouched if it is malformed or of a newer version.
+  // Neither publishes.
+  enum {
+    kChordMapStateVersion = 1,
+    kChordMapStateHeaderSize = 12,
+    kChordMapStateSectionHeaderSize = 5,
+    kChordMapStateMaxDataSize =
+        kChordMapStateHeaderSize +
+        (1 + kChannelCount) *
+            (kChordMapStateSectionHeaderSize + kChordMapMaxDataSize) +
+        kChordMapStateSectionHeaderSize + kChordMapBankMaxDataSize
+  };
+  UInt32 SaveChordMaps(UInt8 *outData) const;
+  bool RestoreChordMaps(const UInt8 *inData, UInt32 inSize);
+
+  // Compiles the editing copies into a new snapshot and swaps it in. Not
+  // real-time safe.
+  void PublishChordMaps();
+
+  // -1 listens on all channels.
+  void SetChannel(int inChannel) {
+    mSettings.channel = inChannel;
+    PublishSettings();
+  }
+  int Channel() const { return mSettings.channel; }
+
+  void SetStrum(Float64 inSampleRate, Float32 inStrumTimeMs, int inDirection,
+                Float32 inVelocityTilt) {
+    mSettings.strumTable.Compute(inSampleRate, inStrumTimeMs, inDirection,
+                                 inVelocityTilt);
+    PublishSettings();
+  }
+
+  // Plays every chord in the inversion and octave closest to the chord
+  // played before it on the same channel (see VoiceLeader). Thru notes are
+  // left alone.
+  void SetVoiceLeading(bool inVoiceLeading) {
+    mSettings.voiceLeading = inVoiceLeading;
+    PublishSettings();
+  }
+
+  // Reports the chord held on a listened channel whenever it changes to
+  // another recognised chord, on the same channel and at the frame of the
+  // note event that completed it.
+  void SetChordRecognition(int inOutput, UInt8 inController) {
+    mSettings.recognitionOutput = inOutput;
+    mSettings.recognitionController = inController > 126 ? 126 : inController;
+    PublishSettings();
+  }
+
+  MIDIOutputCallbackHelper &Output() { return mOutput; }
+  // Recording is off until enabled; the caller drains the ring.
+  TraceRing &Trace() { return mTrace; }
+  const MIDIEventScheduler &Scheduler() const { return mScheduler; }
+
+  void HandleMIDIEvent(UInt8 status, UInt8 channel, UInt8 data1, UInt8 data2,
+                       UInt32 inStartFrame) {
+    HandleMIDI1Event(0, status, channel, data1, data2, inStartFrame);
+  }
+
+  // Runs a decoded batch through the chord transform in one loop, without
+  // a call per message from the caller. System messages (clock, start/stop,
+  // song position, ...) go straight to the output. Returns the number of
+  // messages in the batch.
+  UInt32 HandleMIDIEventBatch(const MIDIEventBatch &inBatch);
+
+  // Universal MIDI Packets. MIDI 2.0 notes keep their 16-bit velocity and
+  // attribute through the chord transform and go out as MIDI 2.0; MIDI 1.0
+  // channel voice messages behave as with HandleMIDIEvent, and system
+  // messages go straight to the output. Other message types are ignored, as
+  // is a message cut off by |inNumWords|. Returns the
+  // number of messages read.
+  UInt32 HandleUMPEvents(const UInt32 *inWords, UInt32 inNumWords,
+                       UInt32 inStartFrame);
+
+  // Sends everything due in this slice and advances the sample timeline.
+  // Returns the number of events sent.
+  UInt32 Render(const AudioTimeStamp &inTimeStamp, UInt32 inNumberFrames);
+
+ private:
+  // Everything besides the maps that the render thread reads, published
+  // the same way.
+  class Settings {
+   public:
+    Settings()
+        : channel(0),
+          voiceLeading(false),
+          recognitionOutput(kChordRecognitionOff),
+          recognitionController(kDefaultRecognitionController),
+          mNext(NULL),
+          mRetiredEpoch(0) {}
+
+    int channel;  // -1 -> omni
+    StrumTable strumTable;
+    bool voiceLeading;
+    int recognitionOutput;
+    UInt8 recognitionController;
+
+   private:
+    template <class SNAPSHOT>
+    friend class CASnapshotPublisher;
+
+    Settings *mNext;
+    UInt32 mRetiredEpoch;
+  };
+
+  void PublishSettings() {
+    mSettingsPublisher.Publish(new Settings(mSettings));
+  }
+
+  // Pinned from the first event of a render slice to the end of Render, so
+  // a whole slice sees one version of the maps and settings.
+  const ChordMapSnapshot &PinnedChordMaps() {
+    if (mPinnedChordMaps == NULL) mPinnedChordMaps = mChordMapPublisher.Pin();
+    return *mPinnedChordMaps;
+  }
+
+  const Settings &PinnedSettings() {
+    if (mPinnedSettings == NULL) mPinnedSettings = mSettingsPublisher.Pin();
+    return *mPinnedSettings;
+  }
+
+  void UnpinSnapshots() {
+    if (mPinnedChordMaps != NULL) {
+      mChordMapPublisher.Unpin();
+      mPinnedChordMaps = NULL;
+    }
+    if (mPinnedSettings != NULL) {
+      mSettingsPublisher.Unpin();
+      mPinnedSettings = NULL;
+    }
+  }
+
+  // A note on/off on its way through the chord transform. The velocity is
+  // 16 bit either way; MIDI 1.0 notes are scaled up on the way in and back
+  // down on the way out.
+  struct NoteMessage {
+    bool midi2;
+    UInt8 group;
+    UInt8 status;
+    UInt8 channel;
+    UInt8 note;
+    UInt16 velocity;
+    UInt8 attributeType;
+    UInt16 attribute;
+  };
+
+  void HandleMIDI1Event(UInt8 group, UInt8 status, UInt8 channel, UInt8 data1,
+                        UInt8 data2, UInt32 inStartFrame);
+  void HandleMIDI2Event(UInt32 word0, UInt32 word1, UInt32 inStartFrame);
+  void HandleSystemMessage(UInt32 word0, UInt32 inStartFrame) {
+    mOutput.AddUMPEvent(word0, 0, inStartFrame);
+    TraceMessage(kTraceDecisionThru, 0, inStartFrame, word0, 0);
+  }
+  void HandleNote(const NoteMessage &inNote, UInt32 inStartFrame);
+  void EmitNote(const NoteMessage &inNote, UInt8 note, UInt16 velocity,
+                UInt32 inStartFrame, UInt32 inDelayFrames);
+  void ClearNoteSampleTimes();
+  void EmitRecognizedChord(const Settings &inSettings, UInt8 group,
+                           UInt8 channel, UInt32 inStartFrame);
+
+  void TraceMessage(UInt8 decision, int count, UInt32 inStartFrame,
+                    UInt32 word0, UInt32 word1) {
+    mTrace.Record(kTraceEventMIDI, decision, (UInt16)count,
+                  mRenderSampleTime + inStartFrame, word0, word1);
+  }
+
+  MIDIOutputCallbackHelper mOutput;
+  MIDIEventScheduler mScheduler;
+  TraceRing mTrace;
+  SInt64 mRenderSampleTime;  // start of the upcoming render slice
+  ChordMap mChordMap;        // shared by all channels
+  ChordMap *mChannelChordMaps[kChannelCount];  // NULL -> use mChordMap
+  ChordMapBank *mBank;
+  ChordMapPublisher mChordMapPublisher;
+  Settings mSettings;
+  CASnapshotPublisher<Settings> mSettingsPublisher;
+  pthread_mutex_t mEditMutex;
+  const ChordMapSnapshot *mPinnedChordMaps;    // render thread only
+  const Settings *mPinnedSettings;             // render thread only
+  SInt16 mProgram[kChannelCount];              // -1 -> no program selected
+  NoteOwnership noteFlag[kChannelCount];
+  // frames each sounding output note's note-on was delayed by
+  UInt32 mNoteOnDelay[kChannelCount][NoteOwnership::kNoteCount];
+  // when the last event for each output note is due, -1 -> none yet
+  SInt64 mNoteSampleTime[kChannelCount][NoteOwnership::kNoteCount];
+  VoiceLeader mVoiceLeaders[kChannelCount];
+  HeldNoteSet mHeldNotes[kChannelCount];  // trigger notes as played
+  UInt8 mRecognizedChord[kChannelCount];  // last reported, or kNoChord
+  ChordRecognizer mChordRecognizer;
+};
+
+#endif /* defined(__ChordEngine__) */
@@ -0,0 +1,258 @@
+//
+//  ChordMap.h
+//  ChordTrigger
+//
+//  Dense trigger note -> chord lookup table. Every one of the 128 notes can
+//  trigger a chord of up to kChordMapMaxChordNotes output notes. The table is
+//  both the editable store and the render-thread lookup structure, so the
+//  render thread only ever does a single indexed load per incoming note.
+//
+//  A map also carries a velocity voicing: a curve shape for the whole map
+//  and a scale and offset per voice, where voices count chord members by
+//  pitch from the top (voice 0 is the highest note of every chord). They are
+//  baked into one VelocityTable per voice on every edit.
+//
+
+#ifndef __ChordMap__
+#define __ChordMap__
+
+#include <CoreMIDI/CoreMIDI.h>
+#include <string.h>
+#include "VelocityCurve.h"
+
+enum {
+  kChordMapNoteCount = 128,
+  kChordMapMaxChordNotes = 16,
+  // serialized form: [trigger][numNotes][notes...] for every mapped trigger,
+  // then, unless the voicing is the default, [0xFF][curve] and
+  // [scale][offset] for every voice
+  kChordMapVelocityMarker = 0xFF,
+  kChordMapVelocityDataSize = 2 + 2 * kChordMapMaxChordNotes,
+  kChordMapMaxDataSize = kChordMapNoteCount * (2 + kChordMapMaxChordNotes) +
+                         kChordMapVelocityDataSize
+};
+
+// Output notes are packed at the front of |notes|. Note 0 is reserved as the
+// "unused" marker, so a trigger with numNotes == 0 passes through unchanged.
+// ranks[i] is the pitch rank of notes[i] within the chord (lowest = 0), kept
+// up to date on every edit for the strum tables.
+typedef struct ChordMapEntry {
+  UInt8 numNotes;
+  UInt8 notes[kChordMapMaxChordNotes];
+  UInt8 ranks[kChordMapMaxChordNotes];
+} ChordMapEntry;
+
+class ChordMap {
+ public:
+  // The velocity tables start out linear, so there is nothing to compute.
+  ChordMap() {
+    memset(mEntries, 0, sizeof(mEntries));
+    ResetVelocity();
+  }
+
+  void Clear() {
+    memset(mEntries, 0, sizeof(mEntries));
+    if (HasDefaultVelocity()) return;
+    ResetVelocity();
+    UpdateVelocityTables();
+  }
+
+  // Replaces the chord for |trigger|. Zero notes are dropped.
+  void SetChord(UInt8 trigger, const UInt8 *notes, int numNotes) {
+    ChordMapEntry &entry = mEntries[trigger & 0x7F];
+    entry.numNotes = 0;
+    for (int i = 0; i < numNotes && entry.numNotes < kChordMapMaxChordNotes;
+         i++) {
+      if (notes[i] != 0) entry.notes[entry.numNotes++] = notes[i] & 0x7F;
+    }
+    UpdateRanks(entry);
+  }
+
+  UInt8 GetChordNote(UInt8 trigger, int index) const {
+    const ChordMapEntry &entry = mEntries[trigger & 0x7F];
+    return (index >= 0 && index < entry.numNotes) ? entry.notes[index] : 0;
+  }
+
+  // Edits a single chord member. Writing 0 removes the note and closes the
+  // gap, writing past the end appends.
+  void SetChordNote(UInt8 trigger, int index, UInt8 note) {
+    ChordMapEntry &entry = mEntries[trigger & 0x7F];
+    if (index < 0 || index >= kChordMapMaxChordNotes) return;
+
+    if (note == 0) {
+      if (index >= entry.numNotes) return;
+      memmove(&entry.notes[index], &entry.notes[index + 1],
+              entry.numNotes - index - 1);
+      entry.numNotes--;
+    } else if (index < entry.numNotes) {
+      entry.notes[index] = note & 0x7F;
+    } else {
+      entry.notes[entry.numNotes++] = note & 0x7F;
+    }
+    UpdateRanks(entry);
+  }
+
+  const ChordMapEntry &Lookup(UInt8 note) const {
+    return mEntries[note & 0x7F];
+  }
+
+  int VelocityCurve() const { return mVelocityCurve; }
+  int VoiceVelocityScale(int voice) const { return mVoiceScale[voice]; }
+  int VoiceVelocityOffset(int voice) const { return mVoiceOffset[voice]; }
+
+  // |curve| is one of the kVelocityCurve constants.
+  void SetVelocityCurve(int curve) {
+    if (curve < 0 || curve >= kVelocityCurveCount) return;
+    mVelocityCurve = (UInt8)curve;
+    UpdateVelocityTables();
+  }
+
+  // |scalePercent| is clamped to 0..200 and |offset| to -127..127.
+  void SetVoiceVelocity(int voice, int scalePercent, int offset) {
+    if (voice < 0 || voice >= kChordMapMaxChordNotes) return;
+    mVoiceScale[voice] =
+        (UInt8)(scalePercent < 0 ? 0 : (scalePercent > 200 ? 200 : scalePercent));
+    mVoiceOffset[voice] =
+        (SInt8)(offset < -127 ? -127 : (offset > 127 ? 127 : offset));
+    UpdateVelocityTables();
+  }
+
+  // Note-on velocity (16 bit) of chord.notes[index].
+  UInt16 Velocity(const ChordMapEntry &chord, int index,
+                  UInt16 velocity) const {
+    return mVoiceTables[chord.numNotes - 1 - chord.ranks[index]].Apply(
+        velocity);
+  }
+
+  // Recomputes entry.ranks after entry.notes changed.
+  static void UpdateRanks(ChordMapEntry &entry) {
+    for (int i = 0; i < entry.numNotes; i++) {
+      UInt8 rank = 0;
+      for (int j = 0; j < entry.numNotes; j++) {
+        if (entry.notes[j] < entry.notes[i] ||
+            (entry.notes[j] == entry.notes[i] && j < i))
+          rank++;
+      }
+      entry.ranks[i] = rank;
+    }
+  }
+
+  // Writes the packed form of the map into |outData|, which must hold at
+  // least kChordMapMaxDataSize bytes. Returns the number of bytes written.
+  UInt32 Save(UInt8 *outData) const {
+    UInt8 *p = outData;
+    for (int i = 0; i < kChordMapNoteCount; i++) {
+      const ChordMapEntry &entry = mEntries[i];
+      if (entry.numNotes == 0) continue;
+      *p++ = (UInt8)i;
+      *p++ = entry.numNotes;
+      memcpy(p, entry.notes, entry.numNotes);
+      p += entry.numNotes;
+    }
+    if (!HasDefaultVelocity()) {
+      *p++ = kChordMapVelocityMarker;
+      *p++ = mVelocityCurve;
+      for (int voice = 0; voice < kChordMapMaxChordNotes; voice++) {
+        *p++ = mVoiceScale[voice];
+        *p++ = (UInt8)mVoiceOffset[voice];
+      }
+    }
+    return (UInt32)(p - outData);
+  }
+
+  // True if |inData| is a well-formed packed form.
+  static bool IsValid(const UInt8 *inData, UInt32 inSize) {
+    const UInt8 *p = inData, *end = inData + inSize;
+    while (p < end) {
+      if (p[0] == kChordMapVelocityMarker) {
+        if (end - p != kChordMapVelocityDataSize || p[1] >= kVelocityCurveCount)
+          return false;
+        for (int voice = 0; voice < kChordMapMaxChordNotes; voice++) {
+          if (p[2 + 2 * voice] > 200 || (SInt8)p[3 + 2 * voice] < -127)
+            return false;
+        }
+        return true;
+      }
+      if (end - p < 2 || p[0] >= kChordMapNoteCount ||
+          p[1] > kChordMapMaxChordNotes || end - p - 2 < p[1])
+        return false;
+      p += 2 + p[1];
+    }
+    return true;
+  }
+
+  // Replaces the map with a packed form produced by Save(). The map is left
+  // untouched if the data is malformed. The data is decoded in place, and
+  // the velocity tables are only recomputed if the voicing changes.
+  bool Restore(const UInt8 *inData, UInt32 inSize) {
+    if (!IsValid(inData, inSize)) return false;
+
+    memset(mEntries, 0, sizeof(mEntries));
+    const UInt8 *p = inData, *end = inData + inSize;
+    while (p < end && p[0] != kChordMapVelocityMarker) {
+      SetChord(p[0], p + 2, p[1]);
+      p += 2 + p[1];
+    }
+
+    if (p == end) {
+      if (!HasDefaultVelocity()) {
+        ResetVelocity();
+        UpdateVelocityTables();
+      }
+      return true;
+    }
+    bool changed = mVelocityCurve != p[1];
+    mVelocityCurve = p[1];
+    for (int voice = 0; voice < kChordMapMaxChordNotes; voice++) {
+      UInt8 scale = p[2 + 2 * voice];
+      SInt8 offset = (SInt8)p[3 + 2 * voice];
+      changed |= mVoiceScale[voice] != scale || mVoiceOffset[voice] != offset;
+      mVoiceScale[voice] = scale;
+      mVoiceOffset[voice] = offset;
+    }
+    if (changed) UpdateVelocityTables();
+    return true;
+  }
+
+ private:
+  void ResetVelocity() {
+    mVelocityCurve = kVelocityCurveLinear;
+    for (int voice = 0; voice < kChordMapMaxChordNotes; voice++) {
+      mVoiceScale[voice] = VelocityTable::kDefaultScale;
+      mVoiceOffset[voice] = 0;
+    }
+  }
+
+  bool HasDefaultVelocity() const {
+    if (mVelocityCurve != kVelocityCurveLinear) return false;
+    for (int voice = 0; voice < kChordMapMaxChordNotes; voice++) {
+      if (mVoiceScale[voice] != VelocityTable::kDefaultScale ||
+          mVoiceOffset[voice] != 0)
+        return false;
+    }
+    return true;
+  }
+
+  // Voices usually share their scale and offset, so a table is copied from
+  // the voice before it when they match.
+  void UpdateVelocityTables() {
+    double shape[128];
+    VelocityTable::Shape(mVelocityCurve, shape);
+    for (int voice = 0; voice < kChordMapMaxChordNotes; voice++) {
+      if (voice > 0 && mVoiceScale[voice] == mVoiceScale[voice - 1] &&
+          mVoiceOffset[voice] == mVoiceOffset[voice - 1])
+        mVoiceTables[voice] = mVoiceTables[voice - 1];
+      else
+        mVoiceTables[voice].Compute(shape, mVoiceScale[voice],
+                                    mVoiceOffset[voice]);
+    }
+  }
+
+  ChordMapEntry mEntries[kChordMapNoteCount];
+  UInt8 mVelocityCurve;
+  UInt8 mVoiceScale[kChordMapMaxChordNotes];  // percent
+  SInt8 mVoiceOffset[kChordMapMaxChordNotes];
+  VelocityTable mVoiceTables[kChordMapMaxChordNotes];
+};
+
+#endif /* defined(__ChordMap__) */
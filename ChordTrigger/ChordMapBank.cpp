@@ -0,0 +1,75 @@
+//
+//  ChordMapBank.cpp
+//  ChordTrigger
+//
+
+#include "ChordMapBank.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const UInt8 kBankMagic[4] = {'C', 'T', 'B', 'K'};
+
+UInt32 ChordMapBank::Save(UInt8 *outData) const {
+  memcpy(outData, kBankMagic, sizeof(kBankMagic));
+  outData[4] = kChordMapBankVersion;
+  outData[5] = 0;
+  outData[6] = (UInt8)(mNumPrograms >> 8);
+  outData[7] = (UInt8)mNumPrograms;
+
+  UInt8 *sizes = outData + kChordMapBankHeaderSize;
+  UInt8 *p = sizes + 2 * mNumPrograms;
+  for (int i = 0; i < mNumPrograms; i++) {
+    UInt32 size = mPrograms[i].Save(p);
+    sizes[2 * i] = (UInt8)(size >> 8);
+    sizes[2 * i + 1] = (UInt8)size;
+    p += size;
+  }
+  return (UInt32)(p - outData);
+}
+
+bool ChordMapBank::Restore(const UInt8 *inData, UInt32 inSize) {
+  if (inSize < kChordMapBankHeaderSize ||
+      memcmp(inData, kBankMagic, sizeof(kBankMagic)) != 0 ||
+      inData[4] != kChordMapBankVersion)
+    return false;
+
+  int numPrograms = (inData[6] << 8) | inData[7];
+  const UInt8 *sizes = inData + kChordMapBankHeaderSize;
+  const UInt8 *p = sizes + 2 * numPrograms, *end = inData + inSize;
+  if (numPrograms > kChordMapBankMaxPrograms || p > end) return false;
+
+  ChordMap *programs = new ChordMap[numPrograms > 0 ? numPrograms : 1];
+  for (int i = 0; i < numPrograms; i++) {
+    UInt32 size = (sizes[2 * i] << 8) | sizes[2 * i + 1];
+    if ((UInt32)(end - p) < size || !programs[i].Restore(p, size)) {
+      delete[] programs;
+      return false;
+    }
+    p += size;
+  }
+
+  delete[] mPrograms;
+  mPrograms = programs;
+  mNumPrograms = numPrograms;
+  return true;
+}
+
+bool ChordMapBank::RestoreFromFile(const char *inPath) {
+  int fd = open(inPath, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat info;
+  bool restored = false;
+  if (fstat(fd, &info) == 0 && info.st_size > 0 &&
+      info.st_size <= kChordMapBankMaxDataSize) {
+    void *image = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image != MAP_FAILED) {
+      restored = Restore((const UInt8 *)image, (UInt32)info.st_size);
+      munmap(image, info.st_size);
+    }
+  }
+  close(fd);
+  return restored;
+}
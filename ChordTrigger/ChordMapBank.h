@@ -0,0 +1,67 @@
+//
+//  ChordMapBank.h
+//  ChordTrigger
+//
+//  A bank of up to 128 chord maps selected by MIDI Program Change. The bank
+//  is stored as a compact binary image,
+//
+//    'C' 'T' 'B' 'K'  version (1)  0  numPrograms (UInt16, big endian)
+//    numPrograms x size (UInt16, big endian)
+//    numPrograms x ChordMap::Save() data
+//
+//  and expanded into dense ChordMaps once when it is loaded, so a program
+//  switch on the render thread is an index into mPrograms.
+//
+//  Banks are shared by successive ChordMapSnapshots. Retain/Release are not
+//  atomic: they are only ever called from the editing side, which creates
+//  and frees the snapshots.
+//
+
+#ifndef __ChordMapBank__
+#define __ChordMapBank__
+
+#include "ChordMap.h"
+
+enum {
+  kChordMapBankMaxPrograms = 128,
+  kChordMapBankVersion = 1,
+  kChordMapBankHeaderSize = 8,
+  kChordMapBankMaxDataSize =
+      kChordMapBankHeaderSize +
+      kChordMapBankMaxPrograms * (2 + kChordMapMaxDataSize)
+};
+
+class ChordMapBank {
+ public:
+  ChordMapBank() : mPrograms(NULL), mNumPrograms(0), mRetainCount(1) {}
+
+  void Retain() { mRetainCount++; }
+  void Release() {
+    if (--mRetainCount == 0) delete this;
+  }
+
+  int NumPrograms() const { return mNumPrograms; }
+
+  // |program| must be below NumPrograms().
+  const ChordMap &Program(int program) const { return mPrograms[program]; }
+
+  // Writes the bank image into |outData|, which must hold at least
+  // kChordMapBankMaxDataSize bytes. Returns the number of bytes written.
+  UInt32 Save(UInt8 *outData) const;
+
+  // Replaces the bank with an image produced by Save(). The bank is left
+  // untouched if the image is malformed.
+  bool Restore(const UInt8 *inData, UInt32 inSize);
+
+  // Maps a bank image file into memory and restores from it.
+  bool RestoreFromFile(const char *inPath);
+
+ private:
+  ~ChordMapBank() { delete[] mPrograms; }
+
+  ChordMap *mPrograms;
+  int mNumPrograms;
+  UInt32 mRetainCount;
+};
+
+#endif /* defined(__ChordMapBank__) */
@@ -0,0 +1,75 @@
+//
+//  ChordMapSnapshot.h
+//  ChordTrigger
+//
+//  Hands chord maps edited on the host's UI/automation thread to the render
+//  thread. Every edit is compiled into a new immutable ChordMapSnapshot which
+//  is published with a single pointer swap, so the render thread never sees
+//  a half-edited map and never takes a lock.
+//
+//  See CASnapshotPublisher for how replaced snapshots are reclaimed.
+//
+
+#ifndef __ChordMapSnapshot__
+#define __ChordMapSnapshot__
+
+#include "CASnapshotPublisher.h"
+#include "ChordMap.h"
+#include "ChordMapBank.h"
+
+class ChordMapSnapshot {
+ public:
+  enum { kChannelCount = 16 };
+
+  // |channelMaps| entries may be NULL, in which case the channel uses
+  // |sharedMap|. |bank| may be NULL; it is retained, not copied.
+  ChordMapSnapshot(const ChordMap &sharedMap,
+                   const ChordMap *const *channelMaps, ChordMapBank *bank)
+      : mStorage(NULL), mBank(bank), mNext(NULL), mRetiredEpoch(0) {
+    if (mBank) mBank->Retain();
+
+    int numMaps = 1;
+    for (int ch = 0; ch < kChannelCount; ch++)
+      if (channelMaps[ch]) numMaps++;
+
+    mStorage = new ChordMap[numMaps];
+    mStorage[0] = sharedMap;
+    for (int ch = 0, i = 1; ch < kChannelCount; ch++) {
+      if (channelMaps[ch]) {
+        mStorage[i] = *channelMaps[ch];
+        mMaps[ch] = &mStorage[i++];
+      } else {
+        mMaps[ch] = &mStorage[0];
+      }
+    }
+  }
+
+  ~ChordMapSnapshot() {
+    delete[] mStorage;
+    if (mBank) mBank->Release();
+  }
+
+  bool HasBank() const { return mBank != NULL; }
+
+  // |program| selects a bank program; a negative |program|, or one the bank
+  // doesn't have, selects the channel's own map.
+  const ChordMap &MapForChannel(UInt8 channel, int program) const {
+    if (program >= 0 && mBank && program < mBank->NumPrograms())
+      return mBank->Program(program);
+    return *mMaps[channel & 0x0F];
+  }
+
+ private:
+  template <class SNAPSHOT>
+  friend class CASnapshotPublisher;
+
+  ChordMap *mStorage;
+  const ChordMap *mMaps[kChannelCount];
+  ChordMapBank *mBank;
+  ChordMapSnapshot *mNext;  // retired list, newest first
+  UInt32 mRetiredEpoch;
+};
+
+typedef CASnapshotPublisher<ChordMapSnapshot> ChordMapPublisher;
+
+#endif /* defined(__ChordMapSnapshot__) */
@@ -0,0 +1,134 @@
+//
+//  ChordMapSysEx.h
+//  ChordTrigger
+//
+//  SysEx format for loading a whole chord map or bank in one message:
+//
+//    F0 7D 43 54 command target payload... checksum F7
+//
+//  7D is the non-commercial manufacturer ID, 43 54 is "CT". Commands:
+//
+//    01  chord map    payload: ChordMap::Save() data; target 0 is the
+//                     shared map, 1-16 the map of that channel
+//    02  bank         payload: ChordMapBank::Save() image, empty to remove
+//                     the bank; target 0
+//    03  map dump     no payload; answered with a 01 message for the target,
+//                     the shared map for a channel without its own
+//    04  bank dump    no payload; answered with a 02 message
+//
+//  The payload is 8-bit data packed 7 bytes to 8: a byte holding the top
+//  bits (bit 6 for the first byte of the group, bit 0 for the seventh), then
+//  the low 7 bits of each byte. The last group may be shorter. The checksum
+//  makes the low 7 bits of the sum of command, target, packed payload and
+//  checksum zero.
+//
+
+#ifndef __ChordMapSysEx__
+#define __ChordMapSysEx__
+
+#include <CoreMIDI/CoreMIDI.h>
+#include <string.h>
+
+enum {
+  kChordMapSysExManufacturer = 0x7D,
+  kChordMapSysExCommandMap = 0x01,
+  kChordMapSysExCommandBank = 0x02,
+  kChordMapSysExCommandMapDump = 0x03,
+  kChordMapSysExCommandBankDump = 0x04,
+  kChordMapSysExMaxTarget = 16,
+  kChordMapSysExHeaderSize = 6,
+  kChordMapSysExOverhead = kChordMapSysExHeaderSize + 2  // checksum, F7
+};
+
+static const UInt8 kChordMapSysExHeader[4] = {0xF0, kChordMapSysExManufacturer,
+                                              'C', 'T'};
+
+typedef struct ChordMapSysExMessage {
+  UInt8 command;
+  UInt8 target;
+  UInt32 size;  // of the unpacked payload
+} ChordMapSysExMessage;
+
+inline UInt32 ChordMapSysExPackedSize(UInt32 inSize) {
+  return inSize + (inSize + 6) / 7;
+}
+
+// True if the message carries our header; it may still be malformed.
+inline bool ChordMapSysExMatches(const UInt8 *inData, UInt32 inLength) {
+  return inLength >= kChordMapSysExOverhead &&
+         memcmp(inData, kChordMapSysExHeader, sizeof(kChordMapSysExHeader)) ==
+             0;
+}
+
+// Writes a complete message into |outData|, which must hold
+// ChordMapSysExPackedSize(inSize) + kChordMapSysExOverhead bytes. Returns
+// the number of bytes written.
+inline UInt32 ChordMapSysExEncode(UInt8 inCommand, UInt8 inTarget,
+                                  const UInt8 *inPayload, UInt32 inSize,
+                                  UInt8 *outData) {
+  memcpy(outData, kChordMapSysExHeader, sizeof(kChordMapSysExHeader));
+  outData[4] = inCommand;
+  outData[5] = inTarget;
+  UInt32 sum = inCommand + inTarget;
+
+  UInt8 *p = outData + kChordMapSysExHeaderSize;
+  for (UInt32 i = 0; i < inSize; i += 7) {
+    UInt32 count = inSize - i < 7 ? inSize - i : 7;
+    UInt8 *topBits = p++;
+    *topBits = 0;
+    for (UInt32 j = 0; j < count; j++) {
+      UInt8 byte = inPayload[i + j];
+      *topBits |= (byte >> 7) << (6 - j);
+      *p = byte & 0x7F;
+      sum += *p++;
+    }
+    sum += *topBits;
+  }
+  *p++ = (UInt8)(-sum & 0x7F);
+  *p++ = 0xF7;
+  return (UInt32)(p - outData);
+}
+
+// Validates a complete message and unpacks its payload into |outPayload|,
+// which must hold |inLength| bytes. Returns false for anything that isn't a
+// well-formed message of a known command.
+inline bool ChordMapSysExDecode(const UInt8 *inData, UInt32 inLength,
+                                ChordMapSysExMessage &outMessage,
+                                UInt8 *outPayload) {
+  if (!ChordMapSysExMatches(inData, inLength) || inData[inLength - 1] != 0xF7)
+    return false;
+
+  UInt8 command = inData[4], target = inData[5];
+  UInt32 packedSize = inLength - kChordMapSysExOverhead;
+  bool isMap = command == kChordMapSysExCommandMap ||
+               command == kChordMapSysExCommandMapDump;
+  bool isBank = command == kChordMapSysExCommandBank ||
+                command == kChordMapSysExCommandBankDump;
+  bool isDump = command == kChordMapSysExCommandMapDump ||
+                command == kChordMapSysExCommandBankDump;
+  if (!(isMap && target <= kChordMapSysExMaxTarget) && !(isBank && target == 0))
+    return false;
+  if ((isDump && packedSize > 0) || packedSize % 8 == 1) return false;
+
+  const UInt8 *packed = inData + kChordMapSysExHeaderSize;
+  UInt32 sum = command + target + packed[packedSize];
+  for (UInt32 i = 0; i <= packedSize; i++) {
+    if (packed[i] & 0x80) return false;
+    if (i < packedSize) sum += packed[i];
+  }
+  if (sum & 0x7F) return false;
+
+  UInt8 *p = outPayload;
+  for (UInt32 i = 0; i < packedSize; i += 8) {
+    UInt8 topBits = packed[i];
+    UInt32 count = packedSize - i - 1 < 7 ? packedSize - i - 1 : 7;
+    for (UInt32 j = 0; j < count; j++)
+      *p++ = packed[i + 1 + j] | (((topBits >> (6 - j)) & 1) << 7);
+  }
+  outMessage.command = command;
+  outMessage.target = target;
+  outMessage.size = (UInt32)(p - outPayload);
+  return true;
+}
+
+#endif /* defined(__ChordMapSysEx__) */
@@ -0,0 +1,155 @@
+//
+//  ChordMapSysExLoader.cpp
+//  ChordTrigger
+//
+
+#include "ChordMapSysExLoader.h"
+
+ChordMapSysExLoader::ChordMapSysExLoader(ChordEngine &engine,
+                                         LoadedCallback callback,
+                                         void *userData)
+    : mEngine(engine),
+      mLoadedCallback(callback),
+      mUserData(userData),
+      mRunning(false),
+      mStop(0),
+      mRequest(new UInt8[kMaxMessageLength]),
+      mRequestLength(0),
+      mRequestState(kSlotEmpty),
+      mPayload(new UInt8[kMaxMessageLength]),
+      mReply(NULL),
+      mReplyLength(0),
+      mReplyState(kReplyNone) {}
+
+ChordMapSysExLoader::~ChordMapSysExLoader() {
+  Stop();
+  delete[] mRequest;
+  delete[] mPayload;
+  delete[] mReply;
+}
+
+bool ChordMapSysExLoader::Start() {
+  if (mRunning) return true;
+  mStop = 0;
+  mRunning = pthread_create(&mThread, NULL, Run, this) == 0;
+  return mRunning;
+}
+
+void ChordMapSysExLoader::Stop() {
+  if (!mRunning) return;
+  CAAtomicIncrement32Barrier(&mStop);
+  mWake.Signal();
+  pthread_join(mThread, NULL);
+  mRunning = false;
+}
+
+bool ChordMapSysExLoader::Submit(const UInt8 *inData, UInt32 inLength) {
+  if (inLength > kMaxMessageLength ||
+      CAAtomicAdd32Barrier(0, &mRequestState) != kSlotEmpty)
+    return false;
+  memcpy(mRequest, inData, inLength);
+  mRequestLength = inLength;
+  CAAtomicCompareAndSwap32Barrier(kSlotEmpty, kSlotFull, &mRequestState);
+  mWake.Signal();
+  return true;
+}
+
+void ChordMapSysExLoader::SendReply(MIDIOutputCallbackHelper &output,
+                                    const AudioTimeStamp &inTimeStamp) {
+  if (CAAtomicAdd32Barrier(0, &mReplyState) != kReplyReady) return;
+  output.FireSysEx(inTimeStamp, mReply, mReplyLength);
+  CAAtomicCompareAndSwap32Barrier(kReplyReady, kReplySent, &mReplyState);
+  mWake.Signal();
+}
+
+void *ChordMapSysExLoader::Run(void *loader) {
+  ChordMapSysExLoader *self = (ChordMapSysExLoader *)loader;
+  for (;;) {
+    self->mWake.Wait();
+    if (CAAtomicAdd32Barrier(0, &self->mStop) != 0) break;
+    self->Process();
+  }
+  return NULL;
+}
+
+void ChordMapSysExLoader::Process() {
+  if (CAAtomicAdd32Barrier(0, &mReplyState) == kReplySent) {
+    delete[] mReply;
+    mReply = NULL;
+    CAAtomicCompareAndSwap32Barrier(kReplySent, kReplyNone, &mReplyState);
+  }
+  if (CAAtomicAdd32Barrier(0, &mRequestState) != kSlotFull) return;
+
+  ChordMapSysExMessage message;
+  bool valid =
+      ChordMapSysExDecode(mRequest, mRequestLength, message, mPayload);
+  CAAtomicCompareAndSwap32Barrier(kSlotFull, kSlotEmpty, &mRequestState);
+  if (!valid) return;
+
+  if (message.command == kChordMapSysExCommandMapDump ||
+      message.command == kChordMapSysExCommandBankDump)
+    Dump(message);
+  else
+    Load(message, mPayload);
+}
+
+// The map or bank is compiled before taking the edit lock, so editing on
+// other threads waits only for it to be copied in and published.
+void ChordMapSysExLoader::Load(const ChordMapSysExMessage &inMessage,
+                               const UInt8 *inPayload) {
+  if (inMessage.command == kChordMapSysExCommandMap) {
+    ChordMap map;
+    if (!map.Restore(inPayload, inMessage.size)) return;
+
+    ChordEngine::EditLocker lock(mEngine);
+    if (inMessage.target == 0)
+      mEngine.SharedChordMap() = map;
+    else
+      *mEngine.CreateChannelChordMap(inMessage.target - 1) = map;
+    mEngine.PublishChordMaps();
+  } else {
+    ChordMapBank *bank = NULL;
+    if (inMessage.size > 0) {
+      bank = new ChordMapBank;
+      if (!bank->Restore(inPayload, inMessage.size)) {
+        bank->Release();
+        return;
+      }
+    }
+
+    ChordEngine::EditLocker lock(mEngine);
+    mEngine.SetChordMapBank(bank);
+    mEngine.PublishChordMaps();
+  }
+  if (mLoadedCallback) (*mLoadedCallback)(mUserData);
+}
+
+void ChordMapSysExLoader::Dump(const ChordMapSysExMessage &inMessage) {
+  if (CAAtomicAdd32Barrier(0, &mReplyState) != kReplyNone) return;
+
+  UInt8 *data;
+  UInt32 size = 0;
+  UInt8 command;
+  {
+    ChordEngine::EditLocker lock(mEngine);
+    if (inMessage.command == kChordMapSysExCommandMapDump) {
+      const ChordMap *map = NULL;
+      if (inMessage.target > 0)
+        map = mEngine.ChannelChordMap(inMessage.target - 1);
+      if (map == NULL) map = &mEngine.SharedChordMap();
+      data = new UInt8[kChordMapMaxDataSize];
+      size = map->Save(data);
+      command = kChordMapSysExCommandMap;
+    } else {
+      data = new UInt8[kChordMapBankMaxDataSize];
+      if (mEngine.Bank()) size = mEngine.Bank()->Save(data);
+      command = kChordMapSysExCommandBank;
+    }
+  }
+
+  mReply = new UInt8[ChordMapSysExPackedSize(size) + kChordMapSysExOverhead];
+  mReplyLength =
+      ChordMapSysExEncode(command, inMessage.target, data, size, mReply);
+  delete[] data;
+  CAAtomicCompareAndSwap32Barrier(kReplyNone, kReplyReady, &mReplyState);
+}
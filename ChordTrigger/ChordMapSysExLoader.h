@@ -0,0 +1,85 @@
+//
+//  ChordMapSysExLoader.h
+//  ChordTrigger
+//
+//  Loads chord maps and banks sent as SysEx (see ChordMapSysEx.h) and
+//  answers dump requests, off the render thread. The MIDI thread only copies
+//  the message into a preallocated slot; a background thread validates and
+//  compiles it into a ChordMap or ChordMapBank, then takes the engine's edit
+//  lock just to install it and publish a new snapshot. Dump replies are
+//  encoded on the background thread and sent from the next Render. The
+//  background thread sleeps on a semaphore that Submit and SendReply signal,
+//  so an idle loader costs nothing.
+//
+//  One message is handled at a time. A message arriving while the previous
+//  one is still waiting, or a dump request while the previous reply is
+//  still unsent, is dropped.
+//
+
+#ifndef __ChordMapSysExLoader__
+#define __ChordMapSysExLoader__
+
+#include <pthread.h>
+#include "CASemaphore.h"
+#include "ChordEngine.h"
+#include "ChordMapBank.h"
+#include "ChordMapSysEx.h"
+
+class ChordMapSysExLoader {
+ public:
+  // The longest message: a full bank. The unit has AUMIDIBase assemble SysEx
+  // this long from packet lists.
+  enum {
+    kMaxMessageLength = kChordMapBankMaxDataSize +
+                        (kChordMapBankMaxDataSize + 6) / 7 +  // packing
+                        kChordMapSysExOverhead
+  };
+
+  // Called on the loader thread after a load was published, holding no lock.
+  typedef void (*LoadedCallback)(void *userData);
+
+  ChordMapSysExLoader(ChordEngine &engine, LoadedCallback callback,
+                      void *userData);
+  ~ChordMapSysExLoader();
+
+  // Starts and stops the loader thread. Not real-time safe.
+  bool Start();
+  void Stop();
+
+  // MIDI thread. Takes a copy of a complete SysEx message that
+  // ChordMapSysExMatches(); returns false if it was dropped.
+  bool Submit(const UInt8 *inData, UInt32 inLength);
+
+  // Render thread, after ChordEngine::Render. Sends a dump reply if one is
+  // ready.
+  void SendReply(MIDIOutputCallbackHelper &output,
+                 const AudioTimeStamp &inTimeStamp);
+
+ private:
+  enum { kSlotEmpty, kSlotFull };
+  enum { kReplyNone, kReplyReady, kReplySent };
+
+  static void *Run(void *loader);
+  void Process();
+  void Load(const ChordMapSysExMessage &inMessage, const UInt8 *inPayload);
+  void Dump(const ChordMapSysExMessage &inMessage);
+
+  ChordEngine &mEngine;
+  LoadedCallback mLoadedCallback;
+  void *mUserData;
+  pthread_t mThread;
+  bool mRunning;
+  volatile SInt32 mStop;
+  CASemaphore mWake;
+
+  UInt8 *mRequest;  // kMaxMessageLength
+  UInt32 mRequestLength;
+  volatile SInt32 mRequestState;
+  UInt8 *mPayload;  // unpacked mRequest
+
+  UInt8 *mReply;  // allocated per reply
+  UInt32 mReplyLength;
+  volatile SInt32 mReplyState;
+};
+
+#endif /* defined(__ChordMapSysExLoader__) */
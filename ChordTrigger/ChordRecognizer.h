@@ -0,0 +1,110 @@
+//
+//  ChordRecognizer.h
+//  ChordTrigger
+//
+//  Names the chord formed by the notes held on a channel. HeldNoteSet keeps
+//  the held notes as a 128-bit mask and folds it into a 12-bit pitch-class
+//  set; ChordRecognizer maps every one of the 4096 possible sets to a root
+//  and quality through a table built once up front, so recognising a chord
+//  after a note event is a fold and a load.
+//
+
+#ifndef __ChordRecognizer__
+#define __ChordRecognizer__
+
+#include <CoreMIDI/CoreMIDI.h>
+#include <string.h>
+
+// In matching priority: a set that spells two chords (Csus4 / Fsus2) is
+// named after the one listed first. Sixth chords come out as the minor
+// seventh (C6 -> Am7) or half-diminished (Cm6 -> Am7b5) chord they spell.
+// Ten qualities of twelve roots fit in one Program Change.
+enum {
+  kChordQualityMajor = 0,
+  kChordQualityMinor,
+  kChordQualityDiminished,
+  kChordQualityAugmented,
+  kChordQualitySus4,
+  kChordQualitySus2,
+  kChordQualityDominant7,
+  kChordQualityMajor7,
+  kChordQualityMinor7,
+  kChordQualityHalfDiminished7,
+  kChordQualityCount
+};
+
+class HeldNoteSet {
+ public:
+  HeldNoteSet() { Clear(); }
+
+  void Clear() { memset(mMask, 0, sizeof(mMask)); }
+
+  void Set(UInt8 note, bool held) {
+    UInt32 bit = 1U << (note & 31);
+    if (held)
+      mMask[(note & 0x7F) >> 5] |= bit;
+    else
+      mMask[(note & 0x7F) >> 5] &= ~bit;
+  }
+
+  // Bit n is set if any note of pitch class n (0 = C) is held. Words start
+  // at notes 0, 32, 64 and 96, i.e. at pitch classes 0, 8, 4 and 0.
+  UInt32 PitchClasses() const {
+    return FoldOctaves(mMask[0]) | Rotate(FoldOctaves(mMask[1]), 8) |
+           Rotate(FoldOctaves(mMask[2]), 4) | FoldOctaves(mMask[3]);
+  }
+
+ private:
+  static UInt32 FoldOctaves(UInt32 word) {
+    return (word | (word >> 12) | (word >> 24)) & 0xFFF;
+  }
+
+  static UInt32 Rotate(UInt32 pitchClasses, int by) {
+    return ((pitchClasses << by) | (pitchClasses >> (12 - by))) & 0xFFF;
+  }
+
+  UInt32 mMask[4];
+};
+
+class ChordRecognizer {
+ public:
+  enum { kNoChord = 0xFF, kPitchClassSetCount = 4096 };
+
+  ChordRecognizer() {
+    // intervals above the root, as pitch-class sets
+    static const UInt16 kShapes[kChordQualityCount] = {
+        0x091,  // 0 4 7
+        0x089,  // 0 3 7
+        0x049,  // 0 3 6
+        0x111,  // 0 4 8
+        0x0A1,  // 0 5 7
+        0x085,  // 0 2 7
+        0x491,  // 0 4 7 10
+        0x891,  // 0 4 7 11
+        0x489,  // 0 3 7 10
+        0x449,  // 0 3 6 10
+    };
+
+    memset(mTable, kNoChord, sizeof(mTable));
+    for (int quality = kChordQualityCount - 1; quality >= 0; quality--) {
+      for (int root = 11; root >= 0; root--) {
+        UInt32 shape = kShapes[quality];
+        UInt32 set = ((shape << root) | (shape >> (12 - root))) & 0xFFF;
+        mTable[set] = (UInt8)(quality << 4 | root);
+      }
+    }
+  }
+
+  // kNoChord, or the quality in the high and the root in the low nibble.
+  UInt8 Recognize(UInt32 pitchClasses) const {
+    return mTable[pitchClasses & 0xFFF];
+  }
+
+  static UInt8 Root(UInt8 chord) { return chord & 0x0F; }
+  static UInt8 Quality(UInt8 chord) { return chord >> 4; }
+
+ private:
+  UInt8 mTable[kPitchClassSetCount];
+};
+
+#endif /* defined(__ChordRecognizer__) */
@@ -1,23 +1,28 @@
 #include "AUInstrumentBase.h"
 #include "ChordTriggerVersion.h"
-#include "MIDIOutputCallbackHelper.h"
+#include "ChordTriggerProperties.h"
+#include "ChordEngine.h"
+#include "ChordMapSysExLoader.h"
+#include "DiatonicChords.h"
+#include "PerformanceCounters.h"
+#include "TraceWriter.h"
+#include <AudioToolbox/AudioUnitUtilities.h>
 #include <CoreMIDI/CoreMIDI.h>
+#include <limits.h>
 #include <list>
 #include <set>
 #include <algorithm>
 
 #ifdef DEBUG
-#include <fstream>
-#include <ctime>
-#define DEBUGLOG_B(x) \
-if (baseDebugFile.is_open()) baseDebugFile << x
+#define DEBUGLOG_B(...) mTraceWriter.Note(__VA_ARGS__)
 #else
-#define DEBUGLOG_B(x)
+#define DEBUGLOG_B(...)
 #endif
 
 #define kNoteOn 0x90
 #define kNoteOff 0x80
 #define kNoteTop 128
+#define kChannelTop 16
 
 using namespace std;
 
@@ -40,6 +45,15 @@ public:
     OSStatus HandleMidiEvent(UInt8 status, UInt8 channel, UInt8 data1,
                              UInt8 data2, UInt32 inStartFrame);
     
+    OSStatus HandleMIDIPacketList(const MIDIPacketList *pktlist);
+    
+    OSStatus HandleSysEx(const UInt8 *inData, UInt32 inLength);
+    
+#if CA_AU_MIDI_EVENT_LIST
+    OSStatus MIDIEventList(UInt32 inOffsetSampleFrame,
+                           const struct MIDIEventList *inEventList);
+#endif
+    
     OSStatus Render(AudioUnitRenderActionFlags &ioActionFlags,
                     const AudioTimeStamp &inTimeStamp, UInt32 inNumberFrames);
     
@@ -53,14 +67,35 @@ public:
                               AudioUnitParameterID inParameterID,
                               AudioUnitParameterInfo &outParameterInfo);
     
+    OSStatus GetParameterValueStrings(AudioUnitScope inScope,
+                                      AudioUnitParameterID inParameterID,
+                                      CFArrayRef *outStrings);
+    
+    OSStatus SetParameter(AudioUnitParameterID inID, AudioUnitScope inScope,
+                          AudioUnitElement inElement,
+                          AudioUnitParameterValue inValue,
+                          UInt32 inBufferOffsetInFrames);
+    
+    OSStatus SaveState(CFPropertyListRef *outData);
+    OSStatus RestoreState(CFPropertyListRef inData);
+    
 private:
-    MIDIOutputCallbackHelper mCallbackHelper;
-    int noteFlag[kNoteTop];
+    OSStatus RestoreLegacyState(CFDictionaryRef inDict);
+    void RefreshChordNoteParameters(bool inNotify);
+    void MirrorParameter(AudioUnitParameterID inID,
+                         AudioUnitParameterValue inValue, bool inNotify);
+    ChordMap *EditChordMap(bool inCreate);
+    bool SetChannelChordMap(UInt8 inChannel, CFDataRef inData);
+    bool SetChordMapBank(CFDataRef inData);
+    static void ChordMapsLoaded(void *inUserData);
     
-protected:
-#ifdef DEBUG
-    ofstream baseDebugFile;
-#endif
+    void UpdateStrumTable();
+    void UpdateChordRecognition();
+    
+    ChordEngine mEngine;
+    ChordMapSysExLoader mSysExLoader;  // stopped before mEngine goes away
+    PerformanceCounters mPerformance;
+    TraceWriter mTraceWriter;  // stopped before mEngine goes away
 };
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -69,23 +104,87 @@ protected:
 
 AUDIOCOMPONENT_ENTRY(AUMusicDeviceFactory, ChordTrigger)
 
-static const int kNumberOfInputNotes = 5;
-static const int kNumberOfOutputNotes = 5;
-
-static const int kParameter_Ch = 0;
+static const int kParameter_Ch = 0;   // 0 = omni, 1-16
 static const CFStringRef kParamName_Ch = CFSTR("Channel: ");
-static const int kNumberOfParameters =
-kNumberOfInputNotes * (kNumberOfOutputNotes + 1) + 1;
+
+// The chord maps themselves live in mEngine and are saved as blobs. The
+// parameters below only expose the chord of one trigger note of one map at a
+// time so generic host views can still edit them.
+static const int kParameter_EditChannel = 1;   // 0 = shared map, 1-16
+static const CFStringRef kParamName_EditChannel = CFSTR("Edit Channel");
+static const int kParameter_EditTrigger = 2;
+static const CFStringRef kParamName_EditTrigger = CFSTR("Edit Trigger Note");
+static const int kParameter_ChordNote = 3;
+
+static const int kParameter_StrumTime =
+kParameter_ChordNote + kChordMapMaxChordNotes;
+static const CFStringRef kParamName_StrumTime = CFSTR("Strum Time");
+static const int kParameter_StrumDirection = kParameter_StrumTime + 1;
+static const CFStringRef kParamName_StrumDirection = CFSTR("Strum Direction");
+static const int kParameter_StrumVelocityTilt = kParameter_StrumTime + 2;
+static const CFStringRef kParamName_StrumVelocityTilt =
+CFSTR("Strum Velocity Tilt");
+
+// Velocity voicing of the map selected by kParameter_EditChannel. Voices
+// count chord members from the top, so voice 0 is every chord's top note.
+static const int kParameter_VelocityCurve = kParameter_StrumTime + 3;
+static const CFStringRef kParamName_VelocityCurve = CFSTR("Velocity Curve");
+static const int kParameter_EditVoice = kParameter_StrumTime + 4;
+static const CFStringRef kParamName_EditVoice = CFSTR("Edit Voice");
+static const int kParameter_VoiceVelocityScale = kParameter_StrumTime + 5;
+static const CFStringRef kParamName_VoiceVelocityScale =
+CFSTR("Voice Velocity Scale");
+static const int kParameter_VoiceVelocityOffset = kParameter_StrumTime + 6;
+static const CFStringRef kParamName_VoiceVelocityOffset =
+CFSTR("Voice Velocity Offset");
+
+// Harmonises the map selected by kParameter_EditChannel: while the scale is
+// not Off, changing any of these refills all of its chords with the diatonic
+// chords of the key. Off leaves the map as it is.
+static const int kParameter_DiatonicScale = kParameter_StrumTime + 7;
+static const CFStringRef kParamName_DiatonicScale = CFSTR("Diatonic Scale");
+static const int kParameter_DiatonicKey = kParameter_StrumTime + 8;
+static const CFStringRef kParamName_DiatonicKey = CFSTR("Diatonic Key");
+static const int kParameter_DiatonicChord = kParameter_StrumTime + 9;
+static const CFStringRef kParamName_DiatonicChord = CFSTR("Diatonic Chord");
+
+// Reports the chord held on the listened channel(s), see
+// ChordEngine::SetChordRecognition.
+static const int kParameter_ChordRecognition = kParameter_StrumTime + 10;
+static const CFStringRef kParamName_ChordRecognition =
+CFSTR("Chord Recognition");
+static const int kParameter_RecognitionController = kParameter_StrumTime + 11;
+static const CFStringRef kParamName_RecognitionController =
+CFSTR("Recognition CC");
+// See ChordEngine::SetVoiceLeading.
+static const int kParameter_VoiceLeading = kParameter_StrumTime + 12;
+static const CFStringRef kParamName_VoiceLeading = CFSTR("Voice Leading");
+static const int kNumberOfParameters = kParameter_StrumTime + 13;
+
+// All chord maps and the bank, see ChordEngine::SaveChordMaps.
+static const CFStringRef kChordStateKey = CFSTR("chordState");
+
+// Layout of the indexed parameters saved by versions before the packed chord
+// map: channel, then per input note the trigger and its output notes.
+static const int kLegacyNumberOfInputNotes = 5;
+static const int kLegacyNumberOfOutputNotes = 5;
+static const int kLegacyNumberOfParameters =
+kLegacyNumberOfInputNotes * (kLegacyNumberOfOutputNotes + 1) + 1;
 
 ChordTrigger::ChordTrigger(AudioComponentInstance inComponentInstance)
-: AUMonotimbralInstrumentBase(inComponentInstance, 0, 1) {
+: AUMonotimbralInstrumentBase(inComponentInstance, 0, 1),
+  mSysExLoader(mEngine, ChordMapsLoaded, this) {
     CreateElements();
+    SetMaxSysExLength(ChordMapSysExLoader::kMaxMessageLength);
     
     Globals()->UseIndexedParameters(kNumberOfParameters);
     Globals()->SetParameter(kParameter_Ch, 1);
     for (int i = 1; i < kNumberOfParameters; i++) Globals()->SetParameter(i, 0);
-    
-    for(int i =0; i<kNoteTop; i++) noteFlag[i] = 0;
+    Globals()->SetParameter(kParameter_VoiceVelocityScale,
+                            VelocityTable::kDefaultScale);
+    Globals()->SetParameter(kParameter_RecognitionController,
+                            ChordEngine::kDefaultRecognitionController);
+    mEngine.SetChannel(0);
     
 #ifdef DEBUG
     string bPath, bFullFileName;
@@ -96,14 +195,14 @@ ChordTrigger::ChordTrigger(AudioComponentInstance inComponentInstance)
         bFullFileName = "Debug.log";
     }
     
-    baseDebugFile.open(bFullFileName.c_str());
-    DEBUGLOG_B("Plug-in constructor invoked with parameters:" << endl);
+    mTraceWriter.Start(mEngine.Trace(), bFullFileName.c_str());
+    DEBUGLOG_B("Plug-in constructor invoked");
 #endif
 }
 
 ChordTrigger::~ChordTrigger() {
 #ifdef DEBUG
-    DEBUGLOG_B("ChordTrigger::~ChordTrigger" << endl);
+    DEBUGLOG_B("ChordTrigger::~ChordTrigger");
 #endif
 }
 
@@ -121,6 +220,45 @@ OSStatus ChordTrigger::GetPropertyInfo(AudioUnitPropertyID inID,
             outDataSize = sizeof(AUMIDIOutputCallbackStruct);
             outWritable = true;
             return noErr;
+        } else if (inID == kChordTriggerProperty_ChordMap) {
+            if (inElement > kChannelTop) return kAudioUnitErr_InvalidElement;
+            outDataSize = sizeof(CFDataRef);
+            outWritable = true;
+            return noErr;
+        } else if (inID == kChordTriggerProperty_MaxEventsPerCycle) {
+            outDataSize = sizeof(UInt32);
+            outWritable = !IsInitialized();
+            return noErr;
+        } else if (inID == kChordTriggerProperty_OutputBufferStats) {
+            outDataSize = sizeof(ChordTriggerOutputBufferStats);
+            outWritable = false;
+            return noErr;
+        } else if (inID == kChordTriggerProperty_ChordMapBank) {
+            outDataSize = sizeof(CFDataRef);
+            outWritable = true;
+            return noErr;
+        } else if (inID == kChordTriggerProperty_ChordMapBankFile) {
+            outDataSize = sizeof(CFURLRef);
+            outWritable = true;
+            return noErr;
+        } else if (inID == kChordTriggerProperty_UMPOutputCallback) {
+            outDataSize = sizeof(ChordTriggerUMPOutputCallbackStruct);
+            outWritable = true;
+            return noErr;
+        } else if (inID == kChordTriggerProperty_PerformanceStats) {
+            outDataSize = sizeof(ChordTriggerPerformanceStats);
+            outWritable = false;
+            return noErr;
+        } else if (inID == kChordTriggerProperty_TraceFile) {
+            outDataSize = sizeof(CFURLRef);
+            outWritable = true;
+            return noErr;
+#if CA_AU_MIDI_EVENT_LIST
+        } else if (inID == kAudioUnitProperty_AudioUnitMIDIProtocol) {
+            outDataSize = sizeof(MIDIProtocolID);
+            outWritable = false;
+            return noErr;
+#endif
         }
     }
     return AUMonotimbralInstrumentBase::GetPropertyInfo(inID, inScope, inElement,
@@ -129,19 +267,27 @@ OSStatus ChordTrigger::GetPropertyInfo(AudioUnitPropertyID inID,
 
 void ChordTrigger::Cleanup() {
 #ifdef DEBUG
-    DEBUGLOG_B("ChordTrigger::Cleanup" << endl);
+    DEBUGLOG_B("ChordTrigger::Cleanup");
 #endif
+    mSysExLoader.Stop();
 }
 
 OSStatus ChordTrigger::Initialize() {
 #ifdef DEBUG
-    DEBUGLOG_B("->ChordTrigger::Initialize" << endl);
+    DEBUGLOG_B("->ChordTrigger::Initialize");
 #endif
     
     AUMonotimbralInstrumentBase::Initialize();
+    mEngine.Reset();
+    mPerformance.Reset();
+    {
+        ChordEngine::EditLocker lock(mEngine);
+        UpdateStrumTable();
+    }
+    mSysExLoader.Start();
     
 #ifdef DEBUG
-    DEBUGLOG_B("<-ChordTrigger::Initialize" << endl);
+    DEBUGLOG_B("<-ChordTrigger::Initialize");
 #endif
     
     return noErr;
@@ -150,7 +296,7 @@ OSStatus ChordTrigger::Initialize() {
 AUElement *ChordTrigger::CreateElement(AudioUnitScope scope,
                                        AudioUnitElement element) {
 #ifdef DEBUG
-    DEBUGLOG_B("CreateElement - scope: " << scope << endl);
+    DEBUGLOG_B("CreateElement - scope: %u", (unsigned)scope);
 #endif
     switch (scope) {
         case kAudioUnitScope_Group:
@@ -167,8 +313,8 @@ OSStatus ChordTrigger::GetParameterInfo(
                                         AudioUnitParameterInfo &outParameterInfo) {
     
 #ifdef DEBUG
-    DEBUGLOG_B("GetParameterInfo - inScope: " << inScope << endl);
-    DEBUGLOG_B("GetParameterInfo - inParameterID: " << inParameterID << endl);
+    DEBUGLOG_B("GetParameterInfo - inScope: %u inParameterID: %u",
+               (unsigned)inScope, (unsigned)inParameterID);
 #endif
     
     if (inScope != kAudioUnitScope_Global) return kAudioUnitErr_InvalidScope;
@@ -179,21 +325,127 @@ OSStatus ChordTrigger::GetParameterInfo(
     if (inParameterID == kParameter_Ch) {
         AUBase::FillInParameterName(outParameterInfo, kParamName_Ch, false);
         outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
-        outParameterInfo.minValue = 1;
-        outParameterInfo.maxValue = 16;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = kChannelTop;
+        return noErr;
+    } else if (inParameterID == kParameter_EditChannel) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_EditChannel,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = kChannelTop;
+        return noErr;
+    } else if (inParameterID == kParameter_EditTrigger) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_EditTrigger,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = 127;
+        return noErr;
+    } else if (inParameterID == kParameter_StrumTime) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_StrumTime,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Milliseconds;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = 500;
+        outParameterInfo.defaultValue = 0;
+        return noErr;
+    } else if (inParameterID == kParameter_StrumDirection) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_StrumDirection,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = StrumTable::kStrumUp;
+        outParameterInfo.maxValue = StrumTable::kStrumDown;
+        return noErr;
+    } else if (inParameterID == kParameter_StrumVelocityTilt) {
+        AUBase::FillInParameterName(outParameterInfo,
+                                    kParamName_StrumVelocityTilt, false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Generic;
+        outParameterInfo.minValue = -127;
+        outParameterInfo.maxValue = 127;
+        outParameterInfo.defaultValue = 0;
+        return noErr;
+    } else if (inParameterID == kParameter_VelocityCurve) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_VelocityCurve,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = kVelocityCurveLinear;
+        outParameterInfo.maxValue = kVelocityCurveCount - 1;
+        return noErr;
+    } else if (inParameterID == kParameter_EditVoice) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_EditVoice,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = kChordMapMaxChordNotes - 1;
+        return noErr;
+    } else if (inParameterID == kParameter_VoiceVelocityScale) {
+        AUBase::FillInParameterName(outParameterInfo,
+                                    kParamName_VoiceVelocityScale, false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Percent;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = 200;
+        outParameterInfo.defaultValue = VelocityTable::kDefaultScale;
+        return noErr;
+    } else if (inParameterID == kParameter_VoiceVelocityOffset) {
+        AUBase::FillInParameterName(outParameterInfo,
+                                    kParamName_VoiceVelocityOffset, false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Generic;
+        outParameterInfo.minValue = -127;
+        outParameterInfo.maxValue = 127;
+        outParameterInfo.defaultValue = 0;
+        return noErr;
+    } else if (inParameterID == kParameter_DiatonicScale) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_DiatonicScale,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = kDiatonicScaleCount;
+        return noErr;
+    } else if (inParameterID == kParameter_DiatonicKey) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_DiatonicKey,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = 11;
+        return noErr;
+    } else if (inParameterID == kParameter_DiatonicChord) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_DiatonicChord,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = kDiatonicChordCount - 1;
+        return noErr;
+    } else if (inParameterID == kParameter_ChordRecognition) {
+        AUBase::FillInParameterName(outParameterInfo,
+                                    kParamName_ChordRecognition, false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = ChordEngine::kChordRecognitionOff;
+        outParameterInfo.maxValue = ChordEngine::kChordRecognitionProgramChange;
+        return noErr;
+    } else if (inParameterID == kParameter_RecognitionController) {
+        AUBase::FillInParameterName(outParameterInfo,
+                                    kParamName_RecognitionController, false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = 126;
+        outParameterInfo.defaultValue =
+            ChordEngine::kDefaultRecognitionController;
+        return noErr;
+    } else if (inParameterID == kParameter_VoiceLeading) {
+        AUBase::FillInParameterName(outParameterInfo, kParamName_VoiceLeading,
+                                    false);
+        outParameterInfo.unit = kAudioUnitParameterUnit_Boolean;
+        outParameterInfo.minValue = 0;
+        outParameterInfo.maxValue = 1;
         return noErr;
-    } else if (inParameterID < kNumberOfParameters) {
-        int input = (inParameterID - 1) / (kNumberOfOutputNotes + 1) + 1;
-        int output = (inParameterID - 1) % (kNumberOfOutputNotes + 1) + 1;
-        CFStringRef cfs;
-        if (output == 1)
-            cfs = CFStringCreateWithFormat(NULL, NULL, CFSTR("Input Note Number: %d"),
-                                           input);
-        else
-            cfs = CFStringCreateWithFormat(
-                                           NULL, NULL, CFSTR("Output Note Number: %d -> %d"), input, output - 1);
+    } else if (inParameterID >= kParameter_ChordNote &&
+               inParameterID < kParameter_ChordNote + kChordMapMaxChordNotes) {
+        CFStringRef cfs = CFStringCreateWithFormat(
+                                                   NULL, NULL, CFSTR("Chord Note %d"),
+                                                   (int)(inParameterID - kParameter_ChordNote + 1));
         
-        AUBase::FillInParameterName(outParameterInfo, cfs, false);
+        AUBase::FillInParameterName(outParameterInfo, cfs, true);
         outParameterInfo.unit = kAudioUnitParameterUnit_Indexed;
         outParameterInfo.minValue = 0;
         outParameterInfo.maxValue = 127;
@@ -204,6 +456,359 @@ OSStatus ChordTrigger::GetParameterInfo(
     return noErr;
 }
 
+OSStatus ChordTrigger::GetParameterValueStrings(AudioUnitScope inScope,
+                                                AudioUnitParameterID inParameterID,
+                                                CFArrayRef *outStrings) {
+    if (inScope != kAudioUnitScope_Global) return kAudioUnitErr_InvalidProperty;
+    
+    if (inParameterID == kParameter_StrumDirection) {
+        if (outStrings == NULL) return noErr;
+        CFStringRef strs[] = {CFSTR("Up"), CFSTR("Down")};
+        *outStrings = CFArrayCreate(NULL, (const void **)strs, 2,
+                                    &kCFTypeArrayCallBacks);
+        return noErr;
+    } else if (inParameterID == kParameter_VelocityCurve) {
+        if (outStrings == NULL) return noErr;
+        CFStringRef strs[kVelocityCurveCount] = {
+            CFSTR("Linear"), CFSTR("Soft"), CFSTR("Softer"), CFSTR("Hard"),
+            CFSTR("Harder")};
+        *outStrings = CFArrayCreate(NULL, (const void **)strs,
+                                    kVelocityCurveCount, &kCFTypeArrayCallBacks);
+        return noErr;
+    } else if (inParameterID == kParameter_EditVoice) {
+        if (outStrings == NULL) return noErr;
+        CFStringRef strs[kChordMapMaxChordNotes];
+        strs[0] = CFSTR("Top");
+        for (int voice = 1; voice < kChordMapMaxChordNotes; voice++)
+            strs[voice] = CFStringCreateWithFormat(NULL, NULL,
+                                                   CFSTR("Top - %d"), voice);
+        *outStrings = CFArrayCreate(NULL, (const void **)strs,
+                                    kChordMapMaxChordNotes,
+                                    &kCFTypeArrayCallBacks);
+        for (int voice = 1; voice < kChordMapMaxChordNotes; voice++)
+            CFRelease(strs[voice]);
+        return noErr;
+    } else if (inParameterID == kParameter_DiatonicScale) {
+        if (outStrings == NULL) return noErr;
+        CFStringRef strs[kDiatonicScaleCount + 1] = {
+            CFSTR("Off"), CFSTR("Major"), CFSTR("Dorian"), CFSTR("Phrygian"),
+            CFSTR("Lydian"), CFSTR("Mixolydian"), CFSTR("Minor"),
+            CFSTR("Locrian"), CFSTR("Harmonic Minor"), CFSTR("Melodic Minor")};
+        *outStrings = CFArrayCreate(NULL, (const void **)strs,
+                                    kDiatonicScaleCount + 1,
+                                    &kCFTypeArrayCallBacks);
+        return noErr;
+    } else if (inParameterID == kParameter_DiatonicKey) {
+        if (outStrings == NULL) return noErr;
+        CFStringRef strs[12] = {
+            CFSTR("C"), CFSTR("C#"), CFSTR("D"), CFSTR("D#"), CFSTR("E"),
+            CFSTR("F"), CFSTR("F#"), CFSTR("G"), CFSTR("G#"), CFSTR("A"),
+            CFSTR("A#"), CFSTR("B")};
+        *outStrings = CFArrayCreate(NULL, (const void **)strs, 12,
+                                    &kCFTypeArrayCallBacks);
+        return noErr;
+    } else if (inParameterID == kParameter_DiatonicChord) {
+        if (outStrings == NULL) return noErr;
+        CFStringRef strs[kDiatonicChordCount] = {
+            CFSTR("Triad"), CFSTR("7th"), CFSTR("9th"), CFSTR("Sus2"),
+            CFSTR("Sus4")};
+        *outStrings = CFArrayCreate(NULL, (const void **)strs,
+                                    kDiatonicChordCount, &kCFTypeArrayCallBacks);
+        return noErr;
+    } else if (inParameterID == kParameter_ChordRecognition) {
+        if (outStrings == NULL) return noErr;
+        CFStringRef strs[] = {CFSTR("Off"), CFSTR("Control Change"),
+                              CFSTR("Program Change")};
+        *outStrings = CFArrayCreate(NULL, (const void **)strs, 3,
+                                    &kCFTypeArrayCallBacks);
+        return noErr;
+    }
+    
+    if (inParameterID != kParameter_Ch && inParameterID != kParameter_EditChannel)
+        return kAudioUnitErr_InvalidProperty;
+    if (outStrings == NULL) return noErr;
+    
+    CFStringRef strs[kChannelTop + 1];
+    strs[0] = (inParameterID == kParameter_Ch) ? CFSTR("Omni") : CFSTR("All");
+    for (int ch = 1; ch <= kChannelTop; ch++)
+        strs[ch] = CFStringCreateWithFormat(NULL, NULL, CFSTR("%d"), ch);
+    
+    *outStrings = CFArrayCreate(NULL, (const void **)strs, kChannelTop + 1,
+                                &kCFTypeArrayCallBacks);
+    for (int ch = 1; ch <= kChannelTop; ch++) CFRelease(strs[ch]);
+    return noErr;
+}
+
+OSStatus ChordTrigger::SetParameter(AudioUnitParameterID inID,
+                                    AudioUnitScope inScope,
+                                    AudioUnitElement inElement,
+                                    AudioUnitParameterValue inValue,
+                                    UInt32 inBufferOffsetInFrames) {
+    OSStatus result = AUMonotimbralInstrumentBase::SetParameter(
+        inID, inScope, inElement, inValue, inBufferOffsetInFrames);
+    if (result != noErr || inScope != kAudioUnitScope_Global) return result;
+    
+    if (inID == kParameter_Ch) {
+        ChordEngine::EditLocker lock(mEngine);
+        mEngine.SetChannel((int)inValue - 1);
+    } else if (inID == kParameter_EditChannel ||
+               inID == kParameter_EditTrigger || inID == kParameter_EditVoice) {
+        ChordEngine::EditLocker lock(mEngine);
+        RefreshChordNoteParameters(true);
+    } else if (inID >= kParameter_StrumTime &&
+               inID <= kParameter_StrumVelocityTilt) {
+        ChordEngine::EditLocker lock(mEngine);
+        UpdateStrumTable();
+    } else if (inID >= kParameter_ChordNote &&
+               inID < kParameter_ChordNote + kChordMapMaxChordNotes) {
+        ChordEngine::EditLocker lock(mEngine);
+        UInt8 trigger = (UInt8)Globals()->GetParameter(kParameter_EditTrigger);
+        EditChordMap(true)->SetChordNote(trigger, inID - kParameter_ChordNote,
+                                         (UInt8)inValue);
+        mEngine.PublishChordMaps();
+        RefreshChordNoteParameters(true);
+    } else if (inID == kParameter_VelocityCurve) {
+        ChordEngine::EditLocker lock(mEngine);
+        EditChordMap(true)->SetVelocityCurve((int)inValue);
+        mEngine.PublishChordMaps();
+    } else if (inID == kParameter_VoiceVelocityScale ||
+               inID == kParameter_VoiceVelocityOffset) {
+        ChordEngine::EditLocker lock(mEngine);
+        EditChordMap(true)->SetVoiceVelocity(
+            (int)Globals()->GetParameter(kParameter_EditVoice),
+            (int)Globals()->GetParameter(kParameter_VoiceVelocityScale),
+            (int)Globals()->GetParameter(kParameter_VoiceVelocityOffset));
+        mEngine.PublishChordMaps();
+    } else if (inID >= kParameter_DiatonicScale &&
+               inID <= kParameter_DiatonicChord) {
+        int scale = (int)Globals()->GetParameter(kParameter_DiatonicScale) - 1;
+        if (scale < 0) return result;
+        
+        ChordEngine::EditLocker lock(mEngine);
+        FillDiatonicChords(
+            *EditChordMap(true),
+            (int)Globals()->GetParameter(kParameter_DiatonicKey), scale,
+            (int)Globals()->GetParameter(kParameter_DiatonicChord));
+        mEngine.PublishChordMaps();
+        RefreshChordNoteParameters(true);
+    } else if (inID == kParameter_ChordRecognition ||
+               inID == kParameter_RecognitionController) {
+        ChordEngine::EditLocker lock(mEngine);
+        UpdateChordRecognition();
+    } else if (inID == kParameter_VoiceLeading) {
+        ChordEngine::EditLocker lock(mEngine);
+        mEngine.SetVoiceLeading(inValue != 0);
+    }
+    return result;
+}
+
+OSStatus ChordTrigger::SaveState(CFPropertyListRef *outData) {
+    OSStatus result = AUMonotimbralInstrumentBase::SaveState(outData);
+    if (result != noErr) return result;
+    
+    CFMutableDictionaryRef dict = (CFMutableDictionaryRef)*outData;
+    UInt8 *buffer = new UInt8[ChordEngine::kChordMapStateMaxDataSize];
+    UInt32 size;
+    {
+        ChordEngine::EditLocker lock(mEngine);
+        size = mEngine.SaveChordMaps(buffer);
+    }
+    CFDataRef data = CFDataCreate(NULL, buffer, size);
+    delete[] buffer;
+    CFDictionarySetValue(dict, kChordStateKey, data);
+    CFRelease(data);
+    return noErr;
+}
+
+OSStatus ChordTrigger::RestoreState(CFPropertyListRef inData) {
+    if (CFGetTypeID(inData) != CFDictionaryGetTypeID())
+        return kAudioUnitErr_InvalidPropertyValue;
+    
+    CFDictionaryRef dict = static_cast<CFDictionaryRef>(inData);
+    CFDataRef stateData =
+    reinterpret_cast<CFDataRef>(CFDictionaryGetValue(dict, kChordStateKey));
+    if (stateData == NULL) return RestoreLegacyState(dict);
+    
+    {
+        ChordEngine::EditLocker lock(mEngine);
+        if (!mEngine.RestoreChordMaps(CFDataGetBytePtr(stateData),
+                                      (UInt32)CFDataGetLength(stateData)))
+            return kAudioUnitErr_InvalidPropertyValue;
+        mEngine.PublishChordMaps();
+    }
+    
+    OSStatus result = AUMonotimbralInstrumentBase::RestoreState(inData);
+    ChordEngine::EditLocker lock(mEngine);
+    mEngine.SetChannel((int)Globals()->GetParameter(kParameter_Ch) - 1);
+    UpdateStrumTable();
+    UpdateChordRecognition();
+    mEngine.SetVoiceLeading(
+        Globals()->GetParameter(kParameter_VoiceLeading) != 0);
+    RefreshChordNoteParameters(false);
+    return result;
+}
+
+// States saved before the packed chord map carry the chords as 31 indexed
+// parameters. Strip those from the parameter data so AUBase does not reject
+// them, and rebuild the chord map from their values.
+OSStatus ChordTrigger::RestoreLegacyState(CFDictionaryRef inDict) {
+    CFDataRef data =
+    reinterpret_cast<CFDataRef>(CFDictionaryGetValue(inDict, CFSTR(kAUPresetDataKey)));
+    if (data == NULL) return AUMonotimbralInstrumentBase::RestoreState(inDict);
+    
+    AudioUnitParameterValue legacy[kLegacyNumberOfParameters] = {0};
+    CFMutableDataRef filtered = CFDataCreateMutable(NULL, 0);
+    
+    const UInt8 *p = CFDataGetBytePtr(data);
+    const UInt8 *pend = p + CFDataGetLength(data);
+    while (pend - p >= 3 * (long)sizeof(UInt32)) {
+        UInt32 scope = CFSwapInt32BigToHost(((const UInt32 *)p)[0]);
+        UInt32 element = CFSwapInt32BigToHost(((const UInt32 *)p)[1]);
+        UInt32 nparams = CFSwapInt32BigToHost(((const UInt32 *)p)[2]);
+        const UInt8 *entries = p + 3 * sizeof(UInt32);
+        if ((UInt32)(pend - entries) / (2 * sizeof(UInt32)) < nparams) break;
+        p = entries + nparams * 2 * sizeof(UInt32);
+        
+        if (scope != kAudioUnitScope_Global || element != 0) {
+            CFDataAppendBytes(filtered, entries - 3 * sizeof(UInt32),
+                              p - entries + 3 * sizeof(UInt32));
+            continue;
+        }
+        
+        UInt32 kept = 0;
+        CFIndex countOffset = CFDataGetLength(filtered) + 2 * sizeof(UInt32);
+        CFDataAppendBytes(filtered, entries - 3 * sizeof(UInt32),
+                          3 * sizeof(UInt32));
+        for (UInt32 i = 0; i < nparams; i++) {
+            const UInt32 *entry = (const UInt32 *)(entries + i * 2 * sizeof(UInt32));
+            UInt32 paramID = CFSwapInt32BigToHost(entry[0]);
+            union { UInt32 i; AudioUnitParameterValue f; } value;
+            value.i = CFSwapInt32BigToHost(entry[1]);
+            
+            if (paramID < (UInt32)kLegacyNumberOfParameters)
+                legacy[paramID] = value.f;
+            if (paramID == kParameter_Ch) {
+                CFDataAppendBytes(filtered, (const UInt8 *)entry, 2 * sizeof(UInt32));
+                kept++;
+            }
+        }
+        UInt32 keptBig = CFSwapInt32HostToBig(kept);
+        CFDataReplaceBytes(filtered, CFRangeMake(countOffset, sizeof(UInt32)),
+                           (const UInt8 *)&keptBig, sizeof(UInt32));
+    }
+    
+    CFMutableDictionaryRef dict =
+    CFDictionaryCreateMutableCopy(NULL, 0, inDict);
+    CFDictionarySetValue(dict, CFSTR(kAUPresetDataKey), filtered);
+    CFRelease(filtered);
+    
+    OSStatus result = AUMonotimbralInstrumentBase::RestoreState(dict);
+    CFRelease(dict);
+    if (result != noErr) return result;
+    
+    // first slot wins when the same trigger note was entered twice
+    ChordEngine::EditLocker lock(mEngine);
+    for (int ch = 0; ch < kChannelTop; ch++) SetChannelChordMap(ch, NULL);
+    SetChordMapBank(NULL);
+    ChordMap &chordMap = mEngine.SharedChordMap();
+    chordMap.Clear();
+    for (int i = kLegacyNumberOfInputNotes - 1; i >= 0; i--) {
+        int slot = 1 + i * (kLegacyNumberOfOutputNotes + 1);
+        UInt8 notes[kLegacyNumberOfOutputNotes];
+        for (int j = 0; j < kLegacyNumberOfOutputNotes; j++)
+            notes[j] = (UInt8)legacy[slot + 1 + j];
+        chordMap.SetChord((UInt8)legacy[slot], notes, kLegacyNumberOfOutputNotes);
+    }
+    mEngine.PublishChordMaps();
+    
+    mEngine.SetChannel((int)Globals()->GetParameter(kParameter_Ch) - 1);
+    UpdateStrumTable();
+    UpdateChordRecognition();
+    mEngine.SetVoiceLeading(
+        Globals()->GetParameter(kParameter_VoiceLeading) != 0);
+    RefreshChordNoteParameters(false);
+    return noErr;
+}
+
+// Returns the map selected by kParameter_EditChannel. A channel without its
+// own map shows the shared one until it is edited, at which point the shared
+// map is copied into a new channel map if |inCreate| is set.
+ChordMap *ChordTrigger::EditChordMap(bool inCreate) {
+    int channel = (int)Globals()->GetParameter(kParameter_EditChannel) - 1;
+    if (channel < 0 || channel >= kChannelTop) return &mEngine.SharedChordMap();
+    
+    if (inCreate) return mEngine.CreateChannelChordMap(channel);
+    ChordMap *map = mEngine.ChannelChordMap(channel);
+    return map ? map : &mEngine.SharedChordMap();
+}
+
+// Replaces the map of one channel with a packed chord map, or drops it when
+// |inData| is NULL so the channel falls back to the shared map.
+bool ChordTrigger::SetChannelChordMap(UInt8 inChannel, CFDataRef inData) {
+    if (inData == NULL) return mEngine.SetChannelChordMap(inChannel, NULL, 0);
+    return mEngine.SetChannelChordMap(inChannel, CFDataGetBytePtr(inData),
+                                      (UInt32)CFDataGetLength(inData));
+}
+
+// Replaces the chord map bank with a bank image, or drops it when |inData|
+// is NULL. Like the chord maps, the result is published by the caller.
+bool ChordTrigger::SetChordMapBank(CFDataRef inData) {
+    if (inData == NULL) {
+        mEngine.SetChordMapBank(NULL);
+        return true;
+    }
+    
+    ChordMapBank *bank = new ChordMapBank;
+    if (!bank->Restore(CFDataGetBytePtr(inData),
+                       (UInt32)CFDataGetLength(inData))) {
+        bank->Release();
+        return false;
+    }
+    mEngine.SetChordMapBank(bank);
+    return true;
+}
+
+// Mirrors the chord of the trigger selected by kParameter_EditChannel and
+// kParameter_EditTrigger into the chord note parameters, and the map's
+// velocity voicing into the velocity parameters.
+void ChordTrigger::RefreshChordNoteParameters(bool inNotify) {
+    const ChordMap &map = *EditChordMap(false);
+    UInt8 trigger = (UInt8)Globals()->GetParameter(kParameter_EditTrigger);
+    int voice = (int)Globals()->GetParameter(kParameter_EditVoice);
+    
+    for (int i = 0; i < kChordMapMaxChordNotes; i++)
+        MirrorParameter(kParameter_ChordNote + i, map.GetChordNote(trigger, i),
+                        inNotify);
+    MirrorParameter(kParameter_VelocityCurve, map.VelocityCurve(), inNotify);
+    MirrorParameter(kParameter_VoiceVelocityScale,
+                    map.VoiceVelocityScale(voice), inNotify);
+    MirrorParameter(kParameter_VoiceVelocityOffset,
+                    map.VoiceVelocityOffset(voice), inNotify);
+}
+
+// Loader thread, after a SysEx upload was published.
+void ChordTrigger::ChordMapsLoaded(void *inUserData) {
+    ChordTrigger *self = static_cast<ChordTrigger *>(inUserData);
+    ChordEngine::EditLocker lock(self->mEngine);
+    self->RefreshChordNoteParameters(true);
+}
+
+void ChordTrigger::MirrorParameter(AudioUnitParameterID inID,
+                                   AudioUnitParameterValue inValue,
+                                   bool inNotify) {
+    if (Globals()->GetParameter(inID) == inValue) return;
+    
+    Globals()->SetParameter(inID, inValue);
+    if (inNotify) {
+        AudioUnitParameter param;
+        param.mAudioUnit = GetComponentInstance();
+        param.mParameterID = inID;
+        param.mScope = kAudioUnitScope_Global;
+        param.mElement = 0;
+        AUParameterListenerNotify(NULL, NULL, &param);
+    }
+}
+
 OSStatus ChordTrigger::GetProperty(AudioUnitPropertyID inID,
                                    AudioUnitScope inScope,
                                    AudioUnitElement inElement, void *outData) {
@@ -216,6 +821,54 @@ OSStatus ChordTrigger::GetProperty(AudioUnitPropertyID inID,
             CFArrayCreate(NULL, (const void **)strs, 1, &kCFTypeArrayCallBacks);
             *(CFArrayRef *)outData = callbackArray;
             return noErr;
+        } else if (inID == kChordTriggerProperty_ChordMap) {
+            if (inElement > kChannelTop) return kAudioUnitErr_InvalidElement;
+            ChordEngine::EditLocker lock(mEngine);
+            const ChordMap *map =
+            (inElement == 0) ? &mEngine.SharedChordMap()
+                             : mEngine.ChannelChordMap(inElement - 1);
+            if (map == NULL) {
+                *(CFDataRef *)outData = NULL;   // channel uses the shared map
+                return noErr;
+            }
+            
+            UInt8 buffer[kChordMapMaxDataSize];
+            UInt32 size = map->Save(buffer);
+            *(CFDataRef *)outData = CFDataCreate(NULL, buffer, size);
+            return noErr;
+        } else if (inID == kChordTriggerProperty_MaxEventsPerCycle) {
+            *(UInt32 *)outData = mEngine.Output().MaxEvents();
+            return noErr;
+        } else if (inID == kChordTriggerProperty_OutputBufferStats) {
+            ChordTriggerOutputBufferStats *stats =
+            (ChordTriggerOutputBufferStats *)outData;
+            stats->packetListSize = mEngine.Output().PacketListSize();
+            stats->packetListHighWater = mEngine.Output().PacketListHighWater();
+            stats->splitFlushCount = mEngine.Output().SplitFlushCount();
+            stats->droppedEventCount = mEngine.Output().OverflowCount();
+            return noErr;
+        } else if (inID == kChordTriggerProperty_PerformanceStats) {
+            mPerformance.Read(*(ChordTriggerPerformanceStats *)outData);
+            return noErr;
+        } else if (inID == kChordTriggerProperty_ChordMapBank) {
+            ChordEngine::EditLocker lock(mEngine);
+            const ChordMapBank *bank = mEngine.Bank();
+            if (bank == NULL) {
+                *(CFDataRef *)outData = NULL;
+                return noErr;
+            }
+            
+            UInt8 *buffer = new UInt8[kChordMapBankMaxDataSize];
+            UInt32 size = bank->Save(buffer);
+            *(CFDataRef *)outData = CFDataCreate(NULL, buffer, size);
+            delete[] buffer;
+            return noErr;
+#if CA_AU_MIDI_EVENT_LIST
+        } else if (inID == kAudioUnitProperty_AudioUnitMIDIProtocol) {
+            // tells the host to send MIDIEventList input as MIDI 2.0 UMPs
+            *(MIDIProtocolID *)outData = kMIDIProtocol_2_0;
+            return noErr;
+#endif
         }
     }
     return AUMonotimbralInstrumentBase::GetProperty(inID, inScope, inElement,
@@ -227,7 +880,7 @@ OSStatus ChordTrigger::SetProperty(AudioUnitPropertyID inID,
                                    AudioUnitElement inElement,
                                    const void *inData, UInt32 inDataSize) {
 #ifdef DEBUG
-    DEBUGLOG_B("SetProperty" << endl);
+    DEBUGLOG_B("SetProperty - inID: %u", (unsigned)inID);
 #endif
     if (inScope == kAudioUnitScope_Global) {
         if (inID == kAudioUnitProperty_MIDIOutputCallback) {
@@ -236,9 +889,93 @@ OSStatus ChordTrigger::SetProperty(AudioUnitPropertyID inID,
             
             AUMIDIOutputCallbackStruct *callbackStruct =
             (AUMIDIOutputCallbackStruct *)inData;
-            mCallbackHelper.SetCallbackInfo(callbackStruct->midiOutputCallback,
+            mEngine.Output().SetCallbackInfo(callbackStruct->midiOutputCallback,
                                             callbackStruct->userData);
             return noErr;
+        } else if (inID == kChordTriggerProperty_ChordMap) {
+            if (inDataSize < sizeof(CFDataRef))
+                return kAudioUnitErr_InvalidPropertyValue;
+            
+            CFDataRef data = *(CFDataRef *)inData;
+            ChordEngine::EditLocker lock(mEngine);
+            bool restored;
+            if (inElement == 0)
+                restored = data != NULL &&
+                           mEngine.SharedChordMap().Restore(
+                               CFDataGetBytePtr(data),
+                               (UInt32)CFDataGetLength(data));
+            else if (inElement <= kChannelTop)
+                restored = SetChannelChordMap(inElement - 1, data);
+            else
+                return kAudioUnitErr_InvalidElement;
+            
+            if (!restored) return kAudioUnitErr_InvalidPropertyValue;
+            
+            mEngine.PublishChordMaps();
+            RefreshChordNoteParameters(true);
+            return noErr;
+        } else if (inID == kChordTriggerProperty_MaxEventsPerCycle) {
+            if (inDataSize < sizeof(UInt32))
+                return kAudioUnitErr_InvalidPropertyValue;
+            if (IsInitialized()) return kAudioUnitErr_Initialized;
+            
+            UInt32 maxEvents = *(const UInt32 *)inData;
+            if (maxEvents == 0) return kAudioUnitErr_InvalidPropertyValue;
+            mEngine.Output().SetMaxEvents(maxEvents);
+            return noErr;
+        } else if (inID == kChordTriggerProperty_ChordMapBank) {
+            if (inDataSize < sizeof(CFDataRef))
+                return kAudioUnitErr_InvalidPropertyValue;
+            
+            ChordEngine::EditLocker lock(mEngine);
+            if (!SetChordMapBank(*(CFDataRef *)inData))
+                return kAudioUnitErr_InvalidPropertyValue;
+            
+            mEngine.PublishChordMaps();
+            return noErr;
+        } else if (inID == kChordTriggerProperty_ChordMapBankFile) {
+            if (inDataSize < sizeof(CFURLRef))
+                return kAudioUnitErr_InvalidPropertyValue;
+            
+            char path[PATH_MAX];
+            CFURLRef url = *(CFURLRef *)inData;
+            if (url == NULL ||
+                !CFURLGetFileSystemRepresentation(url, true, (UInt8 *)path,
+                                                  sizeof(path)))
+                return kAudioUnitErr_InvalidPropertyValue;
+            
+            ChordMapBank *bank = new ChordMapBank;
+            if (!bank->RestoreFromFile(path)) {
+                bank->Release();
+                return kAudioUnitErr_InvalidFile;
+            }
+            ChordEngine::EditLocker lock(mEngine);
+            mEngine.SetChordMapBank(bank);
+            mEngine.PublishChordMaps();
+            return noErr;
+        } else if (inID == kChordTriggerProperty_UMPOutputCallback) {
+            if (inDataSize < sizeof(ChordTriggerUMPOutputCallbackStruct))
+                return kAudioUnitErr_InvalidPropertyValue;
+            
+            mEngine.Output().SetUMPCallbackInfo(
+                *(const ChordTriggerUMPOutputCallbackStruct *)inData);
+            return noErr;
+        } else if (inID == kChordTriggerProperty_TraceFile) {
+            if (inDataSize < sizeof(CFURLRef))
+                return kAudioUnitErr_InvalidPropertyValue;
+            
+            CFURLRef url = *(CFURLRef *)inData;
+            if (url == NULL) {
+                mTraceWriter.Stop();
+                return noErr;
+            }
+            char path[PATH_MAX];
+            if (!CFURLGetFileSystemRepresentation(url, true, (UInt8 *)path,
+                                                  sizeof(path)))
+                return kAudioUnitErr_InvalidPropertyValue;
+            if (!mTraceWriter.Start(mEngine.Trace(), path))
+                return kAudioUnitErr_InvalidFile;
+            return noErr;
         }
     }
     return AUMonotimbralInstrumentBase::SetProperty(inID, inScope, inElement,
@@ -249,74 +986,101 @@ OSStatus ChordTrigger::HandleMidiEvent(UInt8 status, UInt8 channel, UInt8 data1,
                                        UInt8 data2, UInt32 inStartFrame) {
     // data1 : note number, data2 : velocity
     
-#ifdef DEBUG
-    DEBUGLOG_B("HandleMidiEvent - status:"
-               << (int)status << " ch:" << (int)channel << "/"
-               << (Globals()->GetParameter(kParameter_Ch) - 1)
-               << " data1:" << (int)data1 << " data2:" << (int)data2 << endl);
-#endif
-    
-    if (channel == Globals()->GetParameter(kParameter_Ch) - 1 &&
-        (status == kNoteOn || status == kNoteOff)) {
-        
-        bool isThruNote = false;
-        //bool isNoteOn = data2 > 0 || status != kNoteOff;
-        
-        if(data2 == 0) status = kNoteOff;   // velocity = 0 Noteon -> Noteoff
-        
-        for (int i = 1; i < kNumberOfParameters; i += (kNumberOfOutputNotes + 1)) {
-            int noteCheckNumber = Globals()->GetParameter(i);
-            
-            if (data1 == noteCheckNumber) {
-                for (int j = 1; j <= kNumberOfOutputNotes; j++) {
-                    int noteOnOffNumber = Globals()->GetParameter(i + j);
-                    
-                    if (noteOnOffNumber != 0) {
-                        
-                        if(status == kNoteOn){
-                            if(noteFlag[noteOnOffNumber] > 0)
-                                mCallbackHelper.AddMIDIEvent(kNoteOff, channel, noteOnOffNumber, 0, inStartFrame);
-                            mCallbackHelper.AddMIDIEvent(status, channel, noteOnOffNumber,
-                                                         data2, inStartFrame);
-                            
-                            noteFlag[noteOnOffNumber] = data1;
-                        } else {
-                            if(noteFlag[noteOnOffNumber] == data1){
-                                mCallbackHelper.AddMIDIEvent(status, channel, noteOnOffNumber,
-                                                             data2, inStartFrame);
-                                noteFlag[noteOnOffNumber] = 0;
-                            }
-                        }
-                    }
-                }
-                
-                isThruNote = true;
-                break;
-            }
-        }
-        
-        if (!isThruNote) {
-            if(noteFlag[data1] != 0) {
-                mCallbackHelper.AddMIDIEvent(kNoteOff, channel, data1, 0, inStartFrame);
-                noteFlag[data1] = 0;
-            }
-            mCallbackHelper.AddMIDIEvent(status, channel, data1, data2, inStartFrame);
-        }
-    } else
-        mCallbackHelper.AddMIDIEvent(status, channel, data1, data2, inStartFrame);
+    UInt64 start = PerformanceCounters::Now();
+    mEngine.HandleMIDIEvent(status, channel, data1, data2, inStartFrame);
+    mPerformance.EventsHandled(1, start);
     
     return AUMIDIBase::HandleMidiEvent(status, channel, data1, data2,
                                        inStartFrame);
 }
 
+// The engine takes the list a decoded batch at a time instead of one
+// virtual HandleMidiEvent call per message. AUMIDIBase gets the SysEx, and
+// sees every message afterwards only while a parameter is mapped or being
+// learned; otherwise just the non-note messages go to HandleNonNoteEvent.
+OSStatus ChordTrigger::HandleMIDIPacketList(const MIDIPacketList *pktlist) {
+    if (!IsInitialized()) return kAudioUnitErr_Uninitialized;
+    
+    MIDIEventBatch batch(PacketParser(), pktlist);
+    while (batch.DecodeNext()) {
+        UInt64 start = PerformanceCounters::Now();
+        UInt32 numEvents = mEngine.HandleMIDIEventBatch(batch);
+        mPerformance.EventsHandled(numEvents, start);
+        
+#if CA_AUTO_MIDI_MAP
+        bool mapping = GetMIDIMapManager()->HasActiveMappings();
+#else
+        bool mapping = false;
+#endif
+        for (UInt32 i = 0; i < numEvents; i++) {
+            UInt32 word0 = batch.Word(i);
+            UInt8 status = UMPStatus(word0);
+            if (mapping)
+                AUMIDIBase::HandleMidiEvent(status, UMPChannel(word0),
+                                            UMPData1(word0), UMPData2(word0),
+                                            batch.Frame(i));
+            else if (status != kNoteOn && status != kNoteOff)
+                HandleNonNoteEvent(status, UMPChannel(word0), UMPData1(word0),
+                                   UMPData2(word0), batch.Frame(i));
+        }
+        if (batch.SysEx()) HandleSysExPiece(*batch.SysEx());
+    }
+    return noErr;
+}
+
+// Chord map and bank uploads and dump requests go to the loader thread; see
+// ChordMapSysEx.h for the format.
+OSStatus ChordTrigger::HandleSysEx(const UInt8 *inData, UInt32 inLength) {
+    if (ChordMapSysExMatches(inData, inLength))
+        mSysExLoader.Submit(inData, inLength);
+    return noErr;
+}
+
+#if CA_AU_MIDI_EVENT_LIST
+// Universal MIDI Packets go straight to the engine, so MIDI 2.0 notes keep
+// their velocity and attributes. Like MIDIEvent, every packet is taken to
+// start at inOffsetSampleFrame.
+OSStatus ChordTrigger::MIDIEventList(UInt32 inOffsetSampleFrame,
+                                     const struct MIDIEventList *inEventList) {
+    const MIDIEventPacket *packet = &inEventList->packet[0];
+    for (UInt32 i = 0; i < inEventList->numPackets; i++) {
+        UInt64 start = PerformanceCounters::Now();
+        UInt32 numEvents = mEngine.HandleUMPEvents(
+            packet->words, packet->wordCount, inOffsetSampleFrame);
+        mPerformance.EventsHandled(numEvents, start);
+        packet = MIDIEventPacketNext(packet);
+    }
+    return noErr;
+}
+#endif
+
+// Called holding the edit lock, as are the other engine settings changes.
+void ChordTrigger::UpdateStrumTable() {
+    mEngine.SetStrum(GetOutput(0)->GetStreamFormat().mSampleRate,
+                     Globals()->GetParameter(kParameter_StrumTime),
+                     (int)Globals()->GetParameter(kParameter_StrumDirection),
+                     Globals()->GetParameter(kParameter_StrumVelocityTilt));
+}
+
+void ChordTrigger::UpdateChordRecognition() {
+    mEngine.SetChordRecognition(
+        (int)Globals()->GetParameter(kParameter_ChordRecognition),
+        (UInt8)Globals()->GetParameter(kParameter_RecognitionController));
+}
+
 OSStatus ChordTrigger::Render(AudioUnitRenderActionFlags &ioActionFlags,
                               const AudioTimeStamp &inTimeStamp,
                               UInt32 inNumberFrames) {
     
     OSStatus result =
     AUInstrumentBase::Render(ioActionFlags, inTimeStamp, inNumberFrames);
-    if (result == noErr) {
-        mCallbackHelper.FireAtTimeStamp(inTimeStamp);
-    }
+    if (result != noErr) return result;
+    
+    UInt64 start = PerformanceCounters::Now();
+    UInt32 numEvents = mEngine.Render(inTimeStamp, inNumberFrames);
+    mSysExLoader.SendReply(mEngine.Output(), inTimeStamp);
+    mPerformance.CycleRendered(start, numEvents, mEngine.Scheduler().Size(),
+                               mEngine.Output().OverflowCount(),
+                               mEngine.Scheduler().DroppedCount());
     return result;
 }
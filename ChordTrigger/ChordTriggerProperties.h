@@ -0,0 +1,89 @@
+#ifndef __ChordTriggerProperties_h__
+#define __ChordTriggerProperties_h__
+
+// Custom properties, global scope, element 0.
+enum {
+    // CFDataRef, read/write. The whole chord map in the packed form written
+    // by ChordMap::Save(). The caller releases the CFDataRef returned by Get.
+    kChordTriggerProperty_ChordMap = 64000,
+    
+    // UInt32, read/write while uninitialized. Capacity of the per-render
+    // MIDI output event store; events beyond it are dropped and counted.
+    kChordTriggerProperty_MaxEventsPerCycle = 64001,
+    
+    // ChordTriggerOutputBufferStats, read only.
+    kChordTriggerProperty_OutputBufferStats = 64002,
+    
+    // CFDataRef, read/write. A chord map bank image as written by
+    // ChordMapBank::Save(); NULL removes the bank. While a bank is loaded,
+    // Program Change on the listened channel(s) selects its programs instead
+    // of being passed through. Get returns NULL if there is no bank.
+    kChordTriggerProperty_ChordMapBank = 64003,
+    
+    // CFURLRef, write only. Loads a bank image file.
+    kChordTriggerProperty_ChordMapBankFile = 64004,
+    
+    // ChordTriggerUMPOutputCallbackStruct, write only. Receives the output
+    // as Universal MIDI Packets in addition to the MIDI 1.0 output callback.
+    kChordTriggerProperty_UMPOutputCallback = 64005,
+    
+    // ChordTriggerPerformanceStats, read only. Safe to poll from any thread
+    // while rendering; reading never blocks the render thread.
+    kChordTriggerProperty_PerformanceStats = 64006,
+    
+    // CFURLRef, write only. Starts tracing every incoming message, what was
+    // done with it and every render slice into a text file, replacing its
+    // contents; NULL stops tracing. Recording is lock free, so it can stay
+    // on while playing. Debug builds trace to ~/Desktop/Debug.log.
+    kChordTriggerProperty_TraceFile = 64007
+};
+
+// Usage of the MIDI output buffers since the last Initialize, for tuning
+// kChordTriggerProperty_MaxEventsPerCycle.
+typedef struct ChordTriggerOutputBufferStats {
+    UInt32 packetListSize;        // bytes allocated for the packet list
+    UInt32 packetListHighWater;   // most bytes used by one render cycle
+    UInt32 splitFlushCount;       // cycles that needed more than one callback
+    UInt32 droppedEventCount;     // events lost to a full event store
+} ChordTriggerOutputBufferStats;
+
+enum { kChordTriggerCycleTimeBucketCount = 16 };
+
+// Render-cycle counters since the last Initialize. MIDI path time is the
+// time spent in the chord engine, handling incoming events and flushing the
+// output. Bucket 0 of the histogram counts cycles whose MIDI path took less
+// than 1 us, bucket n cycles of 2^(n-1) to 2^n us; the last bucket also
+// takes everything longer.
+typedef struct ChordTriggerPerformanceStats {
+    UInt64 cycleCount;
+    UInt64 eventsIn;              // incoming MIDI messages
+    UInt64 eventsOut;             // messages sent to the output callbacks
+    UInt64 midiPathNanos;
+    UInt32 peakCycleNanos;        // longest MIDI path of one cycle
+    UInt32 peakEventsInPerCycle;
+    UInt32 peakEventsOutPerCycle;
+    UInt32 peakQueuedEvents;      // most strummed events waiting at a cycle end
+    UInt32 droppedEventCount;     // lost to a full output event store
+    UInt32 unscheduledEventCount; // lost to a full strum queue
+    UInt32 cycleTimeHistogram[kChordTriggerCycleTimeBucketCount];
+} ChordTriggerPerformanceStats;
+
+// One output message. words[0] holds the message type: 0x2 messages
+// (MIDI 1.0 channel voice, words[1] unused) are what came in as MIDI 1.0,
+// 0x4 messages (MIDI 2.0 channel voice) what came in as MIDI 2.0.
+typedef struct ChordTriggerUMPEvent {
+    UInt32 words[2];
+    UInt32 startFrame;            // frame offset into the render slice
+} ChordTriggerUMPEvent;
+
+// Called once per render cycle with the events of the cycle in frame order.
+typedef OSStatus (*ChordTriggerUMPOutputCallback)(
+    void *userData, const AudioTimeStamp *timeStamp, UInt32 numEvents,
+    const ChordTriggerUMPEvent *events);
+
+typedef struct ChordTriggerUMPOutputCallbackStruct {
+    ChordTriggerUMPOutputCallback umpOutputCallback;   // NULL to disable
+    void *userData;
+} ChordTriggerUMPOutputCallbackStruct;
+
+#endif
@@ -0,0 +1,95 @@
+//
+//  DiatonicChords.h
+//  ChordTrigger
+//
+//  Generates a chord map that harmonises every note of a key and scale with
+//  the diatonic chord built on it. The scale and chord shapes are constant
+//  tables; FillDiatonicChords() expands them for one key into all 128 chord
+//  map entries on the editing side, so playing stays a single
+//  ChordMap::Lookup per note. Notes outside the scale pass through.
+//
+
+#ifndef __DiatonicChords__
+#define __DiatonicChords__
+
+#include "ChordMap.h"
+
+enum {
+  kDiatonicScaleMajor = 0,
+  kDiatonicScaleDorian,
+  kDiatonicScalePhrygian,
+  kDiatonicScaleLydian,
+  kDiatonicScaleMixolydian,
+  kDiatonicScaleMinor,
+  kDiatonicScaleLocrian,
+  kDiatonicScaleHarmonicMinor,
+  kDiatonicScaleMelodicMinor,
+  kDiatonicScaleCount
+};
+
+enum {
+  kDiatonicChordTriad = 0,
+  kDiatonicChordSeventh,
+  kDiatonicChordNinth,
+  kDiatonicChordSus2,
+  kDiatonicChordSus4,
+  kDiatonicChordCount
+};
+
+enum { kDiatonicDegreeCount = 7, kDiatonicMaxChordDegrees = 5 };
+
+// semitones of each degree above the tonic
+static const UInt8 kDiatonicScaleSteps[kDiatonicScaleCount]
+                                      [kDiatonicDegreeCount] = {
+    {0, 2, 4, 5, 7, 9, 11},  // major
+    {0, 2, 3, 5, 7, 9, 10},  // dorian
+    {0, 1, 3, 5, 7, 8, 10},  // phrygian
+    {0, 2, 4, 6, 7, 9, 11},  // lydian
+    {0, 2, 4, 5, 7, 9, 10},  // mixolydian
+    {0, 2, 3, 5, 7, 8, 10},  // natural minor
+    {0, 1, 3, 5, 6, 8, 10},  // locrian
+    {0, 2, 3, 5, 7, 8, 11},  // harmonic minor
+    {0, 2, 3, 5, 7, 9, 11},  // melodic minor
+};
+
+typedef struct DiatonicChordShape {
+  int numDegrees;
+  UInt8 degrees[kDiatonicMaxChordDegrees];  // scale steps above the root
+} DiatonicChordShape;
+
+static const DiatonicChordShape kDiatonicChordShapes[kDiatonicChordCount] = {
+    {3, {0, 2, 4}},        // triad
+    {4, {0, 2, 4, 6}},     // seventh
+    {5, {0, 2, 4, 6, 8}},  // ninth
+    {3, {0, 1, 4}},        // sus2
+    {3, {0, 3, 4}},        // sus4
+};
+
+// Replaces every chord of |map|. |key| is the tonic's pitch class (0 = C).
+inline void FillDiatonicChords(ChordMap &map, int key, int scale,
+                               int chordType) {
+  const UInt8 *steps = kDiatonicScaleSteps[scale];
+  const DiatonicChordShape &shape = kDiatonicChordShapes[chordType];
+
+  for (int trigger = 0; trigger < kChordMapNoteCount; trigger++) {
+    int pitchClass = (trigger - key % 12 + 12) % 12, degree = 0;
+    while (degree < kDiatonicDegreeCount && steps[degree] != pitchClass)
+      degree++;
+    if (degree == kDiatonicDegreeCount) {
+      map.SetChord(trigger, NULL, 0);
+      continue;
+    }
+
+    UInt8 notes[kDiatonicMaxChordDegrees];
+    int numNotes = 0;
+    for (int i = 0; i < shape.numDegrees; i++) {
+      int d = degree + shape.degrees[i];
+      int note = trigger - steps[degree] + steps[d % kDiatonicDegreeCount] +
+                 12 * (d / kDiatonicDegreeCount);
+      if (note < kChordMapNoteCount) notes[numNotes++] = (UInt8)note;
+    }
+    map.SetChord(trigger, notes, numNotes);
+  }
+}
+
+#endif /* defined(__DiatonicChords__) */
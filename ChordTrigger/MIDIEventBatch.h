@@ -0,0 +1,95 @@
+//
+//  MIDIEventBatch.h
+//  ChordTrigger
+//
+//  Decodes a MIDIPacketList into a flat array of messages as UMP words with
+//  their start frames, up to kCapacity at a time, so the chord transform can
+//  run over the whole array in one loop. Channel voice messages become MIDI
+//  1.0 channel voice words, system common and real-time messages system
+//  words.
+//
+//  The bytes go through the caller's AUMIDIParser, which keeps running
+//  status, partial messages and SysEx between packets and packet lists.
+//  As in AUMIDIBase::HandleMIDIPacketList, every message starts at the
+//  timeStamp of the packet it completes in.
+//
+
+#ifndef __MIDIEventBatch__
+#define __MIDIEventBatch__
+
+#include <CoreMIDI/CoreMIDI.h>
+#include "AUMIDIParser.h"
+#include "UniversalMIDIPacket.h"
+
+class MIDIEventBatch {
+ public:
+  enum { kCapacity = 128 };
+
+  MIDIEventBatch(AUMIDIParser &parser, const MIDIPacketList *pktlist)
+      : mParser(parser),
+        mPacket(&pktlist->packet[0]),
+        mPacketsLeft(pktlist->numPackets),
+        mByte(NULL),
+        mPacketEnd(NULL),
+        mCount(0),
+        mHasSysEx(false) {
+    if (mPacketsLeft > 0) StartPacket();
+  }
+
+  // Replaces the batch with the next messages of the list. A batch ends
+  // early at a piece of SysEx, which then follows its messages. Returns
+  // false once the list is used up.
+  bool DecodeNext() {
+    mCount = 0;
+    mHasSysEx = false;
+    while (mCount < kCapacity) {
+      if (!mParser.Next(mByte, mPacketEnd, mMessage)) {
+        if (--mPacketsLeft <= 0) break;
+        mPacket = MIDIPacketNext(mPacket);
+        StartPacket();
+        continue;
+      }
+      UInt8 status = mMessage.status;
+      if (status == 0xF0) {
+        mHasSysEx = true;
+        break;
+      }
+      mWords[mCount] =
+          status < 0xF0
+              ? UMPMakeMIDI1(0, status & 0xF0, status & 0x0F, mMessage.data1,
+                             mMessage.data2)
+              : UMPMakeSystem(0, status, mMessage.data1, mMessage.data2);
+      mFrames[mCount++] = mFrame;
+    }
+    return mCount > 0 || mHasSysEx;
+  }
+
+  UInt32 Count() const { return mCount; }
+  UInt32 Word(UInt32 index) const { return mWords[index]; }
+  UInt32 Frame(UInt32 index) const { return mFrames[index]; }
+
+  // The piece of SysEx after the batch's messages, or NULL. It points into
+  // the packet list.
+  const AUMIDIMessage *SysEx() const { return mHasSysEx ? &mMessage : NULL; }
+
+ private:
+  void StartPacket() {
+    mByte = mPacket->data;
+    mPacketEnd = mByte + mPacket->length;
+    mFrame = (UInt32)mPacket->timeStamp;
+  }
+
+  AUMIDIParser &mParser;
+  const MIDIPacket *mPacket;
+  SInt32 mPacketsLeft;  // including mPacket
+  const UInt8 *mByte;
+  const UInt8 *mPacketEnd;
+  UInt32 mFrame;
+  UInt32 mCount;
+  bool mHasSysEx;
+  AUMIDIMessage mMessage;
+  UInt32 mWords[kCapacity];
+  UInt32 mFrames[kCapacity];
+};
+
+#endif /* defined(__MIDIEventBatch__) */
@@ -0,0 +1,115 @@
+//
+//  MIDIEventScheduler.h
+//  ChordTrigger
+//
+//  Holds MIDI events that are due later than the current render slice,
+//  ordered by absolute sample time in a fixed-capacity binary min-heap.
+//  Scheduling and dispatching are O(log n) and never allocate; the storage
+//  is reserved up front by SetCapacity().
+//
+
+#ifndef __MIDIEventScheduler__
+#define __MIDIEventScheduler__
+
+#include "MIDIOutputCallbackHelper.h"
+
+typedef struct ScheduledMIDIEvent {
+  SInt64 sampleTime;
+  UInt32 sequence;  // keeps events due at the same time in schedule order
+  UInt32 words[2];  // UMP, as queued by MIDIOutputCallbackHelper
+} ScheduledMIDIEvent;
+
+class MIDIEventScheduler {
+ public:
+  enum { kDefaultCapacity = 4096 };
+
+  MIDIEventScheduler()
+      : mHeap(NULL), mSize(0), mCapacity(0), mSequence(0), mDroppedCount(0) {
+    SetCapacity(kDefaultCapacity);
+  }
+
+  ~MIDIEventScheduler() { delete[] mHeap; }
+
+  // Not real-time safe. Pending events are discarded.
+  void SetCapacity(UInt32 inCapacity) {
+    if (inCapacity == 0) inCapacity = 1;
+    if (inCapacity != mCapacity) {
+      delete[] mHeap;
+      mHeap = new ScheduledMIDIEvent[inCapacity];
+      mCapacity = inCapacity;
+    }
+    Clear();
+  }
+
+  void Clear() {
+    mSize = 0;
+    mSequence = 0;
+    mDroppedCount = 0;
+  }
+
+  UInt32 Size() const { return mSize; }
+  UInt32 DroppedCount() const { return mDroppedCount; }
+
+  // Returns false (and counts the event as dropped) when the heap is full.
+  bool Schedule(SInt64 sampleTime, UInt32 word0, UInt32 word1) {
+    if (mSize == mCapacity) {
+      mDroppedCount++;
+      return false;
+    }
+    ScheduledMIDIEvent event = {sampleTime, mSequence++, {word0, word1}};
+    UInt32 i = mSize++;
+    while (i > 0) {
+      UInt32 parent = (i - 1) / 2;
+      if (!Earlier(event, mHeap[parent])) break;
+      mHeap[i] = mHeap[parent];
+      i = parent;
+    }
+    mHeap[i] = event;
+    return true;
+  }
+
+  // Moves every event due before |inStartSampleTime + inNumberFrames| into
+  // |outHelper|, at its frame offset within the slice. Late events are sent
+  // at frame 0.
+  void Dispatch(SInt64 inStartSampleTime, UInt32 inNumberFrames,
+                MIDIOutputCallbackHelper &outHelper) {
+    SInt64 endSampleTime = inStartSampleTime + inNumberFrames;
+    while (mSize > 0 && mHeap[0].sampleTime < endSampleTime) {
+      const ScheduledMIDIEvent &event = mHeap[0];
+      SInt64 offset = event.sampleTime - inStartSampleTime;
+      outHelper.AddUMPEvent(event.words[0], event.words[1],
+                            offset > 0 ? (UInt32)offset : 0);
+      PopFront();
+    }
+  }
+
+ private:
+  static bool Earlier(const ScheduledMIDIEvent &a,
+                      const ScheduledMIDIEvent &b) {
+    if (a.sampleTime != b.sampleTime) return a.sampleTime < b.sampleTime;
+    return (SInt32)(a.sequence - b.sequence) < 0;
+  }
+
+  void PopFront() {
+    ScheduledMIDIEvent last = mHeap[--mSize];
+    UInt32 i = 0;
+    for (;;) {
+      UInt32 child = 2 * i + 1;
+      if (child >= mSize) break;
+      if (child + 1 < mSize && Earlier(mHeap[child + 1], mHeap[child]))
+        child++;
+      if (!Earlier(mHeap[child], last)) break;
+      mHeap[i] = mHeap[child];
+      i = child;
+    }
+    mHeap[i] = last;
+  }
+
+  ScheduledMIDIEvent *mHeap;
+  UInt32 mSize;
+  UInt32 mCapacity;
+  UInt32 mSequence;
+  UInt32 mDroppedCount;
+};
+
+#endif /* defined(__MIDIEventScheduler__) */
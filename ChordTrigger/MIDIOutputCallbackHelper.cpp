@@ -6,56 +6,224 @@
 //
 
 #include "MIDIOutputCallbackHelper.h"
+#include <stddef.h>
+#include <string.h>
 
-void MIDIOutputCallbackHelper::AddMIDIEvent(UInt8 status, UInt8 channel,
-                                            UInt8 data1, UInt8 data2,
-                                            UInt32 inStartFrame) {
-  MIDIMessageInfoStruct info = {status, channel, data1, data2, inStartFrame};
-  mMIDIMessageList.push_back(info);
+void MIDIOutputCallbackHelper::SetMaxEvents(UInt32 inMaxEvents) {
+  if (inMaxEvents == 0) inMaxEvents = 1;
+  if (inMaxEvents != mMaxEvents) {
+    delete[] mMIDIMessageList;
+    delete[] mSortBuffer;
+    mMIDIMessageList = new MIDIMessageInfoStruct[inMaxEvents];
+    mSortBuffer = new MIDIMessageInfoStruct[inMaxEvents];
+    mMaxEvents = inMaxEvents;
+
+    // worst case every event lands in its own packet: packet header, its
+    // MIDI 1.0 bytes and up to three bytes of alignment padding
+    UInt32 size = (UInt32)offsetof(MIDIPacketList, packet) +
+                  inMaxEvents * (UInt32)(offsetof(MIDIPacket, data) +
+                                         kMaxMIDI1Bytes + 3);
+    if (size < kMinSizeofMIDIBuffer) size = kMinSizeofMIDIBuffer;
+
+    delete[] mMIDIBuffer;
+    mMIDIBuffer = new Byte[size];
+    mSizeofMIDIBuffer = size;
+  }
+  mNumEvents = 0;
+  mOverflowCount = 0;
+  mPacketListHighWater = 0;
+  mSplitFlushCount = 0;
 }
 
-void MIDIOutputCallbackHelper::FireAtTimeStamp(
-    const AudioTimeStamp &inTimeStamp) {
-  if (!mMIDIMessageList.empty()) {
-    if (mMIDICallbackStruct.midiOutputCallback) {
-      // synthesize the packet list and call the MIDIOutputCallback
-      // iterate through the vector and get each item
-      MIDIPacketList *pktlist = PacketList();
-
-      MIDIPacket *pkt = MIDIPacketListInit(pktlist);
-
-      for (MIDIMessageList::iterator iter = mMIDIMessageList.begin();
-           iter != mMIDIMessageList.end(); iter++) {
-        const MIDIMessageInfoStruct &item = *iter;
-
-        Byte midiStatusByte = item.status + item.channel;
-        const Byte data[3] = {midiStatusByte, item.data1, item.data2};
-        UInt32 midiDataCount =
-            ((item.status == 0xC || item.status == 0xD) ? 2 : 3);
-
-        pkt = MIDIPacketListAdd(pktlist, kSizeofMIDIBuffer, pkt,
-                                item.startFrame, midiDataCount, data);
-        if (!pkt) {
-          // send what we have and then clear the buffer and then go through
-          // this again issue the callback with what we got
-          OSStatus result = (*mMIDICallbackStruct.midiOutputCallback)(
-              mMIDICallbackStruct.userData, &inTimeStamp, 0, pktlist);
-          if (result != noErr)
-            printf("error calling output callback: %d", (int)result);
-
-          // clear stuff we've already processed, and fire again
-          mMIDIMessageList.erase(mMIDIMessageList.begin(), iter);
-          FireAtTimeStamp(inTimeStamp);
-          return;
-        }
+void MIDIOutputCallbackHelper::UpdateHighWater(const MIDIPacket *pkt) {
+  UInt32 used = (UInt32)(pkt->data + pkt->length - mMIDIBuffer);
+  if (used > mPacketListHighWater) mPacketListHighWater = used;
+}
+
+void MIDIOutputCallbackHelper::FirePacketList(const AudioTimeStamp &inTimeStamp,
+                                              const MIDIPacketList *pktlist) {
+  OSStatus result = (*mMIDICallbackStruct.midiOutputCallback)(
+      mMIDICallbackStruct.userData, &inTimeStamp, 0, pktlist);
+  if (result != noErr) printf("error calling output callback: %d", (int)result);
+}
+
+// Returns the queued events in frame order, keeping insertion order within a
+// frame. Events are usually already in order, which is checked first; when
+// they aren't, an LSD radix sort over the bytes of the frame offset is used,
+// so the cost stays linear in the number of events.
+const MIDIMessageInfoStruct *MIDIOutputCallbackHelper::SortedEvents() {
+  UInt32 maxFrame = 0;
+  bool sorted = true;
+  for (UInt32 i = 0; i < mNumEvents; i++) {
+    UInt32 frame = mMIDIMessageList[i].startFrame;
+    if (i > 0 && frame < mMIDIMessageList[i - 1].startFrame) sorted = false;
+    if (frame > maxFrame) maxFrame = frame;
+  }
+  if (sorted) return mMIDIMessageList;
+
+  MIDIMessageInfoStruct *src = mMIDIMessageList, *dst = mSortBuffer;
+  for (UInt32 shift = 0; shift < 32 && (maxFrame >> shift) != 0; shift += 8) {
+    UInt32 offsets[256];
+    memset(offsets, 0, sizeof(offsets));
+    for (UInt32 i = 0; i < mNumEvents; i++)
+      offsets[(src[i].startFrame >> shift) & 0xFF]++;
+
+    UInt32 total = 0;
+    for (int b = 0; b < 256; b++) {
+      UInt32 count = offsets[b];
+      offsets[b] = total;
+      total += count;
+    }
+    for (UInt32 i = 0; i < mNumEvents; i++)
+      dst[offsets[(src[i].startFrame >> shift) & 0xFF]++] = src[i];
+
+    MIDIMessageInfoStruct *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+  return src;
+}
+
+MIDIPacket *MIDIOutputCallbackHelper::AddPacket(
+    const AudioTimeStamp &inTimeStamp, MIDIPacket *pkt, UInt32 startFrame,
+    const Byte *data, UInt32 length) {
+  MIDIPacketList *pktlist = PacketList();
+  MIDIPacket *next = MIDIPacketListAdd(pktlist, mSizeofMIDIBuffer, pkt,
+                                       startFrame, length, data);
+  if (!next) {
+    // send what we have and start over with an empty packet list
+    UpdateHighWater(pkt);
+    mSplitFlushCount++;
+    FirePacketList(inTimeStamp, pktlist);
+    next = MIDIPacketListInit(pktlist);
+    next = MIDIPacketListAdd(pktlist, mSizeofMIDIBuffer, next, startFrame,
+                             length, data);
+  }
+  return next;
+}
+
+// Converts a queued message to MIDI 1.0 bytes following the MIDI 2.0
+// translation rules and returns the number of bytes written, 0 if the
+// message has no MIDI 1.0 equivalent (e.g. per-note controllers).
+static UInt32 MIDI1Bytes(const MIDIMessageInfoStruct &item, Byte *out) {
+  UInt32 word0 = item.words[0], word1 = item.words[1];
+  UInt8 status = UMPStatus(word0), channel = UMPChannel(word0);
+
+  if (UMPMessageType(word0) == kUMPTypeMIDI1ChannelVoice) {
+    out[0] = status | channel;
+    out[1] = UMPData1(word0);
+    out[2] = UMPData2(word0);
+    return (status == 0xC0 || status == 0xD0) ? 2 : 3;
+  }
+  if (UMPMessageType(word0) == kUMPTypeSystem) {
+    UInt8 system = UMPSystemStatus(word0);
+    out[0] = system;
+    out[1] = UMPData1(word0);
+    out[2] = UMPData2(word0);
+    if (system == 0xF2) return 3;  // song position
+    return (system == 0xF1 || system == 0xF3) ? 2 : 1;
+  }
+  if (UMPMessageType(word0) != kUMPTypeMIDI2ChannelVoice) return 0;
+
+  UInt32 length = 0;
+  switch (status) {
+    case 0x80:
+    case 0x90:
+      out[length++] = status | channel;
+      out[length++] = UMPData1(word0);
+      out[length] = UMPDownscaleVelocity(UMPVelocity(word1));
+      if (status == 0x90 && out[length] == 0) out[length] = 1;
+      return ++length;
+    case 0xA0:
+    case 0xB0:
+      out[length++] = status | channel;
+      out[length++] = UMPData1(word0);
+      out[length++] = word1 >> 25;
+      return length;
+    case 0xC0:
+      if (word0 & 1) {  // bank valid
+        out[length++] = 0xB0 | channel;
+        out[length++] = 0;
+        out[length++] = (word1 >> 8) & 0x7F;
+        out[length++] = 0xB0 | channel;
+        out[length++] = 32;
+        out[length++] = word1 & 0x7F;
       }
+      out[length++] = 0xC0 | channel;
+      out[length++] = (word1 >> 24) & 0x7F;
+      return length;
+    case 0xD0:
+      out[length++] = 0xD0 | channel;
+      out[length++] = word1 >> 25;
+      return length;
+    case 0xE0:
+      out[length++] = 0xE0 | channel;
+      out[length++] = (word1 >> 18) & 0x7F;
+      out[length++] = word1 >> 25;
+      return length;
+  }
+  return 0;
+}
 
-      // fire callback
-      OSStatus result = (*mMIDICallbackStruct.midiOutputCallback)(
-          mMIDICallbackStruct.userData, &inTimeStamp, 0, pktlist);
-      if (result != noErr)
-        printf("error calling output callback: %d", (int)result);
+void MIDIOutputCallbackHelper::FireMIDIPacketList(
+    const AudioTimeStamp &inTimeStamp, const MIDIMessageInfoStruct *events) {
+  // synthesize the packet list and call the MIDIOutputCallback. All
+  // messages sharing a frame are packed into a single MIDIPacket.
+  MIDIPacket *pkt = MIDIPacketListInit(PacketList());
+
+  Byte data[kMaxPacketData];
+  UInt32 length = 0;
+  UInt32 frame = events[0].startFrame;
+
+  for (UInt32 i = 0; i < mNumEvents; i++) {
+    const MIDIMessageInfoStruct &item = events[i];
+    if (item.startFrame != frame || length + kMaxMIDI1Bytes > kMaxPacketData) {
+      if (length > 0) pkt = AddPacket(inTimeStamp, pkt, frame, data, length);
+      frame = item.startFrame;
+      length = 0;
     }
-    mMIDIMessageList.clear();
+    length += MIDI1Bytes(item, data + length);
+  }
+  if (length > 0) pkt = AddPacket(inTimeStamp, pkt, frame, data, length);
+  if (PacketList()->numPackets == 0) return;
+
+  UpdateHighWater(pkt);
+  FirePacketList(inTimeStamp, PacketList());
+}
+
+void MIDIOutputCallbackHelper::FireUMPEvents(
+    const AudioTimeStamp &inTimeStamp, const MIDIMessageInfoStruct *events) {
+  OSStatus result = (*mUMPCallbackStruct.umpOutputCallback)(
+      mUMPCallbackStruct.userData, &inTimeStamp, mNumEvents, events);
+  if (result != noErr)
+    printf("error calling UMP output callback: %d", (int)result);
+}
+
+void MIDIOutputCallbackHelper::FireAtTimeStamp(
+    const AudioTimeStamp &inTimeStamp) {
+  if (mNumEvents == 0) return;
+
+  if (mMIDICallbackStruct.midiOutputCallback ||
+      mUMPCallbackStruct.umpOutputCallback) {
+    const MIDIMessageInfoStruct *events = SortedEvents();
+    if (mMIDICallbackStruct.midiOutputCallback)
+      FireMIDIPacketList(inTimeStamp, events);
+    if (mUMPCallbackStruct.umpOutputCallback)
+      FireUMPEvents(inTimeStamp, events);
+  }
+  mNumEvents = 0;
+}
+
+void MIDIOutputCallbackHelper::FireSysEx(const AudioTimeStamp &inTimeStamp,
+                                         const Byte *data, UInt32 length) {
+  if (!mMIDICallbackStruct.midiOutputCallback || length == 0) return;
+
+  MIDIPacket *pkt = MIDIPacketListInit(PacketList());
+  for (UInt32 offset = 0; offset < length; offset += kMaxPacketData) {
+    UInt32 chunk = length - offset;
+    if (chunk > kMaxPacketData) chunk = kMaxPacketData;
+    pkt = AddPacket(inTimeStamp, pkt, 0, data + offset, chunk);
   }
+  UpdateHighWater(pkt);
+  FirePacketList(inTimeStamp, PacketList());
 }
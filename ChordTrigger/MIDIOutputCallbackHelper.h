@@ -11,47 +11,134 @@
 
 #include <iostream>
 #include <CoreMIDI/CoreMIDI.h>
-#include <vector>
+#include "ChordTriggerProperties.h"
+#include "UniversalMIDIPacket.h"
 
-#endif /* defined(__MIDIOutputCallbackHelper__) */
-
-typedef struct MIDIMessageInfoStruct {
-  UInt8 status;
-  UInt8 channel;
-  UInt8 data1;
-  UInt8 data2;
-  UInt32 startFrame;
-} MIDIMessageInfoStruct;
+// Queued messages use the layout of the UMP output callback, so sorted
+// events can be handed to it without copying.
+typedef ChordTriggerUMPEvent MIDIMessageInfoStruct;
 
+// Queues the MIDI events generated during one render cycle and hands them to
+// the host's MIDI output callback. The event store is a fixed-capacity array
+// sized by SetMaxEvents(), so nothing is allocated on the render thread;
+// events that don't fit are dropped and counted. On flush the events are
+// stable-sorted by frame and all messages of one frame go out in one packet.
+// The packet list buffer is sized so that a full event store still fits,
+// which keeps it to one output callback per render cycle.
+//
+// Events are kept as UMP words whatever their origin and only converted at
+// flush: to MIDI 1.0 bytes for the AU MIDI output callback, and handed over
+// as they are to the UMP output callback.
 class MIDIOutputCallbackHelper {
-  enum { kSizeofMIDIBuffer = 512 };
+  // a MIDI 2.0 program change with bank select is three MIDI 1.0 messages
+  enum {
+    kMinSizeofMIDIBuffer = 512,
+    kMaxPacketData = 255,
+    kMaxMIDI1Bytes = 8
+  };
 
  public:
-  MIDIOutputCallbackHelper() {
-    mMIDIMessageList.reserve(64);
+  enum { kDefaultMaxEvents = 1024 };
+
+  MIDIOutputCallbackHelper()
+      : mMIDIBuffer(NULL),
+        mSizeofMIDIBuffer(0),
+        mMIDIMessageList(NULL),
+        mSortBuffer(NULL),
+        mNumEvents(0),
+        mMaxEvents(0),
+        mOverflowCount(0),
+        mPacketListHighWater(0),
+        mSplitFlushCount(0) {
     mMIDICallbackStruct.midiOutputCallback = NULL;
-    mMIDIBuffer = new Byte[kSizeofMIDIBuffer];
+    mUMPCallbackStruct.umpOutputCallback = NULL;
+    SetMaxEvents(kDefaultMaxEvents);
   }
 
-  ~MIDIOutputCallbackHelper() { delete[] mMIDIBuffer; }
+  ~MIDIOutputCallbackHelper() {
+    delete[] mMIDIBuffer;
+    delete[] mMIDIMessageList;
+    delete[] mSortBuffer;
+  }
 
   void SetCallbackInfo(AUMIDIOutputCallback &callback, void *userData) {
     mMIDICallbackStruct.midiOutputCallback = callback;
     mMIDICallbackStruct.userData = userData;
   }
 
-  void AddMIDIEvent(UInt8 status, UInt8 channel, UInt8 data1, UInt8 data2,
-                    UInt32 inStartFrame);
+  void SetUMPCallbackInfo(const ChordTriggerUMPOutputCallbackStruct &info) {
+    mUMPCallbackStruct = info;
+  }
+
+  // Resizes the event store and the packet list buffer. Not real-time safe:
+  // call it from Initialize or while the unit is uninitialized. Pending events
+  // are discarded.
+  void SetMaxEvents(UInt32 inMaxEvents);
+  UInt32 MaxEvents() const { return mMaxEvents; }
+
+  // Number of events dropped because the store was full.
+  UInt32 OverflowCount() const { return mOverflowCount; }
+
+  // Largest number of packet list bytes used by a single flush, and how
+  // many flushes still needed more than one output callback.
+  UInt32 PacketListHighWater() const { return mPacketListHighWater; }
+  UInt32 PacketListSize() const { return mSizeofMIDIBuffer; }
+  UInt32 SplitFlushCount() const { return mSplitFlushCount; }
+
+  // Events queued for the next FireAtTimeStamp.
+  UInt32 NumEvents() const { return mNumEvents; }
+
+  // |word1| is ignored for one-word messages.
+  void AddUMPEvent(UInt32 word0, UInt32 word1, UInt32 inStartFrame) {
+    if (mNumEvents == mMaxEvents) {
+      mOverflowCount++;
+      return;
+    }
+    MIDIMessageInfoStruct &info = mMIDIMessageList[mNumEvents++];
+    info.words[0] = word0;
+    info.words[1] = word1;
+    info.startFrame = inStartFrame;
+  }
 
   void FireAtTimeStamp(const AudioTimeStamp &inTimeStamp);
 
+  // Sends a complete SysEx message to the MIDI output callback at frame 0,
+  // in as many packets and callbacks as it takes. Call it after
+  // FireAtTimeStamp so no other message lands in the middle of it.
+  void FireSysEx(const AudioTimeStamp &inTimeStamp, const Byte *data,
+                 UInt32 length);
+
  private:
   MIDIPacketList *PacketList() { return (MIDIPacketList *)mMIDIBuffer; }
 
+  void FirePacketList(const AudioTimeStamp &inTimeStamp,
+                      const MIDIPacketList *pktlist);
+
+  const MIDIMessageInfoStruct *SortedEvents();
+
+  void FireMIDIPacketList(const AudioTimeStamp &inTimeStamp,
+                          const MIDIMessageInfoStruct *events);
+  void FireUMPEvents(const AudioTimeStamp &inTimeStamp,
+                     const MIDIMessageInfoStruct *events);
+
+  MIDIPacket *AddPacket(const AudioTimeStamp &inTimeStamp, MIDIPacket *pkt,
+                        UInt32 startFrame, const Byte *data, UInt32 length);
+
+  void UpdateHighWater(const MIDIPacket *pkt);
+
   Byte *mMIDIBuffer;
+  UInt32 mSizeofMIDIBuffer;
 
   AUMIDIOutputCallbackStruct mMIDICallbackStruct;
+  ChordTriggerUMPOutputCallbackStruct mUMPCallbackStruct;
 
-  typedef std::vector<MIDIMessageInfoStruct> MIDIMessageList;
-  MIDIMessageList mMIDIMessageList;
+  MIDIMessageInfoStruct *mMIDIMessageList;
+  MIDIMessageInfoStruct *mSortBuffer;
+  UInt32 mNumEvents;
+  UInt32 mMaxEvents;
+  UInt32 mOverflowCount;
+  UInt32 mPacketListHighWater;
+  UInt32 mSplitFlushCount;
 };
+
+#endif /* defined(__MIDIOutputCallbackHelper__) */
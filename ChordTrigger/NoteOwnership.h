@@ -0,0 +1,70 @@
+//
+//  NoteOwnership.h
+//  ChordTrigger
+//
+//  Tracks which trigger notes are holding which output notes on one MIDI
+//  channel. Every output note keeps a reference count and every trigger
+//  keeps a mask of the output notes it holds, so an output note is only
+//  switched on by the first trigger that wants it and only switched off once
+//  the last one lets go.
+//
+
+#ifndef __NoteOwnership__
+#define __NoteOwnership__
+
+#include "CABitOperations.h"
+#include <string.h>
+
+class NoteOwnership {
+ public:
+  enum { kNoteCount = 128, kMaskWords = kNoteCount / 32 };
+
+  NoteOwnership() { Clear(); }
+
+  void Clear() {
+    memset(mRefCount, 0, sizeof(mRefCount));
+    memset(mHeld, 0, sizeof(mHeld));
+  }
+
+  // Records that |trigger| holds |note|. Returns true on the 0 -> 1
+  // transition, i.e. when a note-on has to be sent.
+  bool Acquire(UInt8 trigger, UInt8 note) {
+    UInt32 &word = mHeld[trigger & 0x7F][note >> 5];
+    UInt32 bit = 1U << (note & 31);
+    if (word & bit) return false;
+
+    word |= bit;
+    return mRefCount[note & 0x7F]++ == 0;
+  }
+
+  // Releases every note held by |trigger| and writes the notes whose
+  // reference count dropped to zero into |outNotes|, which must hold
+  // kNoteCount entries. Returns the number of notes that need a note-off.
+  int ReleaseAll(UInt8 trigger, UInt8 *outNotes) {
+    UInt32 *held = mHeld[trigger & 0x7F];
+    int numNotes = 0;
+    for (int w = 0; w < kMaskWords; w++) {
+      UInt32 word = held[w];
+      held[w] = 0;
+      while (word) {
+        UInt8 note = (UInt8)(w * 32 + CountTrailingZeroes(word));
+        word &= word - 1;
+        if (--mRefCount[note] == 0) outNotes[numNotes++] = note;
+      }
+    }
+    return numNotes;
+  }
+
+  bool IsHeld(UInt8 trigger) const {
+    const UInt32 *held = mHeld[trigger & 0x7F];
+    return (held[0] | held[1] | held[2] | held[3]) != 0;
+  }
+
+  bool IsSounding(UInt8 note) const { return mRefCount[note & 0x7F] != 0; }
+
+ private:
+  UInt8 mRefCount[kNoteCount];
+  UInt32 mHeld[kNoteCount][kMaskWords];
+};
+
+#endif /* defined(__NoteOwnership__) */
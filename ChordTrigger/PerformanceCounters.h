@@ -0,0 +1,103 @@
+//
+//  PerformanceCounters.h
+//  ChordTrigger
+//
+//  Render-cycle counters for kChordTriggerProperty_PerformanceStats. The
+//  render thread times its MIDI work with CAHostTimeBase and folds each
+//  cycle into the published stats under a sequence count: odd while an
+//  update is in progress, even once it is done. Readers copy the stats and
+//  retry if the count was odd or moved, so the render thread never waits
+//  for them and they never see half an update.
+//
+
+#ifndef __PerformanceCounters__
+#define __PerformanceCounters__
+
+#include <string.h>
+#include "CAAtomic.h"
+#include "CABitOperations.h"
+#include "CAHostTimeBase.h"
+#include "ChordTriggerProperties.h"
+
+class PerformanceCounters {
+ public:
+  PerformanceCounters() {
+    // sets up the time base here rather than on the render thread
+    CAHostTimeBase::GetFrequency();
+    Reset();
+  }
+
+  // Not real-time safe and not concurrent with rendering.
+  void Reset() {
+    memset(&mStats, 0, sizeof(mStats));
+    mSequence = 0;
+    mCycleEventsIn = 0;
+    mCycleTicks = 0;
+  }
+
+  // Render thread.
+  static UInt64 Now() { return CAHostTimeBase::GetTheCurrentTime(); }
+
+  // |inStartTime| is Now() from before the events were handled.
+  void EventsHandled(UInt32 inNumEvents, UInt64 inStartTime) {
+    mCycleEventsIn += inNumEvents;
+    mCycleTicks += Now() - inStartTime;
+  }
+
+  // Ends the cycle. |inStartTime| is Now() from before the output was
+  // flushed; the counts are the engine's state after it.
+  void CycleRendered(UInt64 inStartTime, UInt32 inEventsOut,
+                     UInt32 inQueuedEvents, UInt32 inDroppedEvents,
+                     UInt32 inUnscheduledEvents) {
+    mCycleTicks += Now() - inStartTime;
+    UInt64 nanos = CAHostTimeBase::ConvertToNanos(mCycleTicks);
+    UInt32 cycleNanos = nanos > 0xFFFFFFFF ? 0xFFFFFFFF : (UInt32)nanos;
+
+    CAAtomicIncrement32Barrier(&mSequence);
+    mStats.cycleCount++;
+    mStats.eventsIn += mCycleEventsIn;
+    mStats.eventsOut += inEventsOut;
+    mStats.midiPathNanos += nanos;
+    KeepPeak(mStats.peakCycleNanos, cycleNanos);
+    KeepPeak(mStats.peakEventsInPerCycle, mCycleEventsIn);
+    KeepPeak(mStats.peakEventsOutPerCycle, inEventsOut);
+    KeepPeak(mStats.peakQueuedEvents, inQueuedEvents);
+    mStats.droppedEventCount = inDroppedEvents;
+    mStats.unscheduledEventCount = inUnscheduledEvents;
+    mStats.cycleTimeHistogram[Bucket(cycleNanos)]++;
+    CAAtomicIncrement32Barrier(&mSequence);
+
+    mCycleEventsIn = 0;
+    mCycleTicks = 0;
+  }
+
+  // Any thread.
+  void Read(ChordTriggerPerformanceStats &outStats) const {
+    for (;;) {
+      SInt32 sequence = CAAtomicAdd32Barrier(0, &mSequence);
+      if (sequence & 1) continue;
+      memcpy(&outStats, (const void *)&mStats, sizeof(outStats));
+      if (CAAtomicAdd32Barrier(0, &mSequence) == sequence) return;
+    }
+  }
+
+ private:
+  static void KeepPeak(UInt32 &ioPeak, UInt32 inValue) {
+    if (inValue > ioPeak) ioPeak = inValue;
+  }
+
+  static int Bucket(UInt32 inNanos) {
+    UInt32 micros = inNanos / 1000;
+    int bucket = micros == 0 ? 0 : 32 - (int)CountLeadingZeroes(micros);
+    return bucket < kChordTriggerCycleTimeBucketCount
+               ? bucket
+               : kChordTriggerCycleTimeBucketCount - 1;
+  }
+
+  ChordTriggerPerformanceStats mStats;  // published under mSequence
+  mutable volatile SInt32 mSequence;
+  UInt32 mCycleEventsIn;  // render thread only
+  UInt64 mCycleTicks;
+};
+
+#endif /* defined(__PerformanceCounters__) */
@@ -0,0 +1,63 @@
+//
+//  StrumTable.h
+//  ChordTrigger
+//
+//  Precomputed strum timing and velocity tilt. A chord member's frame offset
+//  and velocity change only depend on the chord size and on the member's
+//  pitch rank within the chord (ChordMapEntry::ranks), so both are baked
+//  into small tables whenever the strum settings or the sample rate change.
+//  The render thread only indexes them.
+//
+
+#ifndef __StrumTable__
+#define __StrumTable__
+
+#include "ChordMap.h"
+
+class StrumTable {
+ public:
+  enum { kStrumUp = 0, kStrumDown = 1 };
+
+  StrumTable() { Compute(44100., 0.f, kStrumUp, 0.f); }
+
+  // |strumTimeMs| is the time from the first to the last note of a chord.
+  // |velocityTilt| is the velocity change (-127..127) the last strummed note
+  // gets relative to the first; members in between are interpolated.
+  void Compute(Float64 sampleRate, Float32 strumTimeMs, int direction,
+               Float32 velocityTilt) {
+    Float64 span = sampleRate * strumTimeMs / 1000.;
+    mActive = span >= 1. || velocityTilt != 0.f;
+
+    for (int n = 1; n <= kChordMapMaxChordNotes; n++) {
+      for (int rank = 0; rank < n; rank++) {
+        int step = (direction == kStrumDown) ? n - 1 - rank : rank;
+        Float64 position = (n > 1) ? (Float64)step / (n - 1) : 0.;
+        mOffsets[n - 1][rank] = (UInt32)(span * position + 0.5);
+        mVelocityDelta[n - 1][rank] =
+            (SInt16)(velocityTilt * position + (velocityTilt < 0 ? -0.5 : 0.5));
+      }
+    }
+  }
+
+  bool IsActive() const { return mActive; }
+
+  UInt32 Offset(const ChordMapEntry &chord, int index) const {
+    return mOffsets[chord.numNotes - 1][chord.ranks[index]];
+  }
+
+  // |velocity| is 16 bit (MIDI 2.0); the tilt keeps its 7-bit steps, so a
+  // MIDI 1.0 velocity scaled up and back comes out as before.
+  UInt16 Velocity(const ChordMapEntry &chord, int index,
+                  UInt16 velocity) const {
+    SInt32 v = velocity +
+               mVelocityDelta[chord.numNotes - 1][chord.ranks[index]] * 0x200;
+    return (UInt16)(v < 0x200 ? 0x200 : (v > 0xFFFF ? 0xFFFF : v));
+  }
+
+ private:
+  bool mActive;
+  UInt32 mOffsets[kChordMapMaxChordNotes][kChordMapMaxChordNotes];
+  SInt16 mVelocityDelta[kChordMapMaxChordNotes][kChordMapMaxChordNotes];
+};
+
+#endif /* defined(__StrumTable__) */
@@ -0,0 +1,134 @@
+//
+//  TraceRing.h
+//  ChordTrigger
+//
+//  Binary trace of what the render thread does with each incoming message.
+//  Records have a fixed size and go into a preallocated single-producer,
+//  single-consumer ring: the render thread writes, one other thread (see
+//  TraceWriter) reads and formats them. Indices run freely and are only
+//  ever advanced by their owner, so neither side waits for the other; when
+//  the ring is full new records are dropped and counted.
+//
+//  Recording is switched at run time and costs one load and a branch while
+//  off, so it stays compiled into release builds.
+//
+
+#ifndef __TraceRing__
+#define __TraceRing__
+
+#include <CoreMIDI/CoreMIDI.h>
+#include "CAAtomic.h"
+
+enum {
+  kTraceEventMIDI = 1,  // an incoming message, as UMP words
+  kTraceEventRender     // a render slice; count = events sent
+};
+
+// What the engine did with an incoming message. count is the number of
+// output notes switched on or off.
+enum {
+  kTraceDecisionThru = 0,       // passed on unchanged
+  kTraceDecisionProgram = 1,    // selected a chord map bank program
+  kTraceDecisionChord = 2,      // note-on expanded into a chord
+  kTraceDecisionRelease = 3,    // note-off releasing a trigger
+  kTraceDecisionUnmapped = 4    // note without a chord, played as is
+};
+
+typedef struct TraceRecord {
+  SInt64 sampleTime;  // engine timeline: slice start plus frame offset
+  UInt32 words[2];    // kTraceEventRender: frames in words[0]
+  UInt8 event;
+  UInt8 decision;
+  UInt16 count;
+} TraceRecord;
+
+class TraceRing {
+ public:
+  enum { kDefaultCapacity = 4096 };
+
+  // |inCapacity| is rounded up to a power of two.
+  explicit TraceRing(UInt32 inCapacity = kDefaultCapacity)
+      : mEnabled(0),
+        mWriteIndex(0),
+        mCachedReadIndex(0),
+        mDroppedCount(0),
+        mReadIndex(0) {
+    mCapacity = 1;
+    while (mCapacity < inCapacity) mCapacity <<= 1;
+    mRecords = new TraceRecord[mCapacity];
+  }
+
+  ~TraceRing() { delete[] mRecords; }
+
+  // Any thread.
+  void SetEnabled(bool inEnabled) { Store(&mEnabled, inEnabled ? 1 : 0); }
+  bool IsEnabled() const { return Load(&mEnabled) != 0; }
+  UInt32 DroppedCount() const { return (UInt32)Load(&mDroppedCount); }
+
+  // Producer. The consumer's index is only reloaded when the ring looks
+  // full, so the producer rarely touches the consumer's cache line.
+  void Record(UInt8 inEvent, UInt8 inDecision, UInt16 inCount,
+              SInt64 inSampleTime, UInt32 inWord0, UInt32 inWord1) {
+    if (!IsEnabled()) return;
+    UInt32 write = (UInt32)mWriteIndex;
+    if (write - mCachedReadIndex == mCapacity) {
+      mCachedReadIndex = (UInt32)Load(&mReadIndex);
+      if (write - mCachedReadIndex == mCapacity) {
+        Store(&mDroppedCount, mDroppedCount + 1);
+        return;
+      }
+    }
+    TraceRecord &record = mRecords[write & (mCapacity - 1)];
+    record.sampleTime = inSampleTime;
+    record.words[0] = inWord0;
+    record.words[1] = inWord1;
+    record.event = inEvent;
+    record.decision = inDecision;
+    record.count = inCount;
+    Store(&mWriteIndex, (SInt32)(write + 1));
+  }
+
+  // Consumer. Copies up to |inMaxRecords| records and frees their slots in
+  // one step. Returns the number copied.
+  UInt32 Read(TraceRecord *outRecords, UInt32 inMaxRecords) {
+    UInt32 read = (UInt32)mReadIndex;
+    UInt32 available = (UInt32)Load(&mWriteIndex) - read;
+    if (available > inMaxRecords) available = inMaxRecords;
+    for (UInt32 i = 0; i < available; i++)
+      outRecords[i] = mRecords[(read + i) & (mCapacity - 1)];
+    if (available) Store(&mReadIndex, (SInt32)(read + available));
+    return available;
+  }
+
+  // Consumer. Drops everything recorded so far.
+  void Skip() { Store(&mReadIndex, Load(&mWriteIndex)); }
+
+ private:
+  enum { kCacheLineSize = 64 };
+
+  // CAAtomic has no plain loads and stores; the builtins give acquire and
+  // release ordering without a locked instruction per record
+  static SInt32 Load(const volatile SInt32 *inValue) {
+    return __atomic_load_n(inValue, __ATOMIC_ACQUIRE);
+  }
+  static void Store(volatile SInt32 *outValue, SInt32 inValue) {
+    __atomic_store_n(outValue, inValue, __ATOMIC_RELEASE);
+  }
+
+  TraceRecord *mRecords;
+  UInt32 mCapacity;
+  volatile SInt32 mEnabled;
+
+  // written by the producer only
+  char mProducerPad[kCacheLineSize];
+  volatile SInt32 mWriteIndex;
+  UInt32 mCachedReadIndex;
+  volatile SInt32 mDroppedCount;
+
+  // written by the consumer only
+  char mConsumerPad[kCacheLineSize];
+  volatile SInt32 mReadIndex;
+  char mTailPad[kCacheLineSize];
+};
+
+#endif /* defined(__TraceRing__) */
@@ -0,0 +1,123 @@
+//
+//  TraceWriter.cpp
+//  ChordTrigger
+//
+
+#include "TraceWriter.h"
+#include "UniversalMIDIPacket.h"
+#include <stdarg.h>
+#include <unistd.h>
+
+enum { kDrainIntervalMicros = 10000, kDrainBatchSize = 256 };
+
+static const char *const kDecisionNames[] = {"thru", "program", "chord",
+                                             "release", "unmapped"};
+
+TraceWriter::TraceWriter()
+    : mRing(NULL), mFile(NULL), mStop(0), mReportedDrops(0) {
+  pthread_mutex_init(&mFileMutex, NULL);
+}
+
+TraceWriter::~TraceWriter() {
+  Stop();
+  pthread_mutex_destroy(&mFileMutex);
+}
+
+bool TraceWriter::Start(TraceRing &ring, const char *path) {
+  Stop();
+  FILE *file = fopen(path, "w");
+  if (file == NULL) return false;
+
+  mRing = &ring;
+  mRing->Skip();
+  mReportedDrops = mRing->DroppedCount();
+  mStop = 0;
+  pthread_mutex_lock(&mFileMutex);
+  mFile = file;
+  pthread_mutex_unlock(&mFileMutex);
+  if (pthread_create(&mThread, NULL, Run, this) != 0) {
+    // no thread to join and nothing recorded to drain
+    pthread_mutex_lock(&mFileMutex);
+    mFile = NULL;
+    mRing = NULL;
+    pthread_mutex_unlock(&mFileMutex);
+    fclose(file);
+    return false;
+  }
+  mRing->SetEnabled(true);
+  return true;
+}
+
+void TraceWriter::Stop() {
+  if (mFile == NULL) return;
+
+  mRing->SetEnabled(false);
+  CAAtomicIncrement32Barrier(&mStop);
+  pthread_join(mThread, NULL);
+  Drain();
+
+  pthread_mutex_lock(&mFileMutex);
+  fclose(mFile);
+  mFile = NULL;
+  pthread_mutex_unlock(&mFileMutex);
+}
+
+void TraceWriter::Note(const char *format, ...) {
+  pthread_mutex_lock(&mFileMutex);
+  if (mFile) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(mFile, format, args);
+    va_end(args);
+    fputc('\n', mFile);
+  }
+  pthread_mutex_unlock(&mFileMutex);
+}
+
+void *TraceWriter::Run(void *writer) {
+  TraceWriter *self = (TraceWriter *)writer;
+  while (CAAtomicAdd32Barrier(0, &self->mStop) == 0) {
+    self->Drain();
+    usleep(kDrainIntervalMicros);
+  }
+  return NULL;
+}
+
+void TraceWriter::Drain() {
+  pthread_mutex_lock(&mFileMutex);
+  TraceRecord records[kDrainBatchSize];
+  UInt32 numRecords;
+  while ((numRecords = mRing->Read(records, kDrainBatchSize)) != 0)
+    for (UInt32 i = 0; i < numRecords; i++) Write(records[i]);
+
+  UInt32 dropped = mRing->DroppedCount();
+  if (dropped != mReportedDrops) {
+    fprintf(mFile, "-- ring full, %u records dropped\n",
+            (unsigned)(dropped - mReportedDrops));
+    mReportedDrops = dropped;
+  }
+  fflush(mFile);
+  pthread_mutex_unlock(&mFileMutex);
+}
+
+void TraceWriter::Write(const TraceRecord &record) {
+  if (record.event == kTraceEventRender) {
+    fprintf(mFile, "%12lld render %u frames, %u events out\n",
+            (long long)record.sampleTime, (unsigned)record.words[0],
+            (unsigned)record.count);
+    return;
+  }
+
+  const char *decision =
+      record.decision < sizeof(kDecisionNames) / sizeof(kDecisionNames[0])
+          ? kDecisionNames[record.decision]
+          : "?";
+  if (UMPWordCount(record.words[0]) == 1)
+    fprintf(mFile, "%12lld in %08X          %-8s %u\n",
+            (long long)record.sampleTime, (unsigned)record.words[0], decision,
+            (unsigned)record.count);
+  else
+    fprintf(mFile, "%12lld in %08X %08X %-8s %u\n",
+            (long long)record.sampleTime, (unsigned)record.words[0],
+            (unsigned)record.words[1], decision, (unsigned)record.count);
+}
@@ -0,0 +1,49 @@
+//
+//  TraceWriter.h
+//  ChordTrigger
+//
+//  Drains a TraceRing into a text file from a background thread, formatting
+//  the records only there, so the render thread never touches the file.
+//  Other threads can add lines of their own with Note().
+//
+
+#ifndef __TraceWriter__
+#define __TraceWriter__
+
+#include <pthread.h>
+#include <stdio.h>
+#include "TraceRing.h"
+
+class TraceWriter {
+ public:
+  TraceWriter();
+  ~TraceWriter();
+
+  // Replaces the contents of the file at |path| with the trace of |ring|
+  // from now on and enables recording. Returns false if the file can't be
+  // opened. Not real-time safe.
+  bool Start(TraceRing &ring, const char *path);
+
+  // Disables recording, writes what is left and closes the file.
+  void Stop();
+
+  bool IsRunning() const { return mFile != NULL; }
+
+  // printf-style; one line. Ignored while stopped. Not for the render
+  // thread.
+  void Note(const char *format, ...);
+
+ private:
+  static void *Run(void *writer);
+  void Drain();
+  void Write(const TraceRecord &record);
+
+  TraceRing *mRing;
+  FILE *mFile;
+  pthread_t mThread;
+  pthread_mutex_t mFileMutex;  // between the drain thread and Note()
+  volatile SInt32 mStop;
+  UInt32 mReportedDrops;
+};
+
+#endif /* defined(__TraceWriter__) */
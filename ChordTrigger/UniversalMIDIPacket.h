@@ -0,0 +1,82 @@
+//
+//  UniversalMIDIPacket.h
+//  ChordTrigger
+//
+//  Helpers for MIDI 2.0 Universal MIDI Packets. Messages are handled as
+//  32-bit words in host order: the message type, group, status and the
+//  first data byte(s) are all in word 0, so a message is classified with a
+//  shift and a mask instead of byte-wise status parsing.
+//
+//  Only the channel voice types are interpreted: 0x2 (MIDI 1.0, one word)
+//  and 0x4 (MIDI 2.0, two words). System messages (0x1) are passed through.
+//
+
+#ifndef __UniversalMIDIPacket__
+#define __UniversalMIDIPacket__
+
+#include <CoreMIDI/CoreMIDI.h>
+
+enum {
+  kUMPTypeSystem = 0x1,
+  kUMPTypeMIDI1ChannelVoice = 0x2,
+  kUMPTypeMIDI2ChannelVoice = 0x4
+};
+
+// Number of words in a message, by message type.
+static const UInt8 kUMPWordCount[16] = {1, 1, 1, 2, 2, 4, 1, 1,
+                                        2, 2, 2, 3, 3, 4, 4, 4};
+
+inline UInt32 UMPMessageType(UInt32 word0) { return word0 >> 28; }
+inline UInt32 UMPWordCount(UInt32 word0) { return kUMPWordCount[word0 >> 28]; }
+inline UInt8 UMPGroup(UInt32 word0) { return (word0 >> 24) & 0x0F; }
+inline UInt8 UMPStatus(UInt32 word0) { return (word0 >> 16) & 0xF0; }
+inline UInt8 UMPChannel(UInt32 word0) { return (word0 >> 16) & 0x0F; }
+inline UInt8 UMPData1(UInt32 word0) { return (word0 >> 8) & 0x7F; }
+inline UInt8 UMPData2(UInt32 word0) { return word0 & 0x7F; }
+
+// MIDI 2.0 note on/off: attribute type in word 0, velocity and attribute
+// data in word 1.
+inline UInt8 UMPAttributeType(UInt32 word0) { return word0 & 0xFF; }
+inline UInt16 UMPVelocity(UInt32 word1) { return word1 >> 16; }
+inline UInt16 UMPAttribute(UInt32 word1) { return word1 & 0xFFFF; }
+
+inline UInt32 UMPMakeMIDI1(UInt8 group, UInt8 status, UInt8 channel,
+                           UInt8 data1, UInt8 data2) {
+  return (kUMPTypeMIDI1ChannelVoice << 28) | ((UInt32)group << 24) |
+         ((UInt32)(status | channel) << 16) | ((UInt32)data1 << 8) | data2;
+}
+
+// System common and real-time messages, status 0xF1-0xFF.
+inline UInt32 UMPMakeSystem(UInt8 group, UInt8 status, UInt8 data1,
+                            UInt8 data2) {
+  return (kUMPTypeSystem << 28) | ((UInt32)group << 24) |
+         ((UInt32)status << 16) | ((UInt32)data1 << 8) | data2;
+}
+
+// The whole status byte of a system message.
+inline UInt8 UMPSystemStatus(UInt32 word0) { return (word0 >> 16) & 0xFF; }
+
+inline UInt32 UMPMakeMIDI2Word0(UInt8 group, UInt8 status, UInt8 channel,
+                                UInt8 index, UInt8 extra) {
+  return ((UInt32)kUMPTypeMIDI2ChannelVoice << 28) | ((UInt32)group << 24) |
+         ((UInt32)(status | channel) << 16) | ((UInt32)index << 8) | extra;
+}
+
+// 7 to 16 bit velocity, keeping 0, 64 and 127 at minimum, center and
+// maximum as the MIDI 2.0 translation rules require.
+inline UInt16 UMPUpscaleVelocity(UInt8 velocity) {
+  UInt32 value = (UInt32)(velocity & 0x7F) << 9;
+  if (velocity <= 64) return (UInt16)value;
+  UInt32 repeat = (velocity & 0x3F) << 3;
+  while (repeat != 0) {
+    value |= repeat;
+    repeat >>= 6;
+  }
+  return (UInt16)value;
+}
+
+inline UInt8 UMPDownscaleVelocity(UInt16 velocity) {
+  return (UInt8)(velocity >> 9);
+}
+
+#endif /* defined(__UniversalMIDIPacket__) */
@@ -0,0 +1,84 @@
+//
+//  VelocityCurve.h
+//  ChordTrigger
+//
+//  Note-on velocity transfer functions. A curve shape, a scale and an offset
+//  are baked into a 128-entry table whenever they change, so applying them
+//  on the render thread is a table lookup. Table entries are 16 bit; a MIDI
+//  1.0 velocity hits an entry exactly and a MIDI 2.0 velocity is
+//  interpolated between its two neighbours.
+//
+
+#ifndef __VelocityCurve__
+#define __VelocityCurve__
+
+#include <math.h>
+#include "UniversalMIDIPacket.h"
+
+// The power-law shapes follow CAVolumeCurve's transfer functions.
+enum {
+  kVelocityCurveLinear = 0,
+  kVelocityCurveSoft = 1,    // x^(1/2): quiet playing comes out louder
+  kVelocityCurveSofter = 2,  // x^(1/3)
+  kVelocityCurveHard = 3,    // x^2: quiet playing comes out quieter
+  kVelocityCurveHarder = 4,  // x^3
+  kVelocityCurveCount = 5
+};
+
+class VelocityTable {
+ public:
+  enum { kDefaultScale = 100 };
+
+  // The identity: the linear curve at the default scale and no offset.
+  VelocityTable() {
+    for (int i = 0; i < 128; i++) mTable[i] = UMPUpscaleVelocity(i);
+  }
+
+  // The curve's shape at each MIDI 1.0 velocity, 0..1. Computing it once
+  // lets several tables with the same curve skip the pow() calls.
+  static void Shape(int curve, double outShape[128]) {
+    static const double kExponents[kVelocityCurveCount] = {1., 1. / 2.,
+                                                           1. / 3., 2., 3.};
+    double exponent = kExponents[curve < 0 || curve >= kVelocityCurveCount
+                                     ? kVelocityCurveLinear
+                                     : curve];
+    for (int i = 0; i < 128; i++) {
+      double x = i / 127.;
+      outShape[i] = exponent != 1. ? pow(x, exponent) : x;
+    }
+  }
+
+  // |scalePercent| (0..200) scales the curve's output, then |offset|
+  // (-127..127, in MIDI 1.0 steps) is added. Note-ons never come out below
+  // velocity 1.
+  void Compute(const double inShape[128], int scalePercent, int offset) {
+    for (int i = 0; i < 128; i++) {
+      double v = 127. * inShape[i] * scalePercent / 100. + offset;
+      if (v > 127.) v = 127.;
+      if (v < (i > 0 ? 1. : 0.)) v = i > 0 ? 1. : 0.;
+      mTable[i] = To16Bit(v);
+    }
+  }
+
+  UInt16 Apply(UInt16 velocity) const {
+    int i = velocity >> 9;
+    int rest = velocity - UMPUpscaleVelocity(i);
+    if (rest <= 0 || i == 127) return mTable[i];
+    int span = UMPUpscaleVelocity(i + 1) - UMPUpscaleVelocity(i);
+    return (UInt16)(mTable[i] + (mTable[i + 1] - mTable[i]) * rest / span);
+  }
+
+ private:
+  // UMPUpscaleVelocity interpolated between whole values, so those land on
+  // exactly the 16-bit value they are scaled up to.
+  static UInt16 To16Bit(double v) {
+    int i = (int)v;
+    if (i >= 127) return UMPUpscaleVelocity(127);
+    double low = UMPUpscaleVelocity(i), high = UMPUpscaleVelocity(i + 1);
+    return (UInt16)(low + (high - low) * (v - i) + 0.5);
+  }
+
+  UInt16 mTable[128];
+};
+
+#endif /* defined(__VelocityCurve__) */
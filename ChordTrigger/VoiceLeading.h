@@ -0,0 +1,124 @@
+//
+//  VoiceLeading.h
+//  ChordTrigger
+//
+//  Picks the voicing of a chord that moves least from the chord played
+//  before it on the same channel. Candidates are the chord's inversions,
+//  each in three octave placements; inversion i lifts the members of pitch
+//  rank < i by an octave, so the ranks every map edit keeps in
+//  ChordMapEntry already describe all candidates. Movement is the sum over
+//  the candidate's notes of the distance to the nearest note of the
+//  previous voicing, read from a distance table rebuilt once per voiced
+//  chord. Choosing among the 3n voicings of an n-note chord takes 9n table
+//  loads and no allocation.
+//
+
+#ifndef __VoiceLeading__
+#define __VoiceLeading__
+
+#include "ChordMap.h"
+
+class VoiceLeader {
+ public:
+  enum { kPlacementCount = 3 };
+
+  VoiceLeader() {
+    for (int i = 0; i < kDistanceCount; i++) mDistance[i] = kOutOfRange;
+    Clear();
+  }
+
+  // Forgets the previous voicing; the next chord plays as mapped.
+  void Clear() { mHasPrevious = false; }
+
+  // Writes the voicing of |chord| closest to the previous one into
+  // |outVoiced| and remembers it for the next chord. Ties go to the mapped
+  // octave, then to the lower inversion, so an unchanged chord keeps its
+  // voicing.
+  void Lead(const ChordMapEntry &chord, ChordMapEntry &outVoiced) {
+    static const int kShifts[kPlacementCount] = {0, -12, 12};
+    int numNotes = chord.numNotes, bestInversion = 0, bestShift = 0;
+    UInt8 sorted[kChordMapMaxChordNotes], order[kChordMapMaxChordNotes];
+    for (int j = 0; j < numNotes; j++) {
+      sorted[chord.ranks[j]] = chord.notes[j];
+      order[chord.ranks[j]] = (UInt8)j;
+    }
+
+    if (mHasPrevious) {
+      // going from inversion i to i + 1 lifts the note of rank i, so each
+      // placement is one pass over the chord
+      UInt32 bestCost = kOutOfRange;
+      for (int s = 0; s < kPlacementCount; s++) {
+        const UInt16 *distance = &mDistance[kPadding + kShifts[s]];
+        UInt32 lifted = 0, rest = 0;
+        for (int rank = 0; rank < numNotes; rank++)
+          rest += distance[sorted[rank]];
+        for (int inversion = 0; inversion < numNotes; inversion++) {
+          if (lifted + rest < bestCost) {
+            bestCost = lifted + rest;
+            bestInversion = inversion;
+            bestShift = kShifts[s];
+          }
+          rest -= distance[sorted[inversion]];
+          lifted += distance[sorted[inversion] + 12];
+        }
+      }
+    }
+
+    // the voicing is two runs in pitch order, the unlifted notes and the
+    // lifted ones; merging them ranks it
+    UInt8 voicedSorted[kChordMapMaxChordNotes];
+    int unlifted = bestInversion, lifted = 0;
+    outVoiced.numNotes = (UInt8)numNotes;
+    for (int rank = 0; rank < numNotes; rank++) {
+      int from;
+      UInt8 note;
+      if (lifted == bestInversion ||
+          (unlifted < numNotes && sorted[unlifted] <= sorted[lifted] + 12)) {
+        from = unlifted++;
+        note = (UInt8)(sorted[from] + bestShift);
+      } else {
+        from = lifted++;
+        note = (UInt8)(sorted[from] + 12 + bestShift);
+      }
+      outVoiced.notes[order[from]] = note;
+      outVoiced.ranks[order[from]] = (UInt8)rank;
+      voicedSorted[rank] = note;
+    }
+    Remember(voicedSorted, numNotes);
+  }
+
+ private:
+  // Candidates reach from an octave below to two octaves above the mapped
+  // notes; anything outside 1..127 costs kOutOfRange, more than any voicing
+  // of in-range notes can add up to.
+  enum {
+    kPadding = 12,
+    kDistanceCount = kPadding + kChordMapNoteCount + 2 * 12,
+    kOutOfRange = 0x1000
+  };
+
+  // Every note from 1 to 127 is below, between or above the notes of the
+  // previous voicing, so each distance is one subtraction.
+  void Remember(const UInt8 *sorted, int numNotes) {
+    mHasPrevious = numNotes > 0;
+    if (!mHasPrevious) return;
+
+    UInt16 *distance = &mDistance[kPadding];
+    int note = 1;
+    for (; note < sorted[0]; note++) distance[note] = sorted[0] - note;
+    for (int rank = 1; rank < numNotes; rank++) {
+      int below = sorted[rank - 1], above = sorted[rank];
+      for (; note <= (below + above) / 2; note++) distance[note] = note - below;
+      for (; note < above; note++) distance[note] = above - note;
+    }
+    for (; note < kChordMapNoteCount; note++)
+      distance[note] = note - sorted[numNotes - 1];
+  }
+
+  bool mHasPrevious;
+  // semitones from note - kPadding to the nearest note of the previous
+  // voicing
+  UInt16 mDistance[kDistanceCount];
+};
+
+#endif /* defined(__VoiceLeading__) */
@@ -46,10 +46,32 @@
 */
 #include "CAAUMIDIMapManager.h"
 #include <AudioToolbox/AudioUnitUtilities.h>
+#include <unistd.h>
 
-CAAUMIDIMapManager::CAAUMIDIMapManager()
+CAAUMIDIMapManager::CAAUMIDIMapManager(AUBase &inBase)
+	: mAUBase(inBase)
 {	
-	hotMapping = false;	
+	hotMapping = 0;
+	mLearnedStatus = 0;
+	mLearnedData1 = 0;
+	mLearnPending = 0;
+	mAnyPending = 0;
+	mPublishedMapCount = 0;
+	mWorkerRunning = false;
+	mStopWorker = 0;
+	pthread_mutex_init(&mEditMutex, NULL);
+	pthread_mutex_init(&mNotifyMutex, NULL);
+}
+
+CAAUMIDIMapManager::~CAAUMIDIMapManager()
+{
+	if (mWorkerRunning) {
+		CAAtomicIncrement32Barrier(&mStopWorker);
+		mWake.Signal();
+		pthread_join(mWorkerThread, NULL);
+	}
+	pthread_mutex_destroy(&mNotifyMutex);
+	pthread_mutex_destroy(&mEditMutex);
 }
 
 static void FillInMap (CAAUMIDIMap &map, AUBase &That)
@@ -70,13 +92,24 @@ static void FillInMap (CAAUMIDIMap &map, AUBase &That)
 
 OSStatus	CAAUMIDIMapManager::SortedInsertToParamaterMaps	(AUParameterMIDIMapping *maps, UInt32 inNumMaps, AUBase &That)
 {	
+	pthread_mutex_lock(&mEditMutex);
+	InsertMaps(maps, inNumMaps, That);
+	StartWorker();
+	pthread_mutex_unlock(&mEditMutex);
+	
+	return noErr;
+}
+
+	// called holding mEditMutex
+void	CAAUMIDIMapManager::InsertMaps(const AUParameterMIDIMapping *maps, UInt32 inNumMaps, AUBase &That)
+{
 	for (unsigned int i = 0; i < inNumMaps; ++i) 
 	{
 		CAAUMIDIMap map(maps[i]);
 
 		FillInMap (map, That);
 		
-		int idx = FindParameterIndex (maps[i]);
+		int idx = FindParameterIndex (map);
 		if (idx > -1)
 			mParameterMaps.erase(mParameterMaps.begin() + idx);
 
@@ -85,22 +118,22 @@ OSStatus	CAAUMIDIMapManager::SortedInsertToParamaterMaps	(AUParameterMIDIMapping
 	}
 	
 	std::sort(mParameterMaps.begin(), mParameterMaps.end(), CompareMIDIMap());	
-	
-	return noErr;
+	PublishIndex();
 }
 
 void CAAUMIDIMapManager::GetHotParameterMap(AUParameterMIDIMapping &outMap )
 {
+	pthread_mutex_lock(&mEditMutex);
 	outMap = mHotMap;
+	pthread_mutex_unlock(&mEditMutex);
 }
 
 void CAAUMIDIMapManager::SortedRemoveFromParameterMaps(AUParameterMIDIMapping *maps, UInt32 inNumMaps, bool &outMapDidChange)
 {	
-	if (hotMapping) {
-		hotMapping = false;
-	}
+	CAAtomicCompareAndSwap32Barrier(1, 0, &hotMapping);
 
 	outMapDidChange = false;
+	pthread_mutex_lock(&mEditMutex);
 	for (unsigned int i = 0; i < inNumMaps; ++i) {
 		int idx = FindParameterIndex (maps[i]);
 		if (idx > -1) {
@@ -109,10 +142,14 @@ void CAAUMIDIMapManager::SortedRemoveFromParameterMaps(AUParameterMIDIMapping *m
 			outMapDidChange = true;
 		}
 	}
+	if (outMapDidChange)
+		PublishIndex();
+	pthread_mutex_unlock(&mEditMutex);
 }
 
 void	CAAUMIDIMapManager::ReplaceAllMaps (AUParameterMIDIMapping* inMappings, UInt32 inNumMaps, AUBase &That)
 {
+	pthread_mutex_lock(&mEditMutex);
 	mParameterMaps.clear();
 
 	for (unsigned int i = 0; i < inNumMaps; ++i) {
@@ -123,26 +160,53 @@ void	CAAUMIDIMapManager::ReplaceAllMaps (AUParameterMIDIMapping* inMappings, UIn
 	}
 
 	std::sort(mParameterMaps.begin(),mParameterMaps.end(), CompareMIDIMap());	
+	PublishIndex();
+	StartWorker();
+	pthread_mutex_unlock(&mEditMutex);
+}
+
+void	CAAUMIDIMapManager::SetHotMapping (AUParameterMIDIMapping &inMap)
+{
+	pthread_mutex_lock(&mEditMutex);
+	mHotMap = inMap;
+	StartWorker();
+	pthread_mutex_unlock(&mEditMutex);
+	CAAtomicCompareAndSwap32Barrier(0, 1, &hotMapping);
 }
 
 bool CAAUMIDIMapManager::HandleHotMapping(UInt8 	inStatus,
 										  UInt8 	inChannel,
 										  UInt8 	inData1,
-										  AUBase	&That)
+										  AUBase	&/*That*/)
 { //used to set the hot map info
 
 	if (inStatus == 0xf0) return false;
 	
-	if (!hotMapping) return false;
-	hotMapping = false;
+	if (!hotMapping || !CAAtomicCompareAndSwap32Barrier(1, 0, &hotMapping)) return false;
 
-	mHotMap.mStatus = inStatus | inChannel;  
-	mHotMap.mData1 = inData1; 
-		
-	SortedInsertToParamaterMaps (&mHotMap, 1, That);
+	mLearnedStatus = inStatus | inChannel;  
+	mLearnedData1 = inData1; 
+	
+		// inserting allocates, so it is left to the worker
+	CAAtomicCompareAndSwap32Barrier(0, 1, &mLearnPending);
+	mWake.Signal();
 	return true;
 }
 
+void CAAUMIDIMapManager::LearnHotMapping()
+{
+	if (!CAAtomicCompareAndSwap32Barrier(1, 0, &mLearnPending))
+		return;
+	
+	pthread_mutex_lock(&mEditMutex);
+	mHotMap.mStatus = mLearnedStatus;
+	mHotMap.mData1 = mLearnedData1;
+	InsertMaps(&mHotMap, 1, mAUBase);
+	pthread_mutex_unlock(&mEditMutex);
+	
+	mAUBase.PropertyChanged (kAudioUnitProperty_HotMapParameterMIDIMapping, kAudioUnitScope_Global, 0);
+}
+
 #if DEBUG
 
 void CAAUMIDIMapManager::Print()
@@ -155,13 +219,23 @@ void CAAUMIDIMapManager::Print()
 
 #endif // DEBUG
 
+UInt32 CAAUMIDIMapManager::NumMaps()
+{
+	pthread_mutex_lock(&mEditMutex);
+	UInt32 numMaps = static_cast<UInt32>(mParameterMaps.size());
+	pthread_mutex_unlock(&mEditMutex);
+	return numMaps;
+}
+
 void CAAUMIDIMapManager::GetMaps(AUParameterMIDIMapping* maps)
 {
+	pthread_mutex_lock(&mEditMutex);
 	int i = 0;
 	for ( ParameterMaps::iterator iter = mParameterMaps.begin(); iter < mParameterMaps.end(); ++iter, ++i) { 
 		AUParameterMIDIMapping &listmap =  (*iter);	
 		maps[i] = listmap;	
 	}
+	pthread_mutex_unlock(&mEditMutex);
 }
 
 int CAAUMIDIMapManager::FindParameterIndex (AUParameterMIDIMapping &inMap)
@@ -181,6 +255,138 @@ int CAAUMIDIMapManager::FindParameterIndex (AUParameterMIDIMapping &inMap)
 	}
 	return -1;
 }
+enum { kIndexChannels = 16, kIndexData1Values = 128, kIndexKeys = 7 * kIndexChannels * kIndexData1Values };
+
+	// note off (0x80) through pitch bend (0xE0)
+static inline UInt32 IndexKey(UInt8 inStatus, UInt8 inChannel, UInt8 inData1)
+{
+	return (((inStatus >> 4) - 8) * kIndexChannels + inChannel) * kIndexData1Values + inData1;
+}
+
+	// The channels and data1 values of the messages a map can match. Maps that
+	// ignore the note number, or use it as the value, are entered for all of them.
+static bool IndexRange(const CAAUMIDIMap &inMap, UInt8 &outFirstChannel, UInt8 &outLastChannel,
+												 UInt8 &outFirstData1, UInt8 &outLastData1)
+{
+	if (inMap.mStatus < 0x80 || inMap.mStatus >= 0xF0)
+		return false;
+	
+	outFirstChannel = inMap.IsAnyChannel() ? 0 : (inMap.mStatus & 0xF);
+	outLastChannel = inMap.IsAnyChannel() ? kIndexChannels - 1 : outFirstChannel;
+	
+	if (inMap.IsKeyEvent() && (inMap.IsAnyNote() || inMap.IsBipolar())) {
+		outFirstData1 = 0;
+		outLastData1 = kIndexData1Values - 1;
+	} else if (inMap.IsChannelPressure() || inMap.IsPitchBend()) {
+		outFirstData1 = outLastData1 = 0;
+	} else {
+		if (inMap.mData1 >= kIndexData1Values)
+			return false;
+		outFirstData1 = outLastData1 = inMap.mData1;
+	}
+	return true;
+}
+
+	// Called holding mEditMutex. Builds the index of the current maps off the
+	// render thread and swaps it in whole.
+void CAAUMIDIMapManager::PublishIndex()
+{
+	MatchIndex *index = new MatchIndex;
+	index->mMaps = mParameterMaps;
+	const ParameterMaps &maps = index->mMaps;
+	std::vector<UInt32> &matchStart = index->mMatchStart;
+	UInt8 firstChannel, lastChannel, firstData1, lastData1;
+	
+	if (!maps.empty()) {
+		matchStart.assign(kIndexKeys + 1, 0);
+		for (ParameterMaps::const_iterator i = maps.begin(); i < maps.end(); ++i) {
+			if (!IndexRange(*i, firstChannel, lastChannel, firstData1, lastData1))
+				continue;
+			for (UInt8 ch = firstChannel; ch <= lastChannel; ++ch)
+				for (UInt8 d = firstData1; d <= lastData1; ++d)
+					matchStart[IndexKey(i->mStatus, ch, d) + 1]++;
+		}
+		for (UInt32 key = 0; key < kIndexKeys; ++key)
+			matchStart[key + 1] += matchStart[key];
+		
+		index->mMatches.resize(matchStart[kIndexKeys]);
+		std::vector<UInt32> next(matchStart.begin(), matchStart.end() - 1);
+		for (UInt32 idx = 0; idx < maps.size(); ++idx) {
+			const CAAUMIDIMap &map = maps[idx];
+			if (!IndexRange(map, firstChannel, lastChannel, firstData1, lastData1))
+				continue;
+			for (UInt8 ch = firstChannel; ch <= lastChannel; ++ch)
+				for (UInt8 d = firstData1; d <= lastData1; ++d)
+					index->mMatches[next[IndexKey(map.mStatus, ch, d)]++] = idx;
+		}
+	}
+	
+		// one notified parameter for all the maps of a parameter
+	index->mMapPending.resize(maps.size());
+	pthread_mutex_lock(&mNotifyMutex);
+	for (UInt32 idx = 0; idx < maps.size(); ++idx) {
+		const CAAUMIDIMap &map = maps[idx];
+		std::deque<NotifiedParameter>::iterator p = mNotifiedParameters.begin();
+		while (p != mNotifiedParameters.end() && !(p->mParameterID == map.mParameterID &&
+												   p->mScope == map.mScope &&
+												   p->mElement == map.mElement))
+			++p;
+		if (p == mNotifiedParameters.end()) {
+			NotifiedParameter param = { map.mScope, map.mElement, map.mParameterID, 0 };
+			mNotifiedParameters.push_back(param);
+			p = mNotifiedParameters.end() - 1;
+		}
+		index->mMapPending[idx] = &p->mPending;
+	}
+	pthread_mutex_unlock(&mNotifyMutex);
+	
+	mIndexPublisher.Publish(index);
+	mPublishedMapCount = static_cast<SInt32>(maps.size());
+}
+
+	// Called holding mEditMutex; never on the render thread.
+void CAAUMIDIMapManager::StartWorker()
+{
+	if (!mWorkerRunning)
+		mWorkerRunning = pthread_create(&mWorkerThread, NULL, WorkerEntry, this) == 0;
+}
+
+void *CAAUMIDIMapManager::WorkerEntry(void *inManager)
+{
+	CAAUMIDIMapManager *This = static_cast<CAAUMIDIMapManager *>(inManager);
+	for (;;) {
+		This->mWake.Wait();
+		if (CAAtomicAdd32Barrier(0, &This->mStopWorker) != 0)
+			break;
+		This->LearnHotMapping();
+		if (This->SendPendingNotifications())
+			usleep(kNotifyIntervalMicros);
+	}
+	return NULL;
+}
+
+	// Returns false if nothing was pending.
+bool CAAUMIDIMapManager::SendPendingNotifications()
+{
+	if (!CAAtomicCompareAndSwap32Barrier(1, 0, &mAnyPending))
+		return false;
+	
+	AudioUnitEvent event;
+	event.mEventType = kAudioUnitEvent_ParameterValueChange;
+	event.mArgument.mParameter.mAudioUnit = mAUBase.GetComponentInstance();
+	
+	pthread_mutex_lock(&mNotifyMutex);
+	for (std::deque<NotifiedParameter>::iterator p = mNotifiedParameters.begin(); p != mNotifiedParameters.end(); ++p) {
+		if (!CAAtomicCompareAndSwap32Barrier(1, 0, &p->mPending))
+			continue;
+		event.mArgument.mParameter.mParameterID = p->mParameterID;
+		event.mArgument.mParameter.mScope = p->mScope;
+		event.mArgument.mParameter.mElement = p->mElement;
+		AUEventListenerNotify(NULL, NULL, &event);
+	}
+	pthread_mutex_unlock(&mNotifyMutex);
+	return true;
+}
 
 bool CAAUMIDIMapManager::FindParameterMapEventMatch(	UInt8			inStatus,
 														UInt8			inChannel,
@@ -191,43 +397,34 @@ bool CAAUMIDIMapManager::FindParameterMapEventMatch(	UInt8			inStatus,
 {
 	bool ret_value = false;
 
+	inStatus &= 0xF0;
 	if (inStatus == 0x90 && !inData2)
-		inStatus = 0x80 | inChannel;
+		inStatus = 0x80;
+	if (inStatus < 0x80 || inStatus >= 0xF0)
+		return false;
 	
-	//used to test for midi matches once map is made
-	CAAUMIDIMap tempMap;
-	tempMap.mStatus = inStatus | inChannel;
-	tempMap.mData1 = inData1;
-	
-	CompareMIDIMap compareObj;
-
-	AudioUnitEvent event;
-	event.mEventType = kAudioUnitEvent_ParameterValueChange;
-	event.mArgument.mParameter.mAudioUnit = inAUBase.GetComponentInstance();
-	
-	ParameterMaps::iterator lower_iter = 
-	std::lower_bound(mParameterMaps.begin(), mParameterMaps.end(), tempMap, compareObj);
-	
-	while (lower_iter < mParameterMaps.end()) 
-	{
-		CAAUMIDIMap & map = (*lower_iter);
-		if (compareObj.Finish(map, tempMap)) 
-			break;
-		
-		Float32 value;
-		if (map.MIDI_Matches(inChannel, inData1, inData2, value))
-		{	
-			inAUBase.SetParameter ( map.mParameterID, map.mScope, map.mElement, 
-									map.ParamValueFromMIDILinear(value), inBufferOffset);
-
-			event.mArgument.mParameter.mParameterID = map.mParameterID;
-			event.mArgument.mParameter.mScope = map.mScope;
-			event.mArgument.mParameter.mElement = map.mElement;
+	const MatchIndex *index = mIndexPublisher.Pin();
+	if (index && !index->mMatchStart.empty()) {
+		UInt32 key = IndexKey(inStatus, inChannel & 0xF, inStatus >= 0xD0 ? 0 : (inData1 & 0x7F));
+		for (UInt32 i = index->mMatchStart[key]; i < index->mMatchStart[key + 1]; ++i)
+		{
+			UInt32 idx = index->mMatches[i];
+			const CAAUMIDIMap & map = index->mMaps[idx];
 			
-			AUEventListenerNotify(NULL, NULL, &event);
-			ret_value = true;
+			Float32 value;
+			if (map.MIDI_Matches(inChannel, inData1, inData2, value))
+			{	
+				inAUBase.SetParameter ( map.mParameterID, map.mScope, map.mElement, 
+										map.ParamValueFromMIDILinear(value), inBufferOffset);
+				
+					// the worker thread tells the listeners
+				if (CAAtomicCompareAndSwap32Barrier(0, 1, index->mMapPending[idx]) &&
+					CAAtomicCompareAndSwap32Barrier(0, 1, &mAnyPending))
+					mWake.Signal();
+				ret_value = true;
+			}
 		}
-		++lower_iter;
 	}
+	mIndexPublisher.Unpin();
 	return ret_value;
 }
@@ -49,24 +49,90 @@
 
 #include "AUBase.h"
 #include "CAAUMIDIMap.h"
+#include "CAAtomic.h"
+#include "CASemaphore.h"
+#include "CASnapshotPublisher.h"
+#include <pthread.h>
+#include <deque>
 #include <vector>
 #include <AudioToolbox/AudioUnitUtilities.h>
 
+	// The maps are edited on the UI side under mEditMutex. The render thread
+	// never takes a lock: it matches events against an immutable MatchIndex
+	// published with each edit, and leaves everything that allocates or blocks
+	// (learning a hot map, rebuilding the index, notifying listeners) to a
+	// worker thread it wakes with a semaphore.
 class CAAUMIDIMapManager {
 		
 protected:
 	
 	typedef std::vector<CAAUMIDIMap>	ParameterMaps;
-	ParameterMaps						mParameterMaps;
+	ParameterMaps						mParameterMaps;		// guarded by mEditMutex
+	pthread_mutex_t						mEditMutex;
 	
-	bool								hotMapping;
-	AUParameterMIDIMapping				mHotMap;
+	volatile SInt32						hotMapping;
+	AUParameterMIDIMapping				mHotMap;			// guarded by mEditMutex
+	
+		// The message HandleHotMapping learned, for the worker to insert.
+	UInt8								mLearnedStatus;
+	UInt8								mLearnedData1;
+	volatile SInt32						mLearnPending;
+	
+		// Parameter change notifications are not sent from the render thread. A
+		// match raises the pending flag of its parameter, and the worker thread
+		// sends one notification per raised flag. Parameters are only ever added,
+		// and a deque does not move its elements, so the flags stay where the
+		// published indexes point.
+	struct NotifiedParameter {
+		AudioUnitScope			mScope;
+		AudioUnitElement		mElement;
+		AudioUnitParameterID	mParameterID;
+		volatile SInt32			mPending;
+	};
+	std::deque<NotifiedParameter>		mNotifiedParameters;	// guarded by mNotifyMutex
+	volatile SInt32						mAnyPending;
+	pthread_mutex_t						mNotifyMutex;
+	
+		// What the render thread matches against, never changed once published.
+		// Direct index from a channel message to the maps it can match: for each
+		// message type, channel and data1 (0 for channel pressure and pitch bend),
+		// mMatches[mMatchStart[key]] up to mMatches[mMatchStart[key + 1]] are the
+		// indices of the maps to try.
+	struct MatchIndex {
+		ParameterMaps					mMaps;
+		std::vector<volatile SInt32 *>	mMapPending;	// per map, the pending flag of its parameter
+		std::vector<UInt32>				mMatchStart;
+		std::vector<UInt32>				mMatches;
+		
+		MatchIndex *					mNext;			// for CASnapshotPublisher
+		UInt32							mRetiredEpoch;
+	};
+	CASnapshotPublisher<MatchIndex>		mIndexPublisher;
+	volatile SInt32						mPublishedMapCount;
+	
+	AUBase &							mAUBase;
+	pthread_t							mWorkerThread;
+	bool								mWorkerRunning;		// guarded by mEditMutex
+	volatile SInt32						mStopWorker;
+	CASemaphore							mWake;
+	
+		// after sending, the worker waits this long so a stream of changes
+		// to a parameter is coalesced into one notification per interval
+	enum { kNotifyIntervalMicros = 10000 };
+	
+	void					InsertMaps(const AUParameterMIDIMapping *maps, UInt32 inNumMaps, AUBase &That);
+	void					PublishIndex();
+	void					StartWorker();
+	void					LearnHotMapping();
+	bool					SendPendingNotifications();
+	static void *			WorkerEntry(void *inManager);
 	
 public:
 					
-							CAAUMIDIMapManager();
+							CAAUMIDIMapManager(AUBase &inBase);
+							~CAAUMIDIMapManager();
 	
-	UInt32					NumMaps(){return static_cast<UInt32>(mParameterMaps.size());}
+	UInt32					NumMaps();
 	void					GetMaps(AUParameterMIDIMapping* maps);
 	
 	int						FindParameterIndex(AUParameterMIDIMapping &map);
@@ -78,15 +144,23 @@ public:
 	
 	void					ReplaceAllMaps (AUParameterMIDIMapping* inMappings, UInt32 inNumMaps, AUBase &That);
 	
-	bool					IsHotMapping(){return hotMapping;}
-	void					SetHotMapping (AUParameterMIDIMapping &inMap){hotMapping = true; mHotMap = inMap; }
+	bool					IsHotMapping(){return CAAtomicAdd32Barrier(0, &hotMapping) != 0;}
 	
+		// Render thread. False while there is nothing to match or learn, so a
+		// caller may skip HandleHotMapping and FindParameterMapEventMatch. A
+		// stale answer only delays a map by one call.
+	bool					HasActiveMappings(){return mPublishedMapCount != 0 || hotMapping != 0;}
+	void					SetHotMapping (AUParameterMIDIMapping &inMap);
+	
+		// Render thread. Takes the message as the hot map's and returns true if
+		// hot mapping is armed; the worker thread inserts the map and announces
+		// kAudioUnitProperty_HotMapParameterMIDIMapping.
 	bool					HandleHotMapping(	UInt8 	inStatus,
 												UInt8 	inChannel,
 												UInt8 	inData1,
 												AUBase	&That);
 	
-		
+		// Render thread; only one thread may call it at a time.
 	bool					FindParameterMapEventMatch(UInt8 	inStatus,
 													   UInt8 	inChannel,
 													   UInt8 	inData1,
@@ -0,0 +1,51 @@
+/*
+     File: CASemaphore.h
+ Abstract: Counting semaphore for waking a worker thread from the render thread
+
+ Signal() makes a single system call and neither allocates nor blocks, so
+ it may be called on the render thread. Wait() blocks until the count is
+ positive and then decrements it; signals that arrive while nobody waits
+ are kept, so a wakeup is never lost, only possibly merged with the next.
+
+ Uses a Mach semaphore on OS X and a POSIX unnamed semaphore elsewhere
+ (OS X does not implement sem_init).
+*/
+#ifndef __CASemaphore_h__
+#define __CASemaphore_h__
+
+#if __APPLE__
+	#include <mach/mach.h>
+	#include <mach/semaphore.h>
+#else
+	#include <semaphore.h>
+	#include <errno.h>
+#endif
+
+class CASemaphore {
+public:
+#if __APPLE__
+					CASemaphore() { semaphore_create(mach_task_self(), &mSemaphore, SYNC_POLICY_FIFO, 0); }
+					~CASemaphore() { semaphore_destroy(mach_task_self(), mSemaphore); }
+
+	void			Signal() { semaphore_signal(mSemaphore); }
+	void			Wait() { while (semaphore_wait(mSemaphore) == KERN_ABORTED) {} }
+#else
+					CASemaphore() { sem_init(&mSemaphore, 0, 0); }
+					~CASemaphore() { sem_destroy(&mSemaphore); }
+
+	void			Signal() { sem_post(&mSemaphore); }
+	void			Wait() { while (sem_wait(&mSemaphore) != 0 && errno == EINTR) {} }
+#endif
+
+private:
+					CASemaphore(const CASemaphore &);
+	CASemaphore &	operator=(const CASemaphore &);
+
+#if __APPLE__
+	semaphore_t		mSemaphore;
+#else
+	sem_t			mSemaphore;
+#endif
+};
+
+#endif
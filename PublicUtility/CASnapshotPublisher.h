@@ -0,0 +1,106 @@
+/*
+     File: CASnapshotPublisher.h
+ Abstract: Lock-free publication of immutable snapshots to the render thread
+
+ Editing threads publish immutable snapshots to the render thread with a
+ single pointer swap, so the render thread never sees a half-made edit and
+ never takes a lock.
+
+ Reclamation is RCU-style with epochs. Every swap advances an epoch
+ counter and tags the replaced snapshot with the new epoch. The render
+ thread pins for as long as it uses a snapshot by announcing the epoch it
+ saw before loading the current one, so it can only hold a snapshot
+ retired after that epoch. The editing side frees every retired snapshot
+ tagged up to the announced epoch, or all of them while nothing is pinned;
+ each publish therefore frees what earlier pins were done with, even if
+ the render thread is pinned at that moment.
+
+ Supports a single reader thread. SNAPSHOT must make the publisher a
+ friend and provide the retired-list fields
+
+	SNAPSHOT *	mNext;
+	UInt32		mRetiredEpoch;
+*/
+#ifndef __CASnapshotPublisher_h__
+#define __CASnapshotPublisher_h__
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <stddef.h>
+
+template <class SNAPSHOT>
+class CASnapshotPublisher {
+public:
+					CASnapshotPublisher() : mCurrent(NULL), mRetired(NULL), mEpoch(1), mReaderEpoch(kUnpinned) {}
+					~CASnapshotPublisher() { FreeRetired(mRetired); delete mCurrent; }
+
+		// Render thread. Every Pin() must be matched by an Unpin(); the returned
+		// snapshot stays valid in between. NULL until the first Publish().
+	const SNAPSHOT *	Pin()
+	{
+			// announced before the load: Reclaim() either sees this pin, or ran
+			// before it, in which case the load can only see the newer snapshot
+		__atomic_store_n(&mReaderEpoch, __atomic_load_n(&mEpoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+		return __atomic_load_n(&mCurrent, __ATOMIC_SEQ_CST);
+	}
+
+		// release is enough: a Reclaim() that sees the unpin also sees that
+		// the reader is done with the snapshot
+	void			Unpin() { __atomic_store_n(&mReaderEpoch, (UInt32)kUnpinned, __ATOMIC_RELEASE); }
+
+		// Editing side. Calls must be serialized with each other, not with the
+		// render thread.
+	void			Publish(SNAPSHOT *inSnapshot)
+	{
+		SNAPSHOT *old = __atomic_exchange_n(&mCurrent, inSnapshot, __ATOMIC_SEQ_CST);
+		if (old) {
+				// a pin that sees the advanced epoch loads after the swap
+			old->mRetiredEpoch = __atomic_add_fetch(&mEpoch, 2, __ATOMIC_SEQ_CST);
+			old->mNext = mRetired;
+			mRetired = old;
+		}
+		Reclaim();
+	}
+
+		// Frees the retired snapshots the reader can no longer hold. Editing side.
+	void			Reclaim()
+	{
+		if (mRetired == NULL)
+			return;
+		UInt32 reader = __atomic_load_n(&mReaderEpoch, __ATOMIC_SEQ_CST);
+		if (reader == kUnpinned) {
+			FreeRetired(mRetired);
+			mRetired = NULL;
+			return;
+		}
+			// the list is newest first, so everything from the first snapshot
+			// retired by the reader's epoch on can go
+		SNAPSHOT **link = &mRetired;
+		while (*link && (SInt32)((*link)->mRetiredEpoch - reader) > 0)
+			link = &(*link)->mNext;
+		FreeRetired(*link);
+		*link = NULL;
+	}
+
+private:
+		// Epochs are odd, so they never wrap to kUnpinned.
+	enum { kUnpinned = 0 };
+
+	static void		FreeRetired(SNAPSHOT *inSnapshot)
+	{
+		while (inSnapshot) {
+			SNAPSHOT *next = inSnapshot->mNext;
+			delete inSnapshot;
+			inSnapshot = next;
+		}
+	}
+
+					CASnapshotPublisher(const CASnapshotPublisher &);
+	CASnapshotPublisher &	operator=(const CASnapshotPublisher &);
+
+	SNAPSHOT *		mCurrent;
+	SNAPSHOT *		mRetired;
+	UInt32			mEpoch;
+	UInt32			mReaderEpoch;	// epoch seen by the current pin, or kUnpinned
+};
+
+#endif